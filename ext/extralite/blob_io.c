@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "extralite.h"
+
+/*
+ * Document-class: Extralite::BlobIO
+ *
+ * This class implements incremental I/O on a BLOB stored in a database, as
+ * returned by `Database#blob_open`. Blob contents are read and written in
+ * chunks with the GVL released, without loading the entire blob into memory.
+ * A `BlobIO` can be used as either source or destination with
+ * `IO.copy_stream`:
+ *
+ *     db.blob_open('attachments', 'data', id) do |blob|
+ *       IO.copy_stream(blob, response)
+ *     end
+ *
+ * Note that the size of a blob cannot be changed using a `BlobIO`. In order to
+ * write a blob, first set its size using `zeroblob`:
+ *
+ *     db.execute('insert into attachments (data) values (zeroblob(?))', File.size(fn))
+ *     db.blob_open('attachments', 'data', db.last_insert_rowid, 'w') do |blob|
+ *       File.open(fn, 'rb') { |f| IO.copy_stream(f, blob) }
+ *     end
+ */
+
+VALUE cBlobIO;
+
+#define BLOB_IO_CHUNK_SIZE 65536
+
+VALUE BlobIO_close(VALUE self);
+
+typedef struct {
+  VALUE           db;
+  Database_t      *db_struct;
+  sqlite3         *sqlite3_db;
+  sqlite3_blob    *blob;
+  int             size;
+  int             pos;
+  int             writable;
+
+  // set while reading or writing with the GVL released
+  int             busy;
+} BlobIO_t;
+
+static size_t BlobIO_size(const void *ptr) {
+  return sizeof(BlobIO_t);
+}
+
+static void BlobIO_mark(void *ptr) {
+  BlobIO_t *blob_io = ptr;
+  rb_gc_mark_movable(blob_io->db);
+}
+
+static void BlobIO_compact(void *ptr) {
+  BlobIO_t *blob_io = ptr;
+  blob_io->db = rb_gc_location(blob_io->db);
+}
+
+static void BlobIO_free(void *ptr) {
+  BlobIO_t *blob_io = ptr;
+  if (blob_io->blob) {
+    connection_release_handle(blob_io->sqlite3_db);
+    sqlite3_blob_close(blob_io->blob);
+  }
+  free(ptr);
+}
+
+static const rb_data_type_t BlobIO_type = {
+    "BlobIO",
+    {BlobIO_mark, BlobIO_free, BlobIO_size, BlobIO_compact},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE BlobIO_allocate(VALUE klass) {
+  BlobIO_t *blob_io = ALLOC(BlobIO_t);
+  memset(blob_io, 0, sizeof(BlobIO_t));
+  blob_io->db = Qnil;
+  return TypedData_Wrap_Struct(klass, &BlobIO_type, blob_io);
+}
+
+static inline BlobIO_t *self_to_blob_io(VALUE obj) {
+  BlobIO_t *blob_io;
+  TypedData_Get_Struct((obj), BlobIO_t, &BlobIO_type, (blob_io));
+  return blob_io;
+}
+
+static inline BlobIO_t *self_to_open_blob_io(VALUE obj) {
+  BlobIO_t *blob_io = self_to_blob_io(obj);
+  if (!blob_io->blob) rb_raise(cError, "Blob is closed");
+  if (!blob_io->db_struct->sqlite3_db) rb_raise(cError, "Database is closed");
+  return blob_io;
+}
+
+static inline void blob_io_raise(BlobIO_t *blob_io, int rc) {
+  if (rc == SQLITE_ABORT)
+    rb_raise(cError, "Blob has been invalidated by a change to its row");
+  rb_raise(cError, "%s", sqlite3_errmsg(blob_io->db_struct->sqlite3_db));
+}
+
+struct blob_io_ctx {
+  sqlite3_blob  *blob;
+  char          *ptr;
+  int           len;
+  int           offset;
+  int           rc;
+};
+
+static void *blob_io_read_impl(void *ptr) {
+  struct blob_io_ctx *ctx = ptr;
+  ctx->rc = sqlite3_blob_read(ctx->blob, ctx->ptr, ctx->len, ctx->offset);
+  return NULL;
+}
+
+static void *blob_io_write_impl(void *ptr) {
+  struct blob_io_ctx *ctx = ptr;
+  ctx->rc = sqlite3_blob_write(ctx->blob, ctx->ptr, ctx->len, ctx->offset);
+  return NULL;
+}
+
+static inline void blob_io_check_idle(BlobIO_t *blob_io) {
+  if (blob_io->busy) rb_raise(cError, "Blob is in use by another thread");
+}
+
+struct blob_io_transfer_args {
+  BlobIO_t  *blob_io;
+  char      *ptr;
+  int       len;
+  void      *(*fn)(void *);
+};
+
+static VALUE blob_io_transfer_chunks(VALUE ptr) {
+  struct blob_io_transfer_args *args = (struct blob_io_transfer_args *)ptr;
+  BlobIO_t *blob_io = args->blob_io;
+  struct blob_io_ctx ctx = { blob_io->blob, NULL, 0, 0, SQLITE_OK };
+  enum gvl_mode mode = Database_prepare_gvl_mode(blob_io->db_struct);
+  int done = 0;
+
+  while (done < args->len) {
+    ctx.ptr = args->ptr + done;
+    ctx.len = args->len - done > BLOB_IO_CHUNK_SIZE ? BLOB_IO_CHUNK_SIZE : args->len - done;
+    ctx.offset = blob_io->pos;
+    gvl_call(mode, args->fn, (void *)&ctx);
+    if (ctx.rc != SQLITE_OK) blob_io_raise(blob_io, ctx.rc);
+
+    done += ctx.len;
+    blob_io->pos += ctx.len;
+  }
+  return Qnil;
+}
+
+static VALUE blob_io_transfer_done(VALUE ptr) {
+  ((BlobIO_t *)ptr)->busy = 0;
+  return Qnil;
+}
+
+// Reads or writes len bytes at the current position in chunks, releasing the
+// GVL for each chunk. The blob is marked as busy for the duration of the
+// transfer, so it cannot be closed or reopened by another thread in between
+// chunks.
+static void blob_io_transfer(BlobIO_t *blob_io, char *ptr, int len, void *(*fn)(void *)) {
+  blob_io_check_idle(blob_io);
+
+  struct blob_io_transfer_args args = { blob_io, ptr, len, fn };
+  blob_io->busy = 1;
+  rb_ensure(blob_io_transfer_chunks, (VALUE)&args, blob_io_transfer_done, (VALUE)blob_io);
+}
+
+struct blob_io_read_args {
+  BlobIO_t  *blob_io;
+  VALUE     buf;
+  int       len;
+};
+
+static VALUE blob_io_read_into(VALUE ptr) {
+  struct blob_io_read_args *args = (struct blob_io_read_args *)ptr;
+  blob_io_transfer(args->blob_io, RSTRING_PTR(args->buf), args->len, blob_io_read_impl);
+  return Qnil;
+}
+
+/* Opens the blob stored in the given table, column and row for incremental
+ * I/O. The mode is either `'r'` (the default) for reading, or `'w'` for
+ * reading and writing. If a block is given, the blob is passed to the block
+ * and closed when the block returns, and the block's return value is
+ * returned.
+ *
+ *     db.blob_open('attachments', 'data', id) { |blob| blob.read(1024) }
+ *
+ * @overload blob_open(table, column, rowid, mode = 'r', db_name = 'main')
+ * @param table [String, Symbol] table name
+ * @param column [String, Symbol] column name
+ * @param rowid [Integer] row id
+ * @param mode [String] open mode (`'r'` or `'w'`)
+ * @param db_name [String] database name (default: "main")
+ * @return [Extralite::BlobIO, any] blob or block's return value
+ */
+VALUE Database_blob_open(int argc, VALUE *argv, VALUE self) {
+  VALUE table, column, rowid, mode, db_name;
+  rb_scan_args(argc, argv, "32", &table, &column, &rowid, &mode, &db_name);
+
+  Database_t *db = self_to_database(self);
+  if (!db->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  int writable = 0;
+  if (!NIL_P(mode)) {
+    const char *m = StringValueCStr(mode);
+    if (!strcmp(m, "w") || !strcmp(m, "r+"))
+      writable = 1;
+    else if (strcmp(m, "r"))
+      rb_raise(rb_eArgError, "Invalid blob mode: %s", m);
+  }
+
+  table = rb_funcall(table, ID_to_s, 0);
+  column = rb_funcall(column, ID_to_s, 0);
+  VALUE obj = rb_obj_alloc(cBlobIO);
+  BlobIO_t *blob_io = self_to_blob_io(obj);
+  RB_OBJ_WRITE(obj, &blob_io->db, self);
+  blob_io->db_struct = db;
+  blob_io->sqlite3_db = db->sqlite3_db;
+  blob_io->writable = writable;
+
+  int rc = sqlite3_blob_open(
+    db->sqlite3_db, NIL_P(db_name) ? "main" : StringValueCStr(db_name),
+    StringValueCStr(table), StringValueCStr(column), NUM2LL(rowid), writable,
+    &blob_io->blob
+  );
+  if (rc != SQLITE_OK) {
+    blob_io->blob = NULL;
+    rb_raise(cError, "%s", sqlite3_errmsg(db->sqlite3_db));
+  }
+  blob_io->size = sqlite3_blob_bytes(blob_io->blob);
+
+  RB_GC_GUARD(table);
+  RB_GC_GUARD(column);
+  if (rb_block_given_p())
+    return rb_ensure(rb_yield, obj, BlobIO_close, obj);
+  return obj;
+}
+
+/* Reads up to length bytes from the current position. If length is nil, reads
+ * until the end of the blob. Following the semantics of `IO#read`, returns nil
+ * at the end of the blob if length is given, or an empty string otherwise. If
+ * an output buffer is given, the data is read into it.
+ *
+ * @param length [Integer, nil] number of bytes to read
+ * @param outbuf [String, nil] output buffer
+ * @return [String, nil] data read
+ */
+VALUE BlobIO_read(int argc, VALUE *argv, VALUE self) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  VALUE length, outbuf;
+  rb_scan_args(argc, argv, "02", &length, &outbuf);
+
+  int remaining = blob_io->size - blob_io->pos;
+  if (remaining < 0) remaining = 0;
+  int len = remaining;
+  if (!NIL_P(length)) {
+    long l = NUM2LONG(length);
+    if (l < 0) rb_raise(rb_eArgError, "negative length %ld given", l);
+    if (l < len) len = (int)l;
+  }
+
+  if (NIL_P(outbuf))
+    outbuf = rb_str_buf_new(len);
+  else {
+    StringValue(outbuf);
+    if (len > RSTRING_LEN(outbuf))
+      rb_str_modify_expand(outbuf, len - RSTRING_LEN(outbuf));
+    else
+      rb_str_modify(outbuf);
+  }
+
+  if (!NIL_P(length) && len == 0 && NUM2LONG(length) > 0) {
+    rb_str_set_len(outbuf, 0);
+    return Qnil;
+  }
+
+  // the buffer is locked while reading, as the GVL is released
+  struct blob_io_read_args args = { blob_io, outbuf, len };
+  rb_str_set_len(outbuf, len);
+  rb_str_locktmp(outbuf);
+  rb_ensure(blob_io_read_into, (VALUE)&args, rb_str_unlocktmp, outbuf);
+  rb_enc_associate_index(outbuf, rb_ascii8bit_encindex());
+  return outbuf;
+}
+
+/* Reads up to maxlen bytes from the current position. Raises `EOFError` at the
+ * end of the blob.
+ *
+ * @param maxlen [Integer] maximum number of bytes to read
+ * @param outbuf [String, nil] output buffer
+ * @return [String] data read
+ */
+VALUE BlobIO_readpartial(int argc, VALUE *argv, VALUE self) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  rb_check_arity(argc, 1, 2);
+
+  if (NUM2LONG(argv[0]) > 0 && blob_io->pos >= blob_io->size)
+    rb_raise(rb_eEOFError, "end of file reached");
+  return BlobIO_read(argc, argv, self);
+}
+
+/* Writes the given data at the current position. As the size of a blob cannot
+ * be changed, raises an error if the data would be written past the end of
+ * the blob.
+ *
+ * @param data [String] data to write
+ * @return [Integer] number of bytes written
+ */
+VALUE BlobIO_write(VALUE self, VALUE data) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  if (!blob_io->writable) rb_raise(cError, "Blob is not opened for writing");
+
+  data = rb_obj_as_string(data);
+  long len = RSTRING_LEN(data);
+  if (blob_io->pos + len > blob_io->size)
+    rb_raise(cError, "Cannot write past the end of the blob (size: %d)", blob_io->size);
+
+  // write from a frozen copy, in case the string is modified by another
+  // thread while the GVL is released
+  VALUE frozen = rb_str_new_frozen(data);
+  blob_io_transfer(blob_io, RSTRING_PTR(frozen), (int)len, blob_io_write_impl);
+  RB_GC_GUARD(frozen);
+  return LONG2NUM(len);
+}
+
+/* Writes the given data at the current position.
+ *
+ * @param data [String] data to write
+ * @return [Extralite::BlobIO] self
+ */
+VALUE BlobIO_append(VALUE self, VALUE data) {
+  BlobIO_write(self, data);
+  return self;
+}
+
+/* Moves the current position to the given offset, according to whence, which
+ * is one of `IO::SEEK_SET` (the default), `IO::SEEK_CUR` or `IO::SEEK_END`.
+ *
+ * @param offset [Integer] offset
+ * @param whence [Integer, Symbol] offset origin
+ * @return [0]
+ */
+VALUE BlobIO_seek(int argc, VALUE *argv, VALUE self) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  VALUE offset, whence;
+  rb_scan_args(argc, argv, "11", &offset, &whence);
+
+  long pos = NUM2LONG(offset);
+  int origin = SEEK_SET;
+  if (SYMBOL_P(whence)) {
+    ID id = SYM2ID(whence);
+    if (id == rb_intern("CUR")) origin = SEEK_CUR;
+    else if (id == rb_intern("END")) origin = SEEK_END;
+    else if (id != rb_intern("SET")) rb_raise(rb_eArgError, "Invalid whence");
+  }
+  else if (!NIL_P(whence))
+    origin = NUM2INT(whence);
+
+  switch (origin) {
+    case SEEK_SET: break;
+    case SEEK_CUR: pos += blob_io->pos; break;
+    case SEEK_END: pos += blob_io->size; break;
+    default: rb_raise(rb_eArgError, "Invalid whence");
+  }
+  if (pos < 0) rb_raise(rb_eArgError, "Invalid offset");
+  if (pos > INT_MAX) pos = INT_MAX;
+
+  blob_io->pos = (int)pos;
+  return INT2FIX(0);
+}
+
+/* Returns the current position.
+ *
+ * @return [Integer] current position
+ */
+VALUE BlobIO_pos(VALUE self) {
+  return INT2NUM(self_to_open_blob_io(self)->pos);
+}
+
+/* Sets the current position.
+ *
+ * @param pos [Integer] position
+ * @return [Integer] position
+ */
+VALUE BlobIO_pos_set(VALUE self, VALUE pos) {
+  BlobIO_seek(1, &pos, self);
+  return pos;
+}
+
+/* Moves the current position to the start of the blob.
+ *
+ * @return [0]
+ */
+VALUE BlobIO_rewind(VALUE self) {
+  self_to_open_blob_io(self)->pos = 0;
+  return INT2FIX(0);
+}
+
+/* Returns true if the current position is at the end of the blob.
+ *
+ * @return [bool] end of blob
+ */
+VALUE BlobIO_eof_p(VALUE self) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  return blob_io->pos >= blob_io->size ? Qtrue : Qfalse;
+}
+
+/* Returns the blob size in bytes.
+ *
+ * @return [Integer] blob size
+ */
+VALUE BlobIO_size_get(VALUE self) {
+  return INT2NUM(self_to_open_blob_io(self)->size);
+}
+
+/* Points the blob to the same column in a different row of the same table,
+ * and moves the current position to the start of the blob. This is faster
+ * than opening a new blob. Raises an error if the blob is being read or
+ * written by another thread.
+ *
+ * @param rowid [Integer] row id
+ * @return [Extralite::BlobIO] self
+ */
+VALUE BlobIO_reopen(VALUE self, VALUE rowid) {
+  BlobIO_t *blob_io = self_to_open_blob_io(self);
+  blob_io_check_idle(blob_io);
+
+  int rc = sqlite3_blob_reopen(blob_io->blob, NUM2LL(rowid));
+  if (rc != SQLITE_OK) blob_io_raise(blob_io, rc);
+
+  blob_io->size = sqlite3_blob_bytes(blob_io->blob);
+  blob_io->pos = 0;
+  return self;
+}
+
+/* Closes the blob. Subsequent operations on the blob will raise an error.
+ * Raises an error if the blob is being read or written by another thread.
+ *
+ * @return [nil]
+ */
+VALUE BlobIO_close(VALUE self) {
+  BlobIO_t *blob_io = self_to_blob_io(self);
+  blob_io_check_idle(blob_io);
+  if (blob_io->blob) {
+    connection_release_handle(blob_io->sqlite3_db);
+    sqlite3_blob_close(blob_io->blob);
+    blob_io->blob = NULL;
+  }
+  return Qnil;
+}
+
+/* Returns true if the blob is closed.
+ *
+ * @return [bool] is blob closed
+ */
+VALUE BlobIO_closed_p(VALUE self) {
+  return self_to_blob_io(self)->blob ? Qfalse : Qtrue;
+}
+
+/* Returns the associated database.
+ *
+ * @return [Extralite::Database] database
+ */
+VALUE BlobIO_database(VALUE self) {
+  return self_to_blob_io(self)->db;
+}
+
+void Init_ExtraliteBlobIO(void) {
+  VALUE mExtralite = rb_define_module("Extralite");
+
+  rb_define_method(cDatabase, "blob_open", Database_blob_open, -1);
+
+  cBlobIO = rb_define_class_under(mExtralite, "BlobIO", rb_cObject);
+  rb_define_alloc_func(cBlobIO, BlobIO_allocate);
+  rb_undef_method(CLASS_OF(cBlobIO), "new");
+
+  rb_define_method(cBlobIO, "close", BlobIO_close, 0);
+  rb_define_method(cBlobIO, "closed?", BlobIO_closed_p, 0);
+  rb_define_method(cBlobIO, "database", BlobIO_database, 0);
+  rb_define_method(cBlobIO, "db", BlobIO_database, 0);
+  rb_define_method(cBlobIO, "eof?", BlobIO_eof_p, 0);
+  rb_define_method(cBlobIO, "eof", BlobIO_eof_p, 0);
+  rb_define_method(cBlobIO, "pos", BlobIO_pos, 0);
+  rb_define_method(cBlobIO, "pos=", BlobIO_pos_set, 1);
+  rb_define_method(cBlobIO, "read", BlobIO_read, -1);
+  rb_define_method(cBlobIO, "readpartial", BlobIO_readpartial, -1);
+  rb_define_method(cBlobIO, "reopen", BlobIO_reopen, 1);
+  rb_define_method(cBlobIO, "rewind", BlobIO_rewind, 0);
+  rb_define_method(cBlobIO, "seek", BlobIO_seek, -1);
+  rb_define_method(cBlobIO, "size", BlobIO_size_get, 0);
+  rb_define_method(cBlobIO, "tell", BlobIO_pos, 0);
+  rb_define_method(cBlobIO, "write", BlobIO_write, 1);
+  rb_define_method(cBlobIO, "<<", BlobIO_append, 1);
+}
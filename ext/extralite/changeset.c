@@ -9,11 +9,33 @@
  */
 
 VALUE cChangeset;
+VALUE cChangeGroup;
 
 VALUE SYM_delete;
 VALUE SYM_insert;
 VALUE SYM_update;
 
+VALUE SYM_abort;
+VALUE SYM_omit;
+VALUE SYM_replace;
+
+VALUE SYM_conflict;
+VALUE SYM_constraint;
+VALUE SYM_data;
+VALUE SYM_foreign_key;
+VALUE SYM_not_found;
+
+VALUE SYM_applied;
+VALUE SYM_conflicts;
+VALUE SYM_omitted;
+VALUE SYM_replaced;
+
+ID ID_push;
+ID ID_read;
+ID ID_write;
+
+#define STREAM_CHUNK_SIZE 65536
+
 static size_t Changeset_size(const void *ptr) {
   return sizeof(Changeset_t);
 }
@@ -35,6 +57,9 @@ static VALUE Changeset_allocate(VALUE klass) {
   Changeset_t *changeset = ALLOC(Changeset_t);
   changeset->changeset_len = 0;
   changeset->changeset_ptr = NULL;
+  changeset->patchset = 0;
+  changeset->busy = 0;
+  memset(&changeset->apply_stats, 0, sizeof(struct changeset_apply_stats));
   return TypedData_Wrap_Struct(klass, &Changeset_type, changeset);
 }
 
@@ -44,6 +69,18 @@ static inline Changeset_t *self_to_changeset(VALUE obj) {
   return changeset;
 }
 
+// The changeset buffer is in use while it is applied (with the GVL possibly
+// released) or written to an IO, and while tracking changes into it. Other
+// threads may run in the meantime, but may not replace the buffer.
+static inline void changeset_check_idle(Changeset_t *changeset) {
+  if (changeset->busy) rb_raise(cError, "Changeset is in use");
+}
+
+static VALUE changeset_release(VALUE self) {
+  self_to_changeset(self)->busy--;
+  return Qnil;
+}
+
 /* Initializes an empty changeset.
  *
  * @return [void]
@@ -52,9 +89,16 @@ VALUE Changeset_initialize(VALUE self) {
   Changeset_t *changeset = self_to_changeset(self);
   changeset->changeset_len = 0;
   changeset->changeset_ptr = NULL;
+  changeset->patchset = 0;
   return Qnil;
 }
 
+// Patchset tables are prefixed with 'P', while changeset tables are prefixed
+// with 'T'.
+static inline int patchset_blob_p(void *ptr, int len) {
+  return len > 0 && ((char *)ptr)[0] == 'P';
+}
+
 static inline VALUE tbl_str(VALUE tbl) {
   switch (TYPE(tbl)) {
     case T_NIL:
@@ -77,12 +121,75 @@ static inline void Changeset_track_attach(sqlite3 *db, struct sqlite3_session *s
   RB_GC_GUARD(name);
 }
 
+struct stream_ctx {
+  VALUE     io;
+  long long bytes;
+  int       state;
+};
+
+static VALUE stream_write(VALUE args) {
+  VALUE *argv = (VALUE *)args;
+  return rb_funcall(argv[0], ID_write, 1, argv[1]);
+}
+
+static VALUE stream_read(VALUE args) {
+  VALUE *argv = (VALUE *)args;
+  VALUE str = rb_funcall(argv[0], ID_read, 1, argv[1]);
+  if (!NIL_P(str)) StringValue(str);
+  return str;
+}
+
+// Output callback for the sqlite3 streaming API. Any exception raised while
+// writing to the IO is stored in the stream context and reraised once control
+// returns from SQLite.
+static int stream_output(void *ptr, const void *data, int len) {
+  struct stream_ctx *ctx = (struct stream_ctx *)ptr;
+  if (ctx->state) return SQLITE_IOERR;
+
+  VALUE args[2] = { ctx->io, rb_str_new(data, len) };
+  rb_protect(stream_write, (VALUE)args, &ctx->state);
+  RB_GC_GUARD(args[1]);
+  if (ctx->state) return SQLITE_IOERR;
+
+  ctx->bytes += len;
+  return SQLITE_OK;
+}
+
+// Input callback for the sqlite3 streaming API. Reads up to *len bytes from
+// the IO, setting *len to 0 on EOF.
+static int stream_input(void *ptr, void *data, int *len) {
+  struct stream_ctx *ctx = (struct stream_ctx *)ptr;
+  if (ctx->state) return SQLITE_IOERR;
+
+  VALUE args[2] = { ctx->io, INT2FIX(*len) };
+  VALUE str = rb_protect(stream_read, (VALUE)args, &ctx->state);
+  if (ctx->state) return SQLITE_IOERR;
+
+  if (NIL_P(str))
+    *len = 0;
+  else {
+    long str_len = RSTRING_LEN(str);
+    if (str_len > *len) str_len = *len;
+    memcpy(data, RSTRING_PTR(str), str_len);
+    *len = (int)str_len;
+  }
+  ctx->bytes += *len;
+  RB_GC_GUARD(str);
+  return SQLITE_OK;
+}
+
+static inline void stream_check(struct stream_ctx *ctx) {
+  if (ctx->state) rb_jump_tag(ctx->state);
+}
+
 struct track_ctx {
-  Changeset_t     *changeset;
-  sqlite3         *sqlite3_db;
-  sqlite3_session *session;
-  VALUE           db;
-  VALUE           tables;
+  Changeset_t       *changeset;
+  sqlite3           *sqlite3_db;
+  sqlite3_session   *session;
+  VALUE             db;
+  VALUE             tables;
+  struct stream_ctx *stream;
+  int               patchset;
 };
 
 VALUE safe_track(struct track_ctx *ctx) {
@@ -98,11 +205,20 @@ VALUE safe_track(struct track_ctx *ctx) {
 
   rb_yield(ctx->db);
 
-  rc = sqlite3session_changeset(
-    ctx->session,
-    &ctx->changeset->changeset_len,
-    &ctx->changeset->changeset_ptr
-  );
+  if (ctx->stream) {
+    rc = ctx->patchset ?
+      sqlite3session_patchset_strm(ctx->session, stream_output, ctx->stream) :
+      sqlite3session_changeset_strm(ctx->session, stream_output, ctx->stream);
+    stream_check(ctx->stream);
+  }
+  else {
+    rc = (ctx->patchset ? sqlite3session_patchset : sqlite3session_changeset)(
+      ctx->session,
+      &ctx->changeset->changeset_len,
+      &ctx->changeset->changeset_ptr
+    );
+    ctx->changeset->patchset = ctx->patchset;
+  }
   if (rc != SQLITE_OK)
     rb_raise(cError, "Error while collecting changeset from session: %s", sqlite3_errstr(rc));
 
@@ -114,24 +230,15 @@ VALUE cleanup_track(struct track_ctx *ctx) {
   return Qnil;
 }
 
-/* Tracks changes in the given block and collects them into the changeset.
- * Changes are tracked only for the given tables. If nil is supplied as the
- * given tables, changes are tracked for all tables.
- * 
- *     # track changes for the foo and bar tables
- *     changeset.track(db, [:foo, :bar]) do
- *       run_some_queries
- *     end
- *     store_changes(changeset.to_blob)
- *
- * @param db [Extralite::Database] database to track
- * @param tables [Array<String, Symbol>, nil] tables to track (or nil for all tables)
- * @return [Extralite::Changeset] changeset
- */
-VALUE Changeset_track(VALUE self, VALUE db, VALUE tables) {
+static VALUE changeset_track_session(struct track_ctx *ctx) {
+  return rb_ensure(SAFE(safe_track), (VALUE)ctx, SAFE(cleanup_track), (VALUE)ctx);
+}
+
+static inline VALUE changeset_track(VALUE self, VALUE db, VALUE tables, int patchset) {
   Changeset_t *changeset = self_to_changeset(self);
   Database_t *db_struct = self_to_database(db);
   sqlite3 *sqlite3_db = db_struct->sqlite3_db;
+  changeset_check_idle(changeset);
 
   if (changeset->changeset_ptr) {
     sqlite3_free(changeset->changeset_ptr);
@@ -144,17 +251,66 @@ VALUE Changeset_track(VALUE self, VALUE db, VALUE tables) {
     .sqlite3_db = sqlite3_db,
     .session = NULL,
     .db = db,
-    .tables = tables
+    .tables = tables,
+    .stream = NULL,
+    .patchset = patchset
   };
   int rc = sqlite3session_create(sqlite3_db, "main", &ctx.session);
   if (rc != SQLITE_OK)
     rb_raise(cError, "Error while creating session: %s", sqlite3_errstr(rc));
 
-  rb_ensure(SAFE(safe_track), (VALUE)&ctx, SAFE(cleanup_track), (VALUE)&ctx);
+  changeset->busy++;
+  rb_ensure(SAFE(changeset_track_session), (VALUE)&ctx, changeset_release, self);
 
   return self;
 }
 
+/* Tracks changes in the given block and collects them into the changeset.
+ * Changes are tracked only for the given tables. If nil is supplied as the
+ * given tables, changes are tracked for all tables.
+ * 
+ *     # track changes for the foo and bar tables
+ *     changeset.track(db, [:foo, :bar]) do
+ *       run_some_queries
+ *     end
+ *     store_changes(changeset.to_blob)
+ *
+ * @param db [Extralite::Database] database to track
+ * @param tables [Array<String, Symbol>, nil] tables to track (or nil for all tables)
+ * @return [Extralite::Changeset] changeset
+ */
+VALUE Changeset_track(VALUE self, VALUE db, VALUE tables) {
+  return changeset_track(self, db, tables, 0);
+}
+
+/* Tracks changes in the given block and collects them into the changeset as a
+ * patchset. Patchsets are more compact than changesets, as they do not
+ * include the original values of updated and deleted rows, other than the
+ * primary key. Patchsets can be applied to databases known to match the
+ * tracked database, but cannot be inverted.
+ *
+ *     changeset.track_patchset(db, [:foo, :bar]) do
+ *       run_some_queries
+ *     end
+ *     changeset.patchset? #=> true
+ *
+ * @param db [Extralite::Database] database to track
+ * @param tables [Array<String, Symbol>, nil] tables to track (or nil for all tables)
+ * @return [Extralite::Changeset] changeset
+ */
+VALUE Changeset_track_patchset(VALUE self, VALUE db, VALUE tables) {
+  return changeset_track(self, db, tables, 1);
+}
+
+/* Returns true if the changeset is a patchset.
+ *
+ * @return [bool] is patchset
+ */
+VALUE Changeset_patchset_p(VALUE self) {
+  Changeset_t *changeset = self_to_changeset(self);
+  return changeset->patchset ? Qtrue : Qfalse;
+}
+
 struct each_ctx {
   sqlite3_changeset_iter *iter;
 };
@@ -193,7 +349,7 @@ static inline VALUE convert_value(sqlite3_value *value) {
       {
         int len = sqlite3_value_bytes(value);
         const void *text = sqlite3_value_text(value);
-        return rb_enc_str_new(text, len, UTF8_ENCODING);
+        return utf8_str_new(text, len);
       }
     default:
       rb_raise(cError, "Invalid value type: %d\n", type);
@@ -294,6 +450,10 @@ inline void verify_changeset(Changeset_t *changeset) {
     rb_raise(cError, "Changeset not available");
 }
 
+static VALUE changeset_each_iterate(struct each_ctx *ctx) {
+  return rb_ensure(SAFE(safe_each), (VALUE)ctx, SAFE(cleanup_iter), (VALUE)ctx);
+}
+
 /* Iterates through the changeset, providing each change to the given block.
  * Each change entry is an array containing the operation (:insert / :update /
  * :delete), the table name, an array containing the old values, and an array
@@ -314,7 +474,8 @@ VALUE Changeset_each(VALUE self) {
   if (rc!=SQLITE_OK)
     rb_raise(cError, "Error while starting iterator: %s", sqlite3_errstr(rc));
 
-  rb_ensure(SAFE(safe_each), (VALUE)&ctx, SAFE(cleanup_iter), (VALUE)&ctx);
+  changeset->busy++;
+  rb_ensure(SAFE(changeset_each_iterate), (VALUE)&ctx, changeset_release, self);
   return self;
 }
 
@@ -337,38 +498,236 @@ VALUE Changeset_to_a(VALUE self) {
   return rb_ensure(SAFE(safe_to_a), (VALUE)&ctx, SAFE(cleanup_iter), (VALUE)&ctx);
 }
 
-// copied from: https://sqlite.org/sessionintro.html
-static int xConflict(void *pCtx, int eConflict, sqlite3_changeset_iter *pIter){
-  long ret = (long)pCtx;
-  return ret;
+enum conflict_policy {
+  CONFLICT_REPLACE,
+  CONFLICT_OMIT,
+  CONFLICT_ABORT,
+  CONFLICT_PROC
+};
+
+struct apply_ctx {
+  Database_t                  *db;
+  sqlite3                     *sqlite3_db;
+  int                         changeset_len;
+  void                        *changeset_ptr;
+  struct stream_ctx           *stream;
+  enum conflict_policy        policy;
+  VALUE                       proc;
+  int                         state;
+  int                         rc;
+  struct changeset_apply_stats stats;
+  long long                   replaced_rows;
+};
+
+static inline enum conflict_policy parse_conflict_policy(VALUE opts, VALUE *proc) {
+  static ID kw_ids[1];
+  VALUE value = Qundef;
+
+  *proc = Qnil;
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) CONST_ID(kw_ids[0], "on_conflict");
+    rb_get_kwargs(opts, kw_ids, 0, 1, &value);
+  }
+
+  if (value == Qundef || value == SYM_replace) return CONFLICT_REPLACE;
+  if (value == SYM_omit)                        return CONFLICT_OMIT;
+  if (value == SYM_abort)                       return CONFLICT_ABORT;
+  if (rb_respond_to(value, ID_call)) {
+    *proc = value;
+    return CONFLICT_PROC;
+  }
+  rb_raise(rb_eArgError, "Invalid conflict policy (expected :replace, :omit, :abort or a proc)");
+}
+
+static inline VALUE conflict_type_symbol(int type) {
+  switch (type) {
+    case SQLITE_CHANGESET_DATA:         return SYM_data;
+    case SQLITE_CHANGESET_NOTFOUND:     return SYM_not_found;
+    case SQLITE_CHANGESET_CONFLICT:     return SYM_conflict;
+    case SQLITE_CHANGESET_CONSTRAINT:   return SYM_constraint;
+    case SQLITE_CHANGESET_FOREIGN_KEY:  return SYM_foreign_key;
+    default:                            return Qnil;
+  }
 }
 
-/* Applies the changeset to the given database.
- * 
+struct conflict_call_args {
+  VALUE                   proc;
+  int                     type;
+  sqlite3_changeset_iter  *iter;
+};
+
+// Calls the conflict proc with the conflict type and the conflicting change
+// (except for foreign key conflicts, where no change is available), and
+// converts the returned symbol into a conflict action.
+static VALUE conflict_call(VALUE ptr) {
+  struct conflict_call_args *args = (struct conflict_call_args *)ptr;
+  VALUE change = (args->type == SQLITE_CHANGESET_FOREIGN_KEY) ? Qnil : changeset_iter_info(args->iter);
+  VALUE ret = rb_funcall(args->proc, ID_call, 2, conflict_type_symbol(args->type), change);
+  RB_GC_GUARD(change);
+
+  if (ret == SYM_replace) return INT2FIX(SQLITE_CHANGESET_REPLACE);
+  if (ret == SYM_omit)    return INT2FIX(SQLITE_CHANGESET_OMIT);
+  if (ret == SYM_abort)   return INT2FIX(SQLITE_CHANGESET_ABORT);
+  rb_raise(rb_eArgError, "Invalid conflict action (expected :replace, :omit or :abort)");
+}
+
+// Conflict handler for sqlite3changeset_apply. Common policies are resolved
+// without calling into Ruby. REPLACE is only allowed by SQLite for data and
+// row conflicts, for other conflict types the change is omitted.
+static int xConflict(void *ptr, int type, sqlite3_changeset_iter *iter) {
+  struct apply_ctx *ctx = (struct apply_ctx *)ptr;
+  int action;
+
+  ctx->stats.conflicts++;
+  switch (ctx->policy) {
+    case CONFLICT_REPLACE:
+      action = SQLITE_CHANGESET_REPLACE;
+      break;
+    case CONFLICT_OMIT:
+      action = SQLITE_CHANGESET_OMIT;
+      break;
+    case CONFLICT_PROC:
+      {
+        if (ctx->state) return SQLITE_CHANGESET_ABORT;
+
+        struct conflict_call_args args = { ctx->proc, type, iter };
+        VALUE ret = rb_protect(conflict_call, (VALUE)&args, &ctx->state);
+        if (ctx->state) return SQLITE_CHANGESET_ABORT;
+        action = FIX2INT(ret);
+        break;
+      }
+    default:
+      return SQLITE_CHANGESET_ABORT;
+  }
+
+  if (action == SQLITE_CHANGESET_REPLACE &&
+      type != SQLITE_CHANGESET_DATA && type != SQLITE_CHANGESET_CONFLICT)
+    action = SQLITE_CHANGESET_OMIT;
+
+  if (action == SQLITE_CHANGESET_REPLACE) {
+    ctx->stats.replaced++;
+    if (type == SQLITE_CHANGESET_CONFLICT) ctx->replaced_rows++;
+  }
+  else if (action == SQLITE_CHANGESET_OMIT)
+    ctx->stats.omitted++;
+  return action;
+}
+
+static void *apply_impl(void *ptr) {
+  struct apply_ctx *ctx = (struct apply_ctx *)ptr;
+  int changes = sqlite3_total_changes(ctx->sqlite3_db);
+
+  if (ctx->stream)
+    ctx->rc = sqlite3changeset_apply_strm(
+      ctx->sqlite3_db, stream_input, ctx->stream, NULL, xConflict, ctx
+    );
+  else
+    ctx->rc = sqlite3changeset_apply(
+      ctx->sqlite3_db, ctx->changeset_len, ctx->changeset_ptr, NULL, xConflict, ctx
+    );
+
+  // replacing a conflicting row deletes it before inserting the change, which
+  // is counted by SQLite as an additional change
+  ctx->stats.applied = sqlite3_total_changes(ctx->sqlite3_db) - changes - ctx->replaced_rows;
+  return NULL;
+}
+
+// Applies the changeset. The GVL is released unless Ruby code needs to be
+// called during the apply, i.e. a conflict proc, a stream or a progress
+// handler.
+static VALUE changeset_apply(struct apply_ctx *ctx) {
+  Database_t *db = ctx->db;
+  enum gvl_mode mode =
+    (ctx->policy == CONFLICT_PROC || ctx->stream || db->progress_handler.mode != PROGRESS_NONE) ?
+    GVL_HOLD : Database_prepare_gvl_mode(db);
+
+  gvl_call(mode, apply_impl, (void *)ctx);
+  if (ctx->stream) stream_check(ctx->stream);
+  if (ctx->state) rb_jump_tag(ctx->state);
+
+  if (ctx->rc == SQLITE_ABORT)
+    rb_raise(cError, "Changeset apply aborted on conflict");
+  if (ctx->rc != SQLITE_OK)
+    rb_raise(cError, "Error while applying changeset: %s", sqlite3_errstr(ctx->rc));
+  return Qnil;
+}
+
+static inline VALUE apply_stats_hash(struct changeset_apply_stats *stats) {
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, SYM_applied, LL2NUM(stats->applied));
+  rb_hash_aset(hash, SYM_conflicts, LL2NUM(stats->conflicts));
+  rb_hash_aset(hash, SYM_replaced, LL2NUM(stats->replaced));
+  rb_hash_aset(hash, SYM_omitted, LL2NUM(stats->omitted));
+  return hash;
+}
+
+/* call-seq:
+ *   changeset.apply(db) -> changeset
+ *   changeset.apply(db, on_conflict: policy) -> changeset
+ *
+ * Applies the changeset to the given database. Conflicts are resolved
+ * according to the given policy:
+ *
+ * - `:replace` (default): the conflicting row is replaced with the change. For
+ *   conflicts where replacing is not possible (e.g. a row to update or delete
+ *   was not found, or a constraint is violated), the change is omitted.
+ * - `:omit`: the conflicting change is omitted.
+ * - `:abort`: the apply is aborted and all changes are rolled back.
+ * - a proc: the proc is called with the conflict type (`:data`, `:not_found`,
+ *   `:conflict`, `:constraint` or `:foreign_key`) and the conflicting change,
+ *   and should return `:replace`, `:omit` or `:abort`.
+ *
+ * Unless a proc is given, the changeset is applied with the GVL released. The
+ * number of applied and conflicting changes can be obtained using
+ * `#apply_stats`.
+ *
+ *     changeset.apply(db, on_conflict: :omit)
+ *     changeset.apply_stats #=> { applied: 10, conflicts: 2, replaced: 0, omitted: 2 }
+ *
  * @param db [Extralite::Database] database to apply changes to
+ * @param opts [Hash] apply options
+ * @option opts [Symbol, Proc] :on_conflict conflict policy
  * @return [Extralite::Changeset] changeset
  */
-VALUE Changeset_apply(VALUE self, VALUE db) {
+VALUE Changeset_apply(int argc, VALUE *argv, VALUE self) {
   Changeset_t *changeset = self_to_changeset(self);
+  VALUE db, opts;
+  rb_scan_args(argc, argv, "1:", &db, &opts);
   verify_changeset(changeset);
 
   Database_t *db_struct = self_to_database(db);
-  sqlite3 *sqlite3_db = db_struct->sqlite3_db;
+  if (!db_struct->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  struct apply_ctx ctx = {
+    .db = db_struct,
+    .sqlite3_db = db_struct->sqlite3_db,
+    .changeset_len = changeset->changeset_len,
+    .changeset_ptr = changeset->changeset_ptr,
+    .stream = NULL,
+    .state = 0
+  };
+  ctx.policy = parse_conflict_policy(opts, &ctx.proc);
+  memset(&changeset->apply_stats, 0, sizeof(struct changeset_apply_stats));
 
-  int rc = sqlite3changeset_apply(
-    sqlite3_db,
-    changeset->changeset_len,
-    changeset->changeset_ptr,
-    NULL,
-    xConflict,
-    (void*)1
-  );
-  if (rc != SQLITE_OK)
-    rb_raise(cError, "Error while applying changeset: %s", sqlite3_errstr(rc));
+  changeset->busy++;
+  rb_ensure(SAFE(changeset_apply), (VALUE)&ctx, changeset_release, self);
+  changeset->apply_stats = ctx.stats;
+  CDC_FLUSH_PENDING(db_struct);
 
+  RB_GC_GUARD(ctx.proc);
   return self;
 }
 
+/* Returns statistics for the last call to `#apply`, with the number of applied
+ * changes, conflicts, and conflicting changes replaced or omitted.
+ *
+ * @return [Hash] apply statistics
+ */
+VALUE Changeset_apply_stats(VALUE self) {
+  Changeset_t *changeset = self_to_changeset(self);
+  return apply_stats_hash(&changeset->apply_stats);
+}
+
 /* Returns an inverted changeset. The inverted changeset can be used to undo the
  * changes in the original changeset.
  *
@@ -380,6 +739,8 @@ VALUE Changeset_apply(VALUE self, VALUE db) {
 VALUE Changeset_invert(VALUE self) {
   Changeset_t *changeset = self_to_changeset(self);
   verify_changeset(changeset);
+  if (changeset->patchset)
+    rb_raise(cError, "Cannot invert a patchset");
 
   VALUE inverted = rb_funcall(cChangeset, ID_new, 0);
   Changeset_t *inverted_changeset = self_to_changeset(inverted);
@@ -423,6 +784,7 @@ VALUE Changeset_to_blob(VALUE self) {
  */
 VALUE Changeset_load(VALUE self, VALUE blob) {
   Changeset_t *changeset = self_to_changeset(self);
+  changeset_check_idle(changeset);
   if (changeset->changeset_ptr) {
     sqlite3_free(changeset->changeset_ptr);
     changeset->changeset_ptr = NULL;
@@ -432,7 +794,478 @@ VALUE Changeset_load(VALUE self, VALUE blob) {
   changeset->changeset_len = RSTRING_LEN(blob);
   changeset->changeset_ptr = sqlite3_malloc(changeset->changeset_len);
   memcpy(changeset->changeset_ptr, RSTRING_PTR(blob), changeset->changeset_len);
+  changeset->patchset = patchset_blob_p(changeset->changeset_ptr, changeset->changeset_len);
+
+  return self;
+}
+
+static VALUE changeset_write_chunks(VALUE ptr) {
+  VALUE *args = (VALUE *)ptr;
+  Changeset_t *changeset = self_to_changeset(args[0]);
+
+  VALUE chunk = Qnil;
+  for (int pos = 0; pos < changeset->changeset_len; pos += STREAM_CHUNK_SIZE) {
+    int len = changeset->changeset_len - pos;
+    if (len > STREAM_CHUNK_SIZE) len = STREAM_CHUNK_SIZE;
+    chunk = rb_str_new((char *)changeset->changeset_ptr + pos, len);
+    rb_funcall(args[1], ID_write, 1, chunk);
+  }
+
+  RB_GC_GUARD(chunk);
+  return Qnil;
+}
+
+/* Writes the changeset to the given IO, in chunks of bounded size. This
+ * method can be used to store a large changeset without copying it into a
+ * single string.
+ *
+ *     File.open('my.changes', 'w+') { |f| changeset.write_to(f) }
+ *
+ * @param io [IO] IO to write to
+ * @return [Extralite::Changeset] changeset
+ */
+VALUE Changeset_write_to(VALUE self, VALUE io) {
+  Changeset_t *changeset = self_to_changeset(self);
+  verify_changeset(changeset);
+
+  VALUE args[] = { self, io };
+  changeset->busy++;
+  rb_ensure(changeset_write_chunks, (VALUE)args, changeset_release, self);
+  return self;
+}
+
+/* call-seq:
+ *   Extralite::Changeset.stream_track(db, io, *tables) { ... } -> bytes_written
+ *   Extralite::Changeset.stream_track(db, io, *tables, patchset: true) { ... } -> bytes_written
+ *
+ * Tracks changes in the given block and writes the resulting changeset (or
+ * patchset, if `patchset: true` is given) directly to the given IO, without
+ * holding the entire changeset in memory. If no tables are given, changes are
+ * tracked for all tables.
+ *
+ *     File.open('my.changes', 'w+') do |f|
+ *       Extralite::Changeset.stream_track(db, f, :foo, :bar) do
+ *         run_some_queries
+ *       end
+ *     end
+ *
+ * @param db [Extralite::Database] database to track
+ * @param io [IO] IO to write the changeset to
+ * @param *tables [Array<String, Symbol>] table(s) to track
+ * @param opts [Hash] tracking options
+ * @option opts [bool] :patchset produce a patchset instead of a changeset
+ * @return [Integer] number of bytes written
+ */
+VALUE Changeset_stream_track(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[1];
+  VALUE db, io, tables, opts;
+  VALUE patchset = Qundef;
+
+  rb_scan_args(argc, argv, "2*:", &db, &io, &tables, &opts);
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) CONST_ID(kw_ids[0], "patchset");
+    rb_get_kwargs(opts, kw_ids, 0, 1, &patchset);
+  }
+  if (RARRAY_LEN(tables) == 0) tables = Qnil;
+
+  Database_t *db_struct = self_to_database(db);
+  if (!db_struct->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  struct stream_ctx stream = { .io = io, .bytes = 0, .state = 0 };
+  struct track_ctx ctx = {
+    .changeset = NULL,
+    .sqlite3_db = db_struct->sqlite3_db,
+    .session = NULL,
+    .db = db,
+    .tables = tables,
+    .stream = &stream,
+    .patchset = (patchset != Qundef) && RTEST(patchset)
+  };
+  int rc = sqlite3session_create(ctx.sqlite3_db, "main", &ctx.session);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while creating session: %s", sqlite3_errstr(rc));
+
+  rb_ensure(SAFE(safe_track), (VALUE)&ctx, SAFE(cleanup_track), (VALUE)&ctx);
+
+  RB_GC_GUARD(tables);
+  return LL2NUM(stream.bytes);
+}
+
+/* call-seq:
+ *   Extralite::Changeset.apply_from(db, io) -> stats
+ *   Extralite::Changeset.apply_from(db, io, on_conflict: policy) -> stats
+ *
+ * Applies a changeset read from the given IO to the given database. The
+ * changeset is read incrementally, without loading it entirely into memory.
+ * Conflicts are resolved according to the given policy (see `#apply`).
+ * Returns the number of applied and conflicting changes (see `#apply_stats`).
+ *
+ *     File.open('my.changes', 'r') do |f|
+ *       Extralite::Changeset.apply_from(db, f)
+ *     end
+ *
+ * @param db [Extralite::Database] database to apply changes to
+ * @param io [IO] IO to read the changeset from
+ * @param opts [Hash] apply options
+ * @option opts [Symbol, Proc] :on_conflict conflict policy
+ * @return [Hash] apply statistics
+ */
+VALUE Changeset_apply_from(int argc, VALUE *argv, VALUE self) {
+  VALUE db, io, opts;
+  rb_scan_args(argc, argv, "2:", &db, &io, &opts);
+
+  Database_t *db_struct = self_to_database(db);
+  if (!db_struct->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  struct stream_ctx stream = { .io = io, .bytes = 0, .state = 0 };
+  struct apply_ctx ctx = {
+    .db = db_struct,
+    .sqlite3_db = db_struct->sqlite3_db,
+    .stream = &stream,
+    .state = 0
+  };
+  ctx.policy = parse_conflict_policy(opts, &ctx.proc);
+
+  changeset_apply(&ctx);
+  CDC_FLUSH_PENDING(db_struct);
+
+  RB_GC_GUARD(ctx.proc);
+  return apply_stats_hash(&ctx.stats);
+}
+
+static inline VALUE changeset_from_ptr(int len, void *ptr) {
+  VALUE changeset = rb_funcall(cChangeset, ID_new, 0);
+  Changeset_t *changeset_struct = self_to_changeset(changeset);
+  changeset_struct->changeset_len = len;
+  changeset_struct->changeset_ptr = ptr;
+  changeset_struct->patchset = patchset_blob_p(ptr, len);
+  return changeset;
+}
+
+/*
+ * Document-class: Extralite::ChangeGroup
+ *
+ * This class implements a change group, which combines multiple changesets
+ * into a single changeset. Changes to the same row are merged, so that the
+ * resulting changeset contains at most one change per row:
+ *
+ *     group = Extralite::ChangeGroup.new
+ *     changesets.each { |c| group << c }
+ *     group.to_changeset.apply(replica)
+ */
 
+typedef struct {
+  sqlite3_changegroup *group;
+} ChangeGroup_t;
+
+static size_t ChangeGroup_size(const void *ptr) {
+  return sizeof(ChangeGroup_t);
+}
+
+static void ChangeGroup_free(void *ptr) {
+  ChangeGroup_t *group = ptr;
+  if (group->group) sqlite3changegroup_delete(group->group);
+  free(ptr);
+}
+
+static const rb_data_type_t ChangeGroup_type = {
+    "ChangeGroup",
+    {0, ChangeGroup_free, ChangeGroup_size,},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE ChangeGroup_allocate(VALUE klass) {
+  ChangeGroup_t *group = ALLOC(ChangeGroup_t);
+  group->group = NULL;
+  return TypedData_Wrap_Struct(klass, &ChangeGroup_type, group);
+}
+
+static inline ChangeGroup_t *self_to_change_group(VALUE obj) {
+  ChangeGroup_t *group;
+  TypedData_Get_Struct((obj), ChangeGroup_t, &ChangeGroup_type, (group));
+  if (!group->group) rb_raise(cError, "Change group not initialized");
+  return group;
+}
+
+/* Initializes an empty change group.
+ *
+ * @return [void]
+ */
+VALUE ChangeGroup_initialize(VALUE self) {
+  ChangeGroup_t *group;
+  TypedData_Get_Struct(self, ChangeGroup_t, &ChangeGroup_type, group);
+  if (group->group) sqlite3changegroup_delete(group->group);
+
+  int rc = sqlite3changegroup_new(&group->group);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while creating change group: %s", sqlite3_errstr(rc));
+  return Qnil;
+}
+
+/* Adds the given changeset to the change group. The changeset can be given as
+ * an `Extralite::Changeset` or as a changeset BLOB.
+ *
+ * @param changeset [Extralite::Changeset, String] changeset to add
+ * @return [Extralite::ChangeGroup] change group
+ */
+VALUE ChangeGroup_add(VALUE self, VALUE changeset) {
+  ChangeGroup_t *group = self_to_change_group(self);
+  int rc;
+
+  if (TYPE(changeset) == T_STRING)
+    rc = sqlite3changegroup_add(group->group, RSTRING_LEN(changeset), RSTRING_PTR(changeset));
+  else {
+    Changeset_t *changeset_struct = self_to_changeset(changeset);
+    verify_changeset(changeset_struct);
+    rc = sqlite3changegroup_add(group->group, changeset_struct->changeset_len, changeset_struct->changeset_ptr);
+  }
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while adding changeset to change group: %s", sqlite3_errstr(rc));
+
+  RB_GC_GUARD(changeset);
+  return self;
+}
+
+/* Adds a changeset read from the given IO to the change group. The changeset is
+ * read incrementally, without loading it entirely into memory.
+ *
+ * @param io [IO] IO to read the changeset from
+ * @return [Extralite::ChangeGroup] change group
+ */
+VALUE ChangeGroup_add_from(VALUE self, VALUE io) {
+  ChangeGroup_t *group = self_to_change_group(self);
+
+  struct stream_ctx stream = { .io = io, .bytes = 0, .state = 0 };
+  int rc = sqlite3changegroup_add_strm(group->group, stream_input, &stream);
+  stream_check(&stream);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while adding changeset to change group: %s", sqlite3_errstr(rc));
+
+  return self;
+}
+
+/* Returns a changeset containing the combined changes in the change group.
+ *
+ * @return [Extralite::Changeset] combined changeset
+ */
+VALUE ChangeGroup_to_changeset(VALUE self) {
+  ChangeGroup_t *group = self_to_change_group(self);
+  int len;
+  void *ptr;
+
+  int rc = sqlite3changegroup_output(group->group, &len, &ptr);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while collecting changeset from change group: %s", sqlite3_errstr(rc));
+
+  return changeset_from_ptr(len, ptr);
+}
+
+/* Writes the combined changes in the change group to the given IO, without
+ * holding the entire changeset in memory.
+ *
+ * @param io [IO] IO to write to
+ * @return [Integer] number of bytes written
+ */
+VALUE ChangeGroup_write_to(VALUE self, VALUE io) {
+  ChangeGroup_t *group = self_to_change_group(self);
+
+  struct stream_ctx stream = { .io = io, .bytes = 0, .state = 0 };
+  int rc = sqlite3changegroup_output_strm(group->group, stream_output, &stream);
+  stream_check(&stream);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while writing changeset from change group: %s", sqlite3_errstr(rc));
+
+  return LL2NUM(stream.bytes);
+}
+
+/* call-seq:
+ *   Extralite::Changeset.concat(*changesets) -> changeset
+ *
+ * Combines the given changesets into a single changeset, merging changes to
+ * the same rows. Changesets can be given as `Extralite::Changeset` instances
+ * or as changeset BLOBs.
+ *
+ *     combined = Extralite::Changeset.concat(*changesets)
+ *     combined.apply(replica)
+ *
+ * @param *changesets [Array<Extralite::Changeset, String>] changesets to combine
+ * @return [Extralite::Changeset] combined changeset
+ */
+VALUE Changeset_concat(int argc, VALUE *argv, VALUE self) {
+  VALUE group = rb_funcall(cChangeGroup, ID_new, 0);
+  for (int i = 0; i < argc; i++) ChangeGroup_add(group, argv[i]);
+
+  VALUE changeset = ChangeGroup_to_changeset(group);
+  RB_GC_GUARD(group);
+  return changeset;
+}
+
+static int cdc_commit_hook(void *ptr) {
+  Database_t *db = (Database_t *)ptr;
+  if (db->cdc) db->cdc->pending_commits++;
+  return 0;
+}
+
+static VALUE cdc_session_create(VALUE ptr) {
+  Database_t *db = (Database_t *)ptr;
+  struct cdc_state *cdc = db->cdc;
+
+  int rc = sqlite3session_create(db->sqlite3_db, "main", &cdc->session);
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while creating session: %s", sqlite3_errstr(rc));
+
+  if (!NIL_P(cdc->tables))
+    Changeset_track_attach(db->sqlite3_db, cdc->session, cdc->tables);
+  else {
+    rc = sqlite3session_attach(cdc->session, NULL);
+    if (rc != SQLITE_OK)
+      rb_raise(cError, "Error while attaching all tables: %s", sqlite3_errstr(rc));
+  }
+  return Qnil;
+}
+
+void cdc_free(Database_t *db) {
+  struct cdc_state *cdc = db->cdc;
+  if (!cdc) return;
+
+  if (cdc->session) sqlite3session_delete(cdc->session);
+  if (db->sqlite3_db) sqlite3_commit_hook(db->sqlite3_db, NULL, NULL);
+  free(cdc);
+  db->cdc = NULL;
+}
+
+// Collects changes captured since the last flush, starts a new session, and
+// delivers the changes to the stream target, either by writing them to an IO
+// or by pushing a changeset to a queue.
+void cdc_flush(Database_t *db) {
+  struct cdc_state *cdc = db->cdc;
+  int len = 0;
+  void *ptr = NULL;
+
+  int rc = (cdc->patchset ? sqlite3session_patchset : sqlite3session_changeset)(
+    cdc->session, &len, &ptr
+  );
+  cdc->pending_commits = 0;
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Error while collecting changeset from session: %s", sqlite3_errstr(rc));
+
+  sqlite3session_delete(cdc->session);
+  cdc->session = NULL;
+  int state = 0;
+  rb_protect(cdc_session_create, (VALUE)db, &state);
+  if (state) {
+    sqlite3_free(ptr);
+    cdc_free(db);
+    rb_jump_tag(state);
+  }
+
+  if (!len) {
+    sqlite3_free(ptr);
+    return;
+  }
+
+  VALUE changeset = changeset_from_ptr(len, ptr);
+  if (rb_respond_to(cdc->target, ID_write))
+    Changeset_write_to(changeset, cdc->target);
+  else
+    rb_funcall(cdc->target, ID_push, 1, changeset);
+  RB_GC_GUARD(changeset);
+}
+
+/* call-seq:
+ *   db.cdc_stream(to:, tables: nil, flush_every: 1, patchset: false) -> db
+ *
+ * Starts a change data capture stream. Changes to the given tables (or all
+ * tables if not specified) are captured across transactions, and delivered to
+ * the given target after every `flush_every` commits. If the target responds
+ * to `#write` (e.g. an IO), changesets are written to it in serialized form.
+ * Otherwise, `Extralite::Changeset` instances are pushed to it (e.g. a Queue).
+ *
+ *     queue = Queue.new
+ *     db.cdc_stream(to: queue, tables: [:foo], flush_every: 10)
+ *     Thread.new { loop { queue.shift.apply(replica) } }
+ *
+ * Changes are delivered once the committing statement is done (or reset), as
+ * long as no transaction is open. Remaining changes can be delivered using
+ * `#cdc_flush`, and are also delivered when the stream is stopped or the
+ * database is closed.
+ *
+ * @param opts [Hash] stream options
+ * @option opts [IO, Queue] :to stream target
+ * @option opts [Array<String, Symbol>, nil] :tables tables to track
+ * @option opts [Integer] :flush_every number of commits per flush
+ * @option opts [bool] :patchset stream patchsets instead of changesets
+ * @return [Extralite::Database] database
+ */
+VALUE Database_cdc_stream(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[4];
+  VALUE opts;
+  VALUE kw_args[4];
+  Database_t *db = self_to_database(self);
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  if (!kw_ids[0]) {
+    CONST_ID(kw_ids[0], "to");
+    CONST_ID(kw_ids[1], "tables");
+    CONST_ID(kw_ids[2], "flush_every");
+    CONST_ID(kw_ids[3], "patchset");
+  }
+  rb_get_kwargs(NIL_P(opts) ? rb_hash_new() : opts, kw_ids, 1, 3, kw_args);
+
+  if (!db->sqlite3_db) rb_raise(cError, "Database is closed");
+  if (db->cdc) rb_raise(cError, "Change data capture stream already started");
+
+  int flush_every = (kw_args[2] == Qundef) ? 1 : NUM2INT(kw_args[2]);
+  if (flush_every < 1)
+    rb_raise(rb_eArgError, "Invalid flush_every value (expected integer > 0)");
+
+  VALUE tables = (kw_args[1] == Qundef) ? Qnil : kw_args[1];
+  if (!NIL_P(tables)) tables = rb_ary_freeze(rb_ary_dup(rb_Array(tables)));
+
+  struct cdc_state *cdc = malloc(sizeof(struct cdc_state));
+  cdc->session = NULL;
+  RB_OBJ_WRITE(self, &cdc->target, kw_args[0]);
+  RB_OBJ_WRITE(self, &cdc->tables, tables);
+  cdc->flush_every = flush_every;
+  cdc->patchset = (kw_args[3] != Qundef) && RTEST(kw_args[3]);
+  cdc->pending_commits = 0;
+  db->cdc = cdc;
+
+  int state = 0;
+  rb_protect(cdc_session_create, (VALUE)db, &state);
+  if (state) {
+    cdc_free(db);
+    rb_jump_tag(state);
+  }
+  sqlite3_commit_hook(db->sqlite3_db, cdc_commit_hook, db);
+
+  RB_GC_GUARD(tables);
+  return self;
+}
+
+/* Delivers all changes captured by the change data capture stream since the
+ * last flush, regardless of the `flush_every` setting.
+ *
+ * @return [Extralite::Database] database
+ */
+VALUE Database_cdc_flush(VALUE self) {
+  Database_t *db = self_to_database(self);
+  if (!db->cdc) rb_raise(cError, "Change data capture stream not started");
+
+  cdc_flush(db);
+  return self;
+}
+
+/* Stops the change data capture stream, delivering any remaining changes.
+ *
+ * @return [Extralite::Database] database
+ */
+VALUE Database_cdc_stop(VALUE self) {
+  Database_t *db = self_to_database(self);
+  if (!db->cdc) return self;
+
+  if (db->cdc->pending_commits) cdc_flush(db);
+  cdc_free(db);
   return self;
 }
 
@@ -442,15 +1275,42 @@ void Init_ExtraliteChangeset(void) {
   cChangeset = rb_define_class_under(mExtralite, "Changeset", rb_cObject);
   rb_define_alloc_func(cChangeset, Changeset_allocate);
 
+  rb_define_singleton_method(cChangeset, "apply_from", Changeset_apply_from, -1);
+  rb_define_singleton_method(cChangeset, "concat", Changeset_concat, -1);
+  rb_define_singleton_method(cChangeset, "stream_track", Changeset_stream_track, -1);
+
   rb_define_method(cChangeset, "initialize", Changeset_initialize, 0);
 
-  rb_define_method(cChangeset, "apply", Changeset_apply, 1);
+  rb_define_method(cChangeset, "apply", Changeset_apply, -1);
+  rb_define_method(cChangeset, "apply_stats", Changeset_apply_stats, 0);
   rb_define_method(cChangeset, "each", Changeset_each, 0);
   rb_define_method(cChangeset, "invert", Changeset_invert, 0);
   rb_define_method(cChangeset, "load", Changeset_load, 1);
   rb_define_method(cChangeset, "to_a", Changeset_to_a, 0);
   rb_define_method(cChangeset, "to_blob", Changeset_to_blob, 0);
+  rb_define_method(cChangeset, "patchset?", Changeset_patchset_p, 0);
   rb_define_method(cChangeset, "track", Changeset_track, 2);
+  rb_define_method(cChangeset, "track_patchset", Changeset_track_patchset, 2);
+  rb_define_method(cChangeset, "write_to", Changeset_write_to, 1);
+
+  cChangeGroup = rb_define_class_under(mExtralite, "ChangeGroup", rb_cObject);
+  rb_define_alloc_func(cChangeGroup, ChangeGroup_allocate);
+
+  rb_define_method(cChangeGroup, "initialize", ChangeGroup_initialize, 0);
+
+  rb_define_method(cChangeGroup, "<<", ChangeGroup_add, 1);
+  rb_define_method(cChangeGroup, "add", ChangeGroup_add, 1);
+  rb_define_method(cChangeGroup, "add_from", ChangeGroup_add_from, 1);
+  rb_define_method(cChangeGroup, "to_changeset", ChangeGroup_to_changeset, 0);
+  rb_define_method(cChangeGroup, "write_to", ChangeGroup_write_to, 1);
+
+  rb_define_method(cDatabase, "cdc_flush", Database_cdc_flush, 0);
+  rb_define_method(cDatabase, "cdc_stop", Database_cdc_stop, 0);
+  rb_define_method(cDatabase, "cdc_stream", Database_cdc_stream, -1);
+
+  ID_push   = rb_intern("push");
+  ID_read   = rb_intern("read");
+  ID_write  = rb_intern("write");
 
   SYM_delete = ID2SYM(rb_intern("delete"));
   SYM_insert = ID2SYM(rb_intern("insert"));
@@ -459,5 +1319,31 @@ void Init_ExtraliteChangeset(void) {
   rb_gc_register_mark_object(SYM_delete);
   rb_gc_register_mark_object(SYM_insert);
   rb_gc_register_mark_object(SYM_update);
+
+  SYM_abort       = ID2SYM(rb_intern("abort"));
+  SYM_omit        = ID2SYM(rb_intern("omit"));
+  SYM_replace     = ID2SYM(rb_intern("replace"));
+  SYM_conflict    = ID2SYM(rb_intern("conflict"));
+  SYM_constraint  = ID2SYM(rb_intern("constraint"));
+  SYM_data        = ID2SYM(rb_intern("data"));
+  SYM_foreign_key = ID2SYM(rb_intern("foreign_key"));
+  SYM_not_found   = ID2SYM(rb_intern("not_found"));
+  SYM_applied     = ID2SYM(rb_intern("applied"));
+  SYM_conflicts   = ID2SYM(rb_intern("conflicts"));
+  SYM_omitted     = ID2SYM(rb_intern("omitted"));
+  SYM_replaced    = ID2SYM(rb_intern("replaced"));
+
+  rb_gc_register_mark_object(SYM_abort);
+  rb_gc_register_mark_object(SYM_omit);
+  rb_gc_register_mark_object(SYM_replace);
+  rb_gc_register_mark_object(SYM_conflict);
+  rb_gc_register_mark_object(SYM_constraint);
+  rb_gc_register_mark_object(SYM_data);
+  rb_gc_register_mark_object(SYM_foreign_key);
+  rb_gc_register_mark_object(SYM_not_found);
+  rb_gc_register_mark_object(SYM_applied);
+  rb_gc_register_mark_object(SYM_conflicts);
+  rb_gc_register_mark_object(SYM_omitted);
+  rb_gc_register_mark_object(SYM_replaced);
 }
 #endif
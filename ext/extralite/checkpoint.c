@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "extralite.h"
+
+/*
+ * Background WAL checkpointing. The checkpointer runs on a dedicated thread,
+ * using its own connection to the database, and spends its time with the GVL
+ * released, either waiting for the next checkpoint or checkpointing. While the
+ * checkpointer is running, the automatic checkpoint normally performed by
+ * SQLite on commit is disabled for the database connection, so checkpoint work
+ * does not add to write latency.
+ */
+
+#define CHECKPOINT_DEFAULT_INTERVAL 1.0
+#define CHECKPOINT_SLEEP_SLICE_MS   20
+#define CHECKPOINT_MAX_BUSY_MS      1000
+#define CHECKPOINT_DEFAULT_AUTO     1000
+
+struct checkpoint_stats {
+  long long           checkpoints;
+  long long           frames_checkpointed;
+  long long           busy;
+  long long           errors;
+  long long           escalations;
+  int                 wal_frames;
+  int                 wal_frames_checkpointed;
+  long long           wal_size;
+  unsigned long long  last_duration_ns;
+  unsigned long long  total_duration_ns;
+  int                 last_mode;
+  const char          *last_error;
+};
+
+struct checkpoint_state {
+  VALUE               thread;
+  sqlite3             *conn;
+  char                wal_path[4096];
+  unsigned long long  interval_ns;
+  int                 mode;
+  long long           truncate_above;
+  // automatic checkpoint setting of the database connection, restored when
+  // the checkpointer is stopped
+  int                 saved_autocheckpoint;
+
+  // set from threads holding the GVL, read by the checkpointer while the GVL
+  // is released
+  volatile int        stop;
+  volatile int        interrupted;
+  // the checkpointer thread is done and its connection is closed
+  int                 done;
+  // the database was freed, the checkpointer thread frees the state when done
+  int                 detached;
+
+  // result of the last run, written while the GVL is released
+  int                 run;
+  int                 run_rc;
+  int                 run_mode;
+  int                 run_log;
+  int                 run_ckpt;
+  long long           run_wal_size;
+  unsigned long long  run_duration_ns;
+
+  struct checkpoint_stats stats;
+};
+
+VALUE SYM_busy;
+VALUE SYM_checkpoints;
+VALUE SYM_errors;
+VALUE SYM_escalations;
+VALUE SYM_frames_checkpointed;
+VALUE SYM_last_duration;
+VALUE SYM_last_error;
+VALUE SYM_last_mode;
+VALUE SYM_total_duration;
+VALUE SYM_wal_frames;
+VALUE SYM_wal_size;
+
+static inline long long wal_file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) ? 0 : (long long)st.st_size;
+}
+
+// Escalates the checkpoint mode if the WAL file has grown too large: to
+// restart above half the size limit, and to truncate above the size limit.
+static inline int checkpoint_escalated_mode(struct checkpoint_state *state, long long wal_size) {
+  if (!state->truncate_above) return state->mode;
+
+  if (wal_size > state->truncate_above)
+    return SQLITE_CHECKPOINT_TRUNCATE;
+  if (wal_size > state->truncate_above / 2 && state->mode < SQLITE_CHECKPOINT_RESTART)
+    return SQLITE_CHECKPOINT_RESTART;
+  return state->mode;
+}
+
+// Waits for the checkpoint interval, then runs a checkpoint. Called without
+// the GVL.
+void *checkpoint_run(void *ptr) {
+  struct checkpoint_state *state = ptr;
+  unsigned long long deadline = monotonic_ns() + state->interval_ns;
+
+  state->run = 0;
+  while (!state->stop && !state->interrupted) {
+    unsigned long long now = monotonic_ns();
+    if (now >= deadline) break;
+
+    int ms = (int)((deadline - now) / 1000000);
+    sqlite3_sleep(ms < 1 ? 1 : (ms > CHECKPOINT_SLEEP_SLICE_MS ? CHECKPOINT_SLEEP_SLICE_MS : ms));
+  }
+  if (state->stop || state->interrupted) return NULL;
+
+  // the connection only switches to WAL mode once the database is read
+  if (state->stats.wal_frames < 0)
+    sqlite3_exec(state->conn, "pragma schema_version", NULL, NULL, NULL);
+
+  state->run_mode = checkpoint_escalated_mode(state, wal_file_size(state->wal_path));
+  state->run_log = state->run_ckpt = 0;
+
+  unsigned long long t0 = monotonic_ns();
+  state->run_rc = sqlite3_wal_checkpoint_v2(
+    state->conn, NULL, state->run_mode, &state->run_log, &state->run_ckpt
+  );
+  state->run_duration_ns = monotonic_ns() - t0;
+  state->run_wal_size = wal_file_size(state->wal_path);
+  state->run = 1;
+  return NULL;
+}
+
+void checkpoint_ubf(void *ptr) {
+  struct checkpoint_state *state = ptr;
+  state->interrupted = 1;
+}
+
+static void checkpoint_update_stats(struct checkpoint_state *state) {
+  struct checkpoint_stats *stats = &state->stats;
+
+  if (state->run_mode != state->mode) stats->escalations++;
+  stats->last_mode = state->run_mode;
+  stats->last_duration_ns = state->run_duration_ns;
+  stats->total_duration_ns += state->run_duration_ns;
+  stats->wal_size = state->run_wal_size;
+
+  switch (state->run_rc) {
+    case SQLITE_OK:
+      stats->checkpoints++;
+      // the checkpointed frame count is for the WAL as a whole, and is reset
+      // when the WAL is restarted
+      if (state->run_ckpt > 0) {
+        int restarted = state->run_log < stats->wal_frames || state->run_ckpt < stats->wal_frames_checkpointed;
+        stats->frames_checkpointed += restarted ?
+          state->run_ckpt : state->run_ckpt - stats->wal_frames_checkpointed;
+      }
+      stats->wal_frames = state->run_log;
+      stats->wal_frames_checkpointed = state->run_ckpt > 0 ? state->run_ckpt : 0;
+      break;
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED:
+      stats->busy++;
+      break;
+    default:
+      stats->errors++;
+      stats->last_error = sqlite3_errstr(state->run_rc);
+  }
+}
+
+VALUE checkpoint_thread_loop(VALUE ptr) {
+  struct checkpoint_state *state = (struct checkpoint_state *)ptr;
+
+  while (!state->stop) {
+    state->interrupted = 0;
+    rb_thread_call_without_gvl(checkpoint_run, (void *)state, checkpoint_ubf, (void *)state);
+    if (state->run) checkpoint_update_stats(state);
+    rb_thread_check_ints();
+  }
+  return Qnil;
+}
+
+VALUE checkpoint_thread_cleanup(VALUE ptr) {
+  struct checkpoint_state *state = (struct checkpoint_state *)ptr;
+
+  connection_close(state->conn);
+  state->conn = NULL;
+  state->done = 1;
+  if (state->detached) free(state);
+  return Qnil;
+}
+
+VALUE checkpoint_thread(void *ptr) {
+  return rb_ensure(SAFE(checkpoint_thread_loop), (VALUE)ptr, SAFE(checkpoint_thread_cleanup), (VALUE)ptr);
+}
+
+void checkpoint_mark(Database_t *db) {
+  if (db->checkpoint) rb_gc_mark(db->checkpoint->thread);
+}
+
+// Returns the automatic checkpoint setting of the given connection, which
+// cannot be read through sqlite3_wal_autocheckpoint.
+static int wal_autocheckpoint_get(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  int value = CHECKPOINT_DEFAULT_AUTO;
+  if (sqlite3_prepare_v2(db, "pragma wal_autocheckpoint", -1, &stmt, NULL) != SQLITE_OK)
+    return value;
+
+  if (sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+// Stops the checkpointer. If join is true, waits for the checkpointer thread to
+// terminate. Otherwise (when called on GC), the state is left to be freed by
+// the checkpointer thread.
+void checkpoint_stop(Database_t *db, int join) {
+  struct checkpoint_state *state = db->checkpoint;
+  if (!state) return;
+
+  int saved_autocheckpoint = state->saved_autocheckpoint;
+  db->checkpoint = NULL;
+  state->stop = 1;
+  if (join) {
+    if (!state->done) rb_funcall(state->thread, ID_join, 0);
+    free(state);
+  }
+  else if (state->done)
+    free(state);
+  else
+    state->detached = 1;
+
+  if (db->sqlite3_db)
+    sqlite3_wal_autocheckpoint(db->sqlite3_db, saved_autocheckpoint);
+}
+
+static inline VALUE checkpoint_mode_to_symbol(int mode) {
+  switch (mode) {
+    case SQLITE_CHECKPOINT_FULL:      return SYM_full;
+    case SQLITE_CHECKPOINT_RESTART:   return SYM_restart;
+    case SQLITE_CHECKPOINT_TRUNCATE:  return SYM_truncate;
+    default:                          return SYM_passive;
+  }
+}
+
+static VALUE checkpoint_stats_hash(struct checkpoint_stats *stats) {
+  VALUE hash = rb_hash_new();
+  rb_hash_aset(hash, SYM_checkpoints, LL2NUM(stats->checkpoints));
+  rb_hash_aset(hash, SYM_frames_checkpointed, LL2NUM(stats->frames_checkpointed));
+  rb_hash_aset(hash, SYM_wal_frames, INT2NUM(stats->wal_frames));
+  rb_hash_aset(hash, SYM_wal_size, LL2NUM(stats->wal_size));
+  rb_hash_aset(hash, SYM_last_duration, DBL2NUM(stats->last_duration_ns / 1e9));
+  rb_hash_aset(hash, SYM_total_duration, DBL2NUM(stats->total_duration_ns / 1e9));
+  rb_hash_aset(hash, SYM_last_mode, stats->checkpoints + stats->busy + stats->errors ?
+    checkpoint_mode_to_symbol(stats->last_mode) : Qnil);
+  rb_hash_aset(hash, SYM_escalations, LL2NUM(stats->escalations));
+  rb_hash_aset(hash, SYM_busy, LL2NUM(stats->busy));
+  rb_hash_aset(hash, SYM_errors, LL2NUM(stats->errors));
+  rb_hash_aset(hash, SYM_last_error, stats->last_error ? rb_str_new_cstr(stats->last_error) : Qnil);
+  return hash;
+}
+
+/* Starts checkpointing the WAL file periodically in the background. The
+ * checkpoints are performed on a separate thread using a separate connection
+ * to the database, with the GVL released. While the background checkpointer
+ * is running, the automatic checkpoint normally performed by SQLite on commit
+ * is disabled for this connection. Calling this method while the background
+ * checkpointer is running restarts it with the new settings.
+ *
+ * If `truncate_above_mb` is given, checkpoints are escalated to `:restart`
+ * when the WAL file is larger than half the given size, and to `:truncate`
+ * when it is larger than the given size.
+ *
+ *     db.auto_checkpoint(interval: 0.5, truncate_above_mb: 64)
+ *
+ * @param interval [Numeric] interval between checkpoints in seconds (default: 1)
+ * @param mode [Symbol] checkpoint mode (`:passive`, `:full`, `:restart`, `:truncate`)
+ * @param truncate_above_mb [Numeric, nil] WAL size limit in MiB
+ * @return [Extralite::Database] database
+ */
+VALUE Database_auto_checkpoint(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[3];
+  VALUE kw_args[3];
+  VALUE opts;
+  double interval = CHECKPOINT_DEFAULT_INTERVAL;
+  int mode = SQLITE_CHECKPOINT_PASSIVE;
+  double truncate_above_mb = 0;
+
+  rb_scan_args(argc, argv, "00:", &opts);
+  Database_t *db = self_to_database(self);
+  if (!db->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) {
+      CONST_ID(kw_ids[0], "interval");
+      CONST_ID(kw_ids[1], "mode");
+      CONST_ID(kw_ids[2], "truncate_above_mb");
+    }
+    rb_get_kwargs(opts, kw_ids, 0, 3, kw_args);
+    if (kw_args[0] != Qundef) interval = NUM2DBL(kw_args[0]);
+    if (kw_args[1] != Qundef) mode = checkpoint_mode_symbol_to_int(kw_args[1]);
+    if (kw_args[2] != Qundef && !NIL_P(kw_args[2])) truncate_above_mb = NUM2DBL(kw_args[2]);
+  }
+  if (interval <= 0) rb_raise(rb_eArgError, "Invalid checkpoint interval");
+  if (truncate_above_mb < 0) rb_raise(rb_eArgError, "Invalid WAL size limit");
+
+  const char *filename = sqlite3_db_filename(db->sqlite3_db, "main");
+  if (!filename || !*filename)
+    rb_raise(cError, "Background checkpoints require a file database");
+
+  checkpoint_stop(db, 1);
+
+  struct checkpoint_state *state = calloc(1, sizeof(struct checkpoint_state));
+  if (!state) rb_raise(cError, "Failed to allocate checkpoint state");
+
+  snprintf(state->wal_path, sizeof(state->wal_path), "%s-wal", filename);
+  state->interval_ns = (unsigned long long)(interval * 1e9);
+  state->mode = mode;
+  state->truncate_above = (long long)(truncate_above_mb * 1024 * 1024);
+  state->thread = Qnil;
+  state->stats.wal_frames = -1;
+
+  int rc = connection_open(filename, &state->conn, SQLITE_OPEN_READWRITE);
+  if (rc) {
+    VALUE msg = rb_str_new_cstr(sqlite3_errmsg(state->conn));
+    connection_close(state->conn);
+    free(state);
+    rb_raise(cError, "%"PRIsVALUE, msg);
+  }
+  int busy_ms = (int)(interval * 1000);
+  sqlite3_busy_timeout(state->conn, busy_ms > CHECKPOINT_MAX_BUSY_MS ? CHECKPOINT_MAX_BUSY_MS : busy_ms);
+
+  state->saved_autocheckpoint = wal_autocheckpoint_get(db->sqlite3_db);
+  sqlite3_wal_autocheckpoint(db->sqlite3_db, 0);
+  db->checkpoint = state;
+  RB_OBJ_WRITE(self, &state->thread, rb_thread_create(checkpoint_thread, (void *)state));
+  return self;
+}
+
+/* Stops the background checkpointer, waiting for any checkpoint in progress to
+ * complete, and restores the automatic checkpoint setting in effect before it
+ * was started. Returns the checkpoint statistics (see `#checkpoint_stats`), or
+ * nil if the background checkpointer is not running.
+ *
+ * @return [Hash, nil] checkpoint statistics
+ */
+VALUE Database_stop_auto_checkpoint(VALUE self) {
+  Database_t *db = self_to_database(self);
+  struct checkpoint_state *state = db->checkpoint;
+  if (!state) return Qnil;
+
+  struct checkpoint_stats stats = state->stats;
+  checkpoint_stop(db, 1);
+  return checkpoint_stats_hash(&stats);
+}
+
+/* Returns statistics for the background checkpointer, or nil if it is not
+ * running. The returned hash contains the following keys:
+ *
+ * - `:checkpoints`: number of checkpoints performed.
+ * - `:frames_checkpointed`: total number of WAL frames checkpointed.
+ * - `:wal_frames`: number of frames in the WAL after the last checkpoint.
+ * - `:wal_size`: WAL file size in bytes after the last checkpoint.
+ * - `:last_duration`, `:total_duration`: checkpoint duration in seconds.
+ * - `:last_mode`: mode of the last checkpoint.
+ * - `:escalations`: number of checkpoints escalated because of WAL size.
+ * - `:busy`: number of checkpoints that could not complete due to locking.
+ * - `:errors`, `:last_error`: number of failed checkpoints, and last error.
+ *
+ * @return [Hash, nil] checkpoint statistics
+ */
+VALUE Database_checkpoint_stats(VALUE self) {
+  Database_t *db = self_to_database(self);
+  return db->checkpoint ? checkpoint_stats_hash(&db->checkpoint->stats) : Qnil;
+}
+
+void Init_ExtraliteCheckpoint(void) {
+  rb_define_method(cDatabase, "auto_checkpoint",      Database_auto_checkpoint, -1);
+  rb_define_method(cDatabase, "checkpoint_stats",     Database_checkpoint_stats, 0);
+  rb_define_method(cDatabase, "stop_auto_checkpoint", Database_stop_auto_checkpoint, 0);
+
+  SYM_busy                = ID2SYM(rb_intern("busy"));
+  SYM_checkpoints         = ID2SYM(rb_intern("checkpoints"));
+  SYM_errors              = ID2SYM(rb_intern("errors"));
+  SYM_escalations         = ID2SYM(rb_intern("escalations"));
+  SYM_frames_checkpointed = ID2SYM(rb_intern("frames_checkpointed"));
+  SYM_last_duration       = ID2SYM(rb_intern("last_duration"));
+  SYM_last_error          = ID2SYM(rb_intern("last_error"));
+  SYM_last_mode           = ID2SYM(rb_intern("last_mode"));
+  SYM_total_duration      = ID2SYM(rb_intern("total_duration"));
+  SYM_wal_frames          = ID2SYM(rb_intern("wal_frames"));
+  SYM_wal_size            = ID2SYM(rb_intern("wal_size"));
+
+  rb_gc_register_mark_object(SYM_busy);
+  rb_gc_register_mark_object(SYM_checkpoints);
+  rb_gc_register_mark_object(SYM_errors);
+  rb_gc_register_mark_object(SYM_escalations);
+  rb_gc_register_mark_object(SYM_frames_checkpointed);
+  rb_gc_register_mark_object(SYM_last_duration);
+  rb_gc_register_mark_object(SYM_last_error);
+  rb_gc_register_mark_object(SYM_last_mode);
+  rb_gc_register_mark_object(SYM_total_duration);
+  rb_gc_register_mark_object(SYM_wal_frames);
+  rb_gc_register_mark_object(SYM_wal_size);
+}
@@ -12,38 +12,19 @@ inline void *gvl_call(enum gvl_mode mode, void *(*fn)(void *), void *data) {
   }
 }
 
-static inline VALUE get_column_value(sqlite3_stmt *stmt, int col, int type) {
-  switch (type) {
-    case SQLITE_NULL:
-      return Qnil;
-    case SQLITE_INTEGER:
-      return LL2NUM(sqlite3_column_int64(stmt, col));
-    case SQLITE_FLOAT:
-      return DBL2NUM(sqlite3_column_double(stmt, col));
-    case SQLITE_TEXT:
-      return rb_enc_str_new((char *)sqlite3_column_text(stmt, col), (long)sqlite3_column_bytes(stmt, col), UTF8_ENCODING);
-    case SQLITE_BLOB:
-      return rb_str_new((const char *)sqlite3_column_blob(stmt, col), (long)sqlite3_column_bytes(stmt, col));
-    default:
-      rb_raise(cError, "Unknown column type: %d", type);
-  }
-
-  return Qnil;
-}
-
-int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value);
+int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value, VALUE *pins);
 
-static inline void bind_key_value(sqlite3_stmt *stmt, VALUE k, VALUE v) {
+static inline void bind_key_value(sqlite3_stmt *stmt, VALUE k, VALUE v, VALUE *pins) {
   switch (TYPE(k)) {
     case T_FIXNUM:
-      bind_parameter_value(stmt, FIX2INT(k), v);
+      bind_parameter_value(stmt, FIX2INT(k), v, pins);
       break;
     case T_SYMBOL:
       k = rb_sym2str(k);
     case T_STRING:
       if (RSTRING_PTR(k)[0] != ':') k = rb_str_plus(rb_str_new2(":"), k);
       int pos = sqlite3_bind_parameter_index(stmt, StringValuePtr(k));
-      bind_parameter_value(stmt, pos, v);
+      bind_parameter_value(stmt, pos, v, pins);
       break;
     default:
       rb_raise(cParameterError, "Cannot bind parameter with a key of type %"PRIsVALUE"",
@@ -51,28 +32,48 @@ static inline void bind_key_value(sqlite3_stmt *stmt, VALUE k, VALUE v) {
   }
 }
 
-void bind_hash_parameter_values(sqlite3_stmt *stmt, VALUE hash) {
+void bind_hash_parameter_values(sqlite3_stmt *stmt, VALUE hash, VALUE *pins) {
   VALUE keys = rb_funcall(hash, ID_keys, 0);
   long len = RARRAY_LEN(keys);
   for (long i = 0; i < len; i++) {
     VALUE k = RARRAY_AREF(keys, i);
     VALUE v = rb_hash_aref(hash, k);
-    bind_key_value(stmt, k, v);
+    bind_key_value(stmt, k, v, pins);
   }
   RB_GC_GUARD(keys);
 }
 
-void bind_struct_parameter_values(sqlite3_stmt *stmt, VALUE struct_obj) {
+void bind_struct_parameter_values(sqlite3_stmt *stmt, VALUE struct_obj, VALUE *pins) {
   VALUE members = rb_struct_members(struct_obj);
   for (long i = 0; i < RSTRUCT_LEN(struct_obj); i++) {
     VALUE k = rb_ary_entry(members, i);
     VALUE v = RSTRUCT_GET(struct_obj, i);
-    bind_key_value(stmt, k, v);
+    bind_key_value(stmt, k, v, pins);
   }
   RB_GC_GUARD(members);
 }
 
-inline int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value) {
+// Strings at least this long are bound without copying if frozen. The
+// threshold is above the largest embedded string capacity, so the string
+// buffer can neither be modified nor moved by GC compaction while pinned.
+#define BIND_STATIC_MIN_LEN 1024
+
+// Returns the destructor to use when binding the given string. Frozen,
+// heap-allocated strings are bound with SQLITE_STATIC and pushed into the given
+// pins array, which the caller must keep alive (and unchanged) until the
+// statement is reset and its bindings cleared. All other strings are copied by
+// SQLite.
+static inline sqlite3_destructor_type bind_string_destructor(VALUE str, VALUE *pins) {
+  if (!pins || !OBJ_FROZEN(str) || RSTRING_LEN(str) < BIND_STATIC_MIN_LEN ||
+      !FL_TEST_RAW(str, RSTRING_NOEMBED))
+    return SQLITE_TRANSIENT;
+
+  if (NIL_P(*pins)) *pins = rb_ary_new();
+  rb_ary_push(*pins, str);
+  return SQLITE_STATIC;
+}
+
+inline int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value, VALUE *pins) {
   switch (TYPE(value)) {
     case T_NIL:
       sqlite3_bind_null(stmt, pos);
@@ -94,22 +95,22 @@ inline int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value) {
       value = rb_sym2str(value);
     case T_STRING:
       if (rb_enc_get_index(value) == rb_ascii8bit_encindex() || CLASS_OF(value) == cBlob)
-        sqlite3_bind_blob(stmt, pos, RSTRING_PTR(value), RSTRING_LEN(value), SQLITE_TRANSIENT);
+        sqlite3_bind_blob(stmt, pos, RSTRING_PTR(value), RSTRING_LEN(value), bind_string_destructor(value, pins));
       else
-        sqlite3_bind_text(stmt, pos, RSTRING_PTR(value), RSTRING_LEN(value), SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, pos, RSTRING_PTR(value), RSTRING_LEN(value), bind_string_destructor(value, pins));
       return 1;
     case T_ARRAY:
       {
         int count = RARRAY_LEN(value);
         for (int i = 0; i < count; i++)
-          bind_parameter_value(stmt, pos + i, RARRAY_AREF(value, i));
+          bind_parameter_value(stmt, pos + i, RARRAY_AREF(value, i), pins);
         return count;
       }
     case T_HASH:
-      bind_hash_parameter_values(stmt, value);
+      bind_hash_parameter_values(stmt, value, pins);
       return 0;
     case T_STRUCT:
-      bind_struct_parameter_values(stmt, value);
+      bind_struct_parameter_values(stmt, value, pins);
       return 0;
     default:
       rb_raise(cParameterError, "Cannot bind parameter at position %d of type %"PRIsVALUE"",
@@ -117,59 +118,30 @@ inline int bind_parameter_value(sqlite3_stmt *stmt, int pos, VALUE value) {
   }
 }
 
-inline void bind_all_parameters(sqlite3_stmt *stmt, int argc, VALUE *argv) {
+inline void bind_all_parameters(sqlite3_stmt *stmt, int argc, VALUE *argv, VALUE *pins) {
   int pos = 1;
   for (int i = 0; i < argc; i++) {
-    pos += bind_parameter_value(stmt, pos, argv[i]);
+    pos += bind_parameter_value(stmt, pos, argv[i], pins);
   }
 }
 
-inline void bind_all_parameters_from_object(sqlite3_stmt *stmt, VALUE obj) {
+inline void bind_all_parameters_from_object(sqlite3_stmt *stmt, VALUE obj, VALUE *pins) {
   if (TYPE(obj) == T_ARRAY) {
     int pos = 1;
     int count = RARRAY_LEN(obj);
     for (int i = 0; i < count; i++)
-      pos += bind_parameter_value(stmt, pos, RARRAY_AREF(obj, i));
+      pos += bind_parameter_value(stmt, pos, RARRAY_AREF(obj, i), pins);
   }
   else
-    bind_parameter_value(stmt, 1, obj);
-}
-
-#define MAX_EMBEDDED_COLUMN_NAMES 12
-
-struct column_names {
-  int count;
-  union {
-    VALUE array;
-    VALUE names[MAX_EMBEDDED_COLUMN_NAMES];
-  };
-};
-
-static inline void column_names_setup(struct column_names *names, int count) {
-  names->count = count;
-  names->array = (count > MAX_EMBEDDED_COLUMN_NAMES) ? rb_ary_new2(count) : Qnil;
-}
-
-static inline void column_names_set(struct column_names *names, int idx, VALUE value) {
-  if (names->count <= MAX_EMBEDDED_COLUMN_NAMES) 
-    names->names[idx] = value;
-  else
-    rb_ary_push(names->array, value);
-}
-
-static inline VALUE column_names_get(struct column_names *names, int idx) {
-  return (names->count <= MAX_EMBEDDED_COLUMN_NAMES) ?
-    names->names[idx] : RARRAY_AREF(names->array, idx);
+    bind_parameter_value(stmt, 1, obj, pins);
 }
 
-static inline struct column_names get_column_names(sqlite3_stmt *stmt, int column_count) {
-  struct column_names names;
-  column_names_setup(&names, column_count);
-  for (int i = 0; i < column_count; i++) {
-    VALUE name = ID2SYM(rb_intern(sqlite3_column_name(stmt, i)));
-    column_names_set(&names, i, name);
-  }
-  return names;
+// Clears the statement's bindings, then releases the strings pinned for them.
+// The bindings must be cleared first, since the statement refers to the pinned
+// strings' buffers until then.
+inline void clear_bindings(sqlite3_stmt *stmt, VALUE pins) {
+  sqlite3_clear_bindings(stmt);
+  if (!NIL_P(pins)) rb_ary_clear(pins);
 }
 
 static inline VALUE get_column_names_array(sqlite3_stmt *stmt, int column_count) {
@@ -181,38 +153,184 @@ static inline VALUE get_column_names_array(sqlite3_stmt *stmt, int column_count)
   return arr;
 }
 
-static inline VALUE row_to_hash(sqlite3_stmt *stmt, int column_count, struct column_names *names) {
-  VALUE row = rb_hash_new();
-  if (names->count <= MAX_EMBEDDED_COLUMN_NAMES) {
-    for (int i = 0; i < column_count; i++) {
-      VALUE value = get_column_value(stmt, i, sqlite3_column_type(stmt, i));
-      rb_hash_aset(row, names->names[i], value);
-    }
-  }
-  else {
-    for (int i = 0; i < column_count; i++) {
-      VALUE value = get_column_value(stmt, i, sqlite3_column_type(stmt, i));
-      rb_hash_aset(row, RARRAY_AREF(names->array, i), value);
-    }
+#define MAX_EMBEDDED_HASH_COLUMNS 16
+
+// Key/value buffer for building row hashes with a single bulk insert. Keys are
+// set once per execution, values are set for each row.
+struct hash_row {
+  int   count;
+  VALUE *pairs;
+  VALUE buffer;
+  VALUE embedded[MAX_EMBEDDED_HASH_COLUMNS * 2];
+};
+
+static inline void hash_row_setup(struct hash_row *row, sqlite3_stmt *stmt, int column_count) {
+  row->count = column_count;
+  row->buffer = 0;
+  row->pairs = (column_count > MAX_EMBEDDED_HASH_COLUMNS) ?
+    rb_alloc_tmp_buffer((volatile VALUE *)&row->buffer, column_count * 2 * sizeof(VALUE)) :
+    row->embedded;
+
+  for (int i = 0; i < column_count; i++) {
+    row->pairs[i * 2] = ID2SYM(rb_intern(sqlite3_column_name(stmt, i)));
+    row->pairs[i * 2 + 1] = Qnil;
   }
+}
+
+static inline VALUE row_to_hash(sqlite3_stmt *stmt, struct hash_row *hash_row, struct column_decoders *decoders) {
+  VALUE *pairs = hash_row->pairs;
+  for (int i = 0; i < hash_row->count; i++)
+    pairs[i * 2 + 1] = COLUMN_VALUE(stmt, i, decoders);
+
+  // the hash is sized for all columns up front, so it is not grown while
+  // inserting (rb_hash_bulk_insert also presizes empty hashes on older Rubies)
+#ifdef HAVE_RB_HASH_NEW_CAPA
+  VALUE row = rb_hash_new_capa(hash_row->count);
+#else
+  VALUE row = rb_hash_new();
+#endif
+  rb_hash_bulk_insert(hash_row->count * 2, pairs, row);
   return row;
 }
 
-static inline VALUE row_to_array(sqlite3_stmt *stmt, int column_count) {
+static inline VALUE row_to_array(sqlite3_stmt *stmt, int column_count, struct column_decoders *decoders) {
   VALUE row = rb_ary_new2(column_count);
   for (int i = 0; i < column_count; i++) {
-    VALUE value = get_column_value(stmt, i, sqlite3_column_type(stmt, i));
+    VALUE value = COLUMN_VALUE(stmt, i, decoders);
     rb_ary_push(row, value);
   }
   return row;
 }
 
-static inline void row_to_splat_values(sqlite3_stmt *stmt, int column_count, VALUE *values) {
+// Splat rows are read into an argv buffer, which is embedded for up to
+// MAX_EMBEDDED_ARGV_COLUMNS columns, and allocated once per query execution for
+// wider rows.
+#define MAX_EMBEDDED_ARGV_COLUMNS 16
+
+struct splat_row {
+  VALUE *values;
+  VALUE buffer;
+  VALUE embedded[MAX_EMBEDDED_ARGV_COLUMNS];
+};
+
+static inline void splat_row_setup(struct splat_row *splat_row, int column_count) {
+  splat_row->buffer = 0;
+  splat_row->values = (column_count > MAX_EMBEDDED_ARGV_COLUMNS) ?
+    rb_alloc_tmp_buffer((volatile VALUE *)&splat_row->buffer, column_count * sizeof(VALUE)) :
+    splat_row->embedded;
+}
+
+static inline void row_to_splat_values(sqlite3_stmt *stmt, int column_count, VALUE *values, struct column_decoders *decoders) {
+  // unrolled for the most common column counts
+  switch (column_count) {
+    case 4: values[3] = COLUMN_VALUE(stmt, 3, decoders); // fall through
+    case 3: values[2] = COLUMN_VALUE(stmt, 2, decoders); // fall through
+    case 2: values[1] = COLUMN_VALUE(stmt, 1, decoders); // fall through
+    case 1: values[0] = COLUMN_VALUE(stmt, 0, decoders); // fall through
+    case 0: return;
+  }
   for (int i = 0; i < column_count; i++) {
-    values[i] = get_column_value(stmt, i, sqlite3_column_type(stmt, i));
+    values[i] = COLUMN_VALUE(stmt, i, decoders);
   }
 }
 
+static inline int subclass_p(VALUE klass, VALUE super) {
+  return klass != super && RTEST(rb_class_inherited_p(klass, super));
+}
+
+static inline int data_class_p(VALUE klass) {
+  ID id_Data = rb_intern("Data");
+  return rb_const_defined(rb_cObject, id_Data) && subclass_p(klass, rb_const_get(rb_cObject, id_Data));
+}
+
+// Verifies the given class can be used for rows in object mode.
+VALUE row_class_check(VALUE klass) {
+  if (RB_TYPE_P(klass, T_CLASS) && (subclass_p(klass, rb_cStruct) || data_class_p(klass)))
+    return klass;
+
+  rb_raise(rb_eArgError, "Expected a Struct or Data class");
+}
+
+enum row_class_kind {
+  // Struct, values passed to #initialize in member order
+  ROW_CLASS_POSITIONAL,
+  // Data or keyword_init Struct, values passed to #initialize as keywords
+  ROW_CLASS_KEYWORDS,
+  // Data with default #initialize and all members selected, values set directly
+  ROW_CLASS_DATA
+};
+
+// per-execution mapping of result columns to members of a Struct or Data class
+struct row_class {
+  VALUE               klass;
+  enum row_class_kind kind;
+  VALUE               members;
+  int                 member_count;
+  VALUE               buffer;
+  VALUE               *values;
+  int                 *column_members;
+};
+
+static inline void row_class_setup(struct row_class *rc, VALUE klass, sqlite3_stmt *stmt, int column_count) {
+  rc->klass = klass;
+  rc->members = rb_funcall(klass, rb_intern("members"), 0);
+  rc->member_count = (int)RARRAY_LEN(rc->members);
+  rc->buffer = 0;
+  rc->values = rb_alloc_tmp_buffer(
+    (volatile VALUE *)&rc->buffer, rc->member_count * sizeof(VALUE) + column_count * sizeof(int)
+  );
+  rc->column_members = (int *)(rc->values + rc->member_count);
+
+  for (int i = 0; i < rc->member_count; i++) rc->values[i] = Qnil;
+
+  int mapped_count = 0;
+  for (int i = 0; i < column_count; i++) {
+    VALUE name = ID2SYM(rb_intern(sqlite3_column_name(stmt, i)));
+    int idx = 0;
+    while (idx < rc->member_count && RARRAY_AREF(rc->members, idx) != name) idx++;
+    if (idx == rc->member_count)
+      rb_raise(cError, "Column %"PRIsVALUE" has no matching member in %"PRIsVALUE, name, klass);
+
+    // values are all nil until the first row is read, so use them to count
+    // the members that have a matching column
+    if (rc->values[idx] == Qnil) {
+      rc->values[idx] = Qfalse;
+      mapped_count++;
+    }
+    rc->column_members[i] = idx;
+  }
+  for (int i = 0; i < rc->member_count; i++) rc->values[i] = Qnil;
+
+  if (data_class_p(klass))
+    rc->kind = (mapped_count == rc->member_count && rb_method_basic_definition_p(klass, rb_intern("initialize"))) ?
+      ROW_CLASS_DATA : ROW_CLASS_KEYWORDS;
+  else
+    rc->kind = RTEST(rb_funcall(klass, rb_intern("keyword_init?"), 0)) ?
+      ROW_CLASS_KEYWORDS : ROW_CLASS_POSITIONAL;
+}
+
+static inline VALUE row_to_object(sqlite3_stmt *stmt, int column_count, struct row_class *rc, struct column_decoders *decoders) {
+  if (rc->kind == ROW_CLASS_KEYWORDS) {
+    VALUE kwargs = rb_hash_new();
+    for (int i = 0; i < column_count; i++) {
+      VALUE value = COLUMN_VALUE(stmt, i, decoders);
+      rb_hash_aset(kwargs, RARRAY_AREF(rc->members, rc->column_members[i]), value);
+    }
+    return rb_class_new_instance_kw(1, &kwargs, rc->klass, RB_PASS_KEYWORDS);
+  }
+
+  // members without a matching column are left nil
+  for (int i = 0; i < column_count; i++)
+    rc->values[rc->column_members[i]] = COLUMN_VALUE(stmt, i, decoders);
+
+  if (rc->kind == ROW_CLASS_POSITIONAL)
+    return rb_class_new_instance(rc->member_count, rc->values, rc->klass);
+
+  VALUE obj = rb_obj_alloc(rc->klass);
+  rb_struct_initialize(obj, rb_ary_new_from_values(rc->member_count, rc->values));
+  return obj;
+}
+
 typedef struct {
   sqlite3 *db;
   sqlite3_stmt **stmt;
@@ -340,15 +458,20 @@ inline enum gvl_mode stepwise_gvl_mode(query_ctx *ctx) {
 
 inline int stmt_iterate(query_ctx *ctx) {
   struct step_ctx step_ctx = {ctx->stmt, 0};
+  enum gvl_mode mode = stepwise_gvl_mode(ctx);
   ctx->step_count += 1;
-  gvl_call(stepwise_gvl_mode(ctx), stmt_iterate_step, (void *)&step_ctx);
+  if (mode == GVL_RELEASE) ctx->db->metrics.gvl_releases++;
+  gvl_call(mode, stmt_iterate_step, (void *)&step_ctx);
   switch (step_ctx.rc) {
     case SQLITE_ROW:
+      ctx->db->metrics.rows++;
       return 1;
     case SQLITE_DONE:
       ctx->eof = 1;
+      CDC_FLUSH_PENDING(ctx->db);
       return 0;
     case SQLITE_BUSY:
+      ctx->db->metrics.busy_errors++;
       rb_raise(cBusyError, "Database is busy");
     case SQLITE_INTERRUPT:
       rb_raise(cInterruptError, "Query was interrupted");
@@ -363,6 +486,7 @@ inline int stmt_iterate(query_ctx *ctx) {
 
 VALUE cleanup_stmt(query_ctx *ctx) {
   if (ctx->stmt) sqlite3_finalize(ctx->stmt);
+  CDC_FLUSH_PENDING(ctx->db);
   return Qnil;
 }
 
@@ -372,12 +496,15 @@ VALUE safe_query_hash(query_ctx *ctx) {
   VALUE array = ROW_MULTI_P(ctx->row_mode) ? rb_ary_new() : Qnil;
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
-  struct column_names names = get_column_names(ctx->stmt, column_count);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  struct hash_row hash_row;
+  hash_row_setup(&hash_row, ctx->stmt, column_count);
   int row_count = 0;
   int do_transform = !NIL_P(ctx->transform_proc);
 
   while (stmt_iterate(ctx)) {
-    row = row_to_hash(ctx->stmt, column_count, &names);
+    row = row_to_hash(ctx->stmt, &hash_row, decoders);
     if (do_transform)
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
     row_count++;
@@ -395,26 +522,14 @@ VALUE safe_query_hash(query_ctx *ctx) {
       return ROW_MULTI_P(ctx->row_mode) ? array : ctx->self;
   }
 
-  RB_GC_GUARD(names.array);
+  RB_GC_GUARD(hash_row.buffer);
   RB_GC_GUARD(row);
   RB_GC_GUARD(array);
   return ROW_MULTI_P(ctx->row_mode) ? array : Qnil;
 }
 
-#define MAX_ARGV_COLUMNS 8
-#define NIL_ARGV_VALUES {Qnil, Qnil, Qnil, Qnil, Qnil, Qnil, Qnil, Qnil}
-#define ARGV_GC_GUARD(values) \
-  RB_GC_GUARD(values[0]); \
-  RB_GC_GUARD(values[1]); \
-  RB_GC_GUARD(values[2]); \
-  RB_GC_GUARD(values[3]); \
-  RB_GC_GUARD(values[4]); \
-  RB_GC_GUARD(values[5]); \
-  RB_GC_GUARD(values[6]); \
-  RB_GC_GUARD(values[7])
-
 #define ARGV_GET_ROW(ctx, column_count, argv_values, row, do_transform, return_rows) \
-  row_to_splat_values(ctx->stmt, column_count, argv_values); \
+  row_to_splat_values(ctx->stmt, column_count, argv_values, decoders); \
   if (do_transform) \
     row = rb_funcall2(ctx->transform_proc, ID_call, column_count, argv_values); \
   else if (return_rows) \
@@ -422,11 +537,13 @@ VALUE safe_query_hash(query_ctx *ctx) {
 
 VALUE safe_query_splat(query_ctx *ctx) {
   VALUE array = ROW_MULTI_P(ctx->row_mode) ? rb_ary_new() : Qnil;
-  VALUE argv_values[MAX_ARGV_COLUMNS] = NIL_ARGV_VALUES;
+  struct splat_row splat_row;
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
-  if (column_count > MAX_ARGV_COLUMNS)
-    rb_raise(cError, "Conversion is supported only up to %d columns", MAX_ARGV_COLUMNS);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  splat_row_setup(&splat_row, column_count);
+  VALUE *argv_values = splat_row.values;
 
   int do_transform = !NIL_P(ctx->transform_proc);
   int return_rows = (ctx->row_mode != ROW_YIELD);
@@ -452,7 +569,7 @@ VALUE safe_query_splat(query_ctx *ctx) {
       return ROW_MULTI_P(ctx->row_mode) ? array : ctx->self;
   }
 
-  ARGV_GC_GUARD(argv_values);
+  RB_GC_GUARD(splat_row.buffer);
   RB_GC_GUARD(row);
   RB_GC_GUARD(array);
   return ROW_MULTI_P(ctx->row_mode) ? array : Qnil;
@@ -462,11 +579,13 @@ VALUE safe_query_array(query_ctx *ctx) {
   VALUE array = ROW_MULTI_P(ctx->row_mode) ? rb_ary_new() : Qnil;
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
   int row_count = 0;
   int do_transform = !NIL_P(ctx->transform_proc);
 
   while (stmt_iterate(ctx)) {
-    row = row_to_array(ctx->stmt, column_count);
+    row = row_to_array(ctx->stmt, column_count, decoders);
     if (do_transform)
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
     row_count++;
@@ -491,46 +610,161 @@ VALUE safe_query_array(query_ctx *ctx) {
 
 VALUE safe_query_single_row_hash(query_ctx *ctx) {
   int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
   VALUE row = Qnil;
-  struct column_names names = get_column_names(ctx->stmt, column_count);
+  struct hash_row hash_row;
+  hash_row_setup(&hash_row, ctx->stmt, column_count);
 
   if (stmt_iterate(ctx)) {
-    row = row_to_hash(ctx->stmt, column_count, &names);
+    row = row_to_hash(ctx->stmt, &hash_row, decoders);
     if (!NIL_P(ctx->transform_proc))
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
   }
 
   RB_GC_GUARD(row);
-  RB_GC_GUARD(names.array);
+  RB_GC_GUARD(hash_row.buffer);
   return row;
 }
 
 VALUE safe_query_single_row_splat(query_ctx *ctx) {
-  VALUE argv_values[MAX_ARGV_COLUMNS] = NIL_ARGV_VALUES;
+  struct splat_row splat_row;
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
-  if (column_count > MAX_ARGV_COLUMNS)
-    rb_raise(cError, "Conversion is supported only up to %d columns", MAX_ARGV_COLUMNS);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  splat_row_setup(&splat_row, column_count);
+  VALUE *argv_values = splat_row.values;
   int do_transform = !NIL_P(ctx->transform_proc);
 
   if (stmt_iterate(ctx)) {
     ARGV_GET_ROW(ctx, column_count, argv_values, row, do_transform, 1);
   }
 
-  ARGV_GC_GUARD(argv_values);
+  RB_GC_GUARD(splat_row.buffer);
   RB_GC_GUARD(row);
   return row;
 }
 
 VALUE safe_query_single_row_array(query_ctx *ctx) {
   int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
   VALUE row = Qnil;
   int do_transform = !NIL_P(ctx->transform_proc);
 
   if (stmt_iterate(ctx)) {
-    row = row_to_array(ctx->stmt, column_count);
+    row = row_to_array(ctx->stmt, column_count, decoders);
+    if (do_transform)
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+  }
+
+  RB_GC_GUARD(row);
+  return row;
+}
+
+VALUE safe_query_object(query_ctx *ctx) {
+  VALUE array = ROW_MULTI_P(ctx->row_mode) ? rb_ary_new() : Qnil;
+  VALUE row = Qnil;
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  struct row_class rc;
+  row_class_setup(&rc, ctx->row_class, ctx->stmt, column_count);
+  int row_count = 0;
+  int do_transform = !NIL_P(ctx->transform_proc);
+
+  while (stmt_iterate(ctx)) {
+    row = row_to_object(ctx->stmt, column_count, &rc, decoders);
+    if (do_transform)
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+    row_count++;
+    switch (ctx->row_mode) {
+      case ROW_YIELD:
+        rb_yield(row);
+        break;
+      case ROW_MULTI:
+        rb_ary_push(array, row);
+        break;
+      case ROW_SINGLE:
+        return row;
+    }
+    if (ctx->max_rows != ALL_ROWS && row_count >= ctx->max_rows)
+      return ROW_MULTI_P(ctx->row_mode) ? array : ctx->self;
+  }
+
+  RB_GC_GUARD(rc.members);
+  RB_GC_GUARD(rc.buffer);
+  RB_GC_GUARD(row);
+  RB_GC_GUARD(array);
+  return ROW_MULTI_P(ctx->row_mode) ? array : Qnil;
+}
+
+VALUE safe_query_single_row_object(query_ctx *ctx) {
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  struct row_class rc;
+  row_class_setup(&rc, ctx->row_class, ctx->stmt, column_count);
+  VALUE row = Qnil;
+
+  if (stmt_iterate(ctx)) {
+    row = row_to_object(ctx->stmt, column_count, &rc, decoders);
+    if (!NIL_P(ctx->transform_proc))
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+  }
+
+  RB_GC_GUARD(rc.members);
+  RB_GC_GUARD(rc.buffer);
+  RB_GC_GUARD(row);
+  return row;
+}
+
+VALUE safe_query_lazy(query_ctx *ctx) {
+  VALUE array = ROW_MULTI_P(ctx->row_mode) ? rb_ary_new() : Qnil;
+  VALUE row = Qnil;
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  VALUE layout = row_layout_new(ctx->stmt, column_count, decoders);
+  int row_count = 0;
+  int do_transform = !NIL_P(ctx->transform_proc);
+
+  while (stmt_iterate(ctx)) {
+    row = row_new(layout, ctx->stmt);
     if (do_transform)
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+    row_count++;
+    switch (ctx->row_mode) {
+      case ROW_YIELD:
+        rb_yield(row);
+        break;
+      case ROW_MULTI:
+        rb_ary_push(array, row);
+        break;
+      case ROW_SINGLE:
+        return row;
+    }
+    if (ctx->max_rows != ALL_ROWS && row_count >= ctx->max_rows)
+      return ROW_MULTI_P(ctx->row_mode) ? array : ctx->self;
+  }
+
+  RB_GC_GUARD(layout);
+  RB_GC_GUARD(row);
+  RB_GC_GUARD(array);
+  return ROW_MULTI_P(ctx->row_mode) ? array : Qnil;
+}
+
+VALUE safe_query_single_row_lazy(query_ctx *ctx) {
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  VALUE row = Qnil;
+
+  if (stmt_iterate(ctx)) {
+    row = row_new(row_layout_new(ctx->stmt, column_count, decoders), ctx->stmt);
+    if (!NIL_P(ctx->transform_proc))
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
   }
 
   RB_GC_GUARD(row);
@@ -542,23 +776,28 @@ enum batch_mode {
   BATCH_QUERY_HASH,
   BATCH_QUERY_SPLAT,
   BATCH_QUERY_ARRAY,
+  BATCH_QUERY_OBJECT,
+  BATCH_QUERY_LAZY,
 };
 
 static inline VALUE batch_iterate_hash(query_ctx *ctx) {
   VALUE rows = rb_ary_new();
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
-  struct column_names names = get_column_names(ctx->stmt, column_count);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  struct hash_row hash_row;
+  hash_row_setup(&hash_row, ctx->stmt, column_count);
   const int do_transform = !NIL_P(ctx->transform_proc);
 
   while (stmt_iterate(ctx)) {
-    row = row_to_hash(ctx->stmt, column_count, &names);
+    row = row_to_hash(ctx->stmt, &hash_row, decoders);
     if (do_transform)
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
     rb_ary_push(rows, row);
   }
 
-  RB_GC_GUARD(names.array);
+  RB_GC_GUARD(hash_row.buffer);
   RB_GC_GUARD(row);
   RB_GC_GUARD(rows);
   return rows;
@@ -568,10 +807,12 @@ static inline VALUE batch_iterate_array(query_ctx *ctx) {
   VALUE rows = rb_ary_new();
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
   int do_transform = !NIL_P(ctx->transform_proc);
 
   while (stmt_iterate(ctx)) {
-    row = row_to_array(ctx->stmt, column_count);
+    row = row_to_array(ctx->stmt, column_count, decoders);
     if (do_transform)
       row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
     rb_ary_push(rows, row);
@@ -584,11 +825,13 @@ static inline VALUE batch_iterate_array(query_ctx *ctx) {
 
 static inline VALUE batch_iterate_splat(query_ctx *ctx) {
   VALUE rows = rb_ary_new();
-  VALUE argv_values[MAX_ARGV_COLUMNS] = NIL_ARGV_VALUES;
+  struct splat_row splat_row;
   VALUE row = Qnil;
   int column_count = sqlite3_column_count(ctx->stmt);
-  if (column_count > MAX_ARGV_COLUMNS)
-    rb_raise(cError, "Conversion is supported only up to %d columns", MAX_ARGV_COLUMNS);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  splat_row_setup(&splat_row, column_count);
+  VALUE *argv_values = splat_row.values;
   int do_transform = !NIL_P(ctx->transform_proc);
 
   while (stmt_iterate(ctx)) {
@@ -596,12 +839,61 @@ static inline VALUE batch_iterate_splat(query_ctx *ctx) {
     rb_ary_push(rows, row);
   }
 
-  ARGV_GC_GUARD(argv_values);
+  RB_GC_GUARD(splat_row.buffer);
   RB_GC_GUARD(row);
   RB_GC_GUARD(rows);
   return rows;
 }
 
+static inline VALUE batch_iterate_object(query_ctx *ctx) {
+  VALUE rows = rb_ary_new();
+  VALUE row = Qnil;
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  struct row_class rc;
+  row_class_setup(&rc, ctx->row_class, ctx->stmt, column_count);
+  int do_transform = !NIL_P(ctx->transform_proc);
+
+  while (stmt_iterate(ctx)) {
+    row = row_to_object(ctx->stmt, column_count, &rc, decoders);
+    if (do_transform)
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+    rb_ary_push(rows, row);
+  }
+
+  RB_GC_GUARD(rc.members);
+  RB_GC_GUARD(rc.buffer);
+  RB_GC_GUARD(row);
+  RB_GC_GUARD(rows);
+  return rows;
+}
+
+static inline VALUE batch_iterate_lazy(query_ctx *ctx) {
+  VALUE rows = rb_ary_new();
+  VALUE row = Qnil;
+  int column_count = sqlite3_column_count(ctx->stmt);
+  struct column_decoders decoder_table;
+  struct column_decoders *decoders = column_decoders_setup(&decoder_table, ctx, column_count);
+  VALUE layout = row_layout_new(ctx->stmt, column_count, decoders);
+  int do_transform = !NIL_P(ctx->transform_proc);
+
+  while (stmt_iterate(ctx)) {
+    row = row_new(layout, ctx->stmt);
+    if (do_transform)
+      row = rb_funcall(ctx->transform_proc, ID_call, 1, row);
+    rb_ary_push(rows, row);
+  }
+
+  RB_GC_GUARD(layout);
+  RB_GC_GUARD(row);
+  RB_GC_GUARD(rows);
+  return rows;
+}
+
+#define BATCH_QUERY_KIND(ctx, batch_mode) \
+  ((batch_mode) == BATCH_EXECUTE ? METRICS_QUERY_EXECUTE : (int)(ctx)->query_mode)
+
 static inline void batch_iterate(query_ctx *ctx, enum batch_mode mode, VALUE *rows) {
   switch (mode) {
     case BATCH_EXECUTE:
@@ -616,6 +908,12 @@ static inline void batch_iterate(query_ctx *ctx, enum batch_mode mode, VALUE *ro
     case BATCH_QUERY_ARRAY:
       *rows = batch_iterate_array(ctx);
       break;
+    case BATCH_QUERY_OBJECT:
+      *rows = batch_iterate_object(ctx);
+      break;
+    case BATCH_QUERY_LAZY:
+      *rows = batch_iterate_lazy(ctx);
+      break;
   }
 }
 
@@ -628,9 +926,9 @@ static inline VALUE batch_run_array(query_ctx *ctx, enum batch_mode batch_mode)
 
   for (int i = 0; i < count; i++) {
     sqlite3_reset(ctx->stmt);
-    sqlite3_clear_bindings(ctx->stmt);
-    Database_issue_query(ctx->db, ctx->sql);
-    bind_all_parameters_from_object(ctx->stmt, RARRAY_AREF(ctx->params, i));
+    clear_bindings(ctx->stmt, ctx->pins);
+    Database_issue_query(ctx->db, ctx->sql, BATCH_QUERY_KIND(ctx, batch_mode));
+    bind_all_parameters_from_object(ctx->stmt, RARRAY_AREF(ctx->params, i), &ctx->pins);
 
     batch_iterate(ctx, batch_mode, &rows);
     changes += sqlite3_changes(ctx->sqlite3_db);
@@ -665,9 +963,9 @@ static VALUE batch_run_each_iter(RB_BLOCK_CALL_FUNC_ARGLIST(yield_value, vctx))
   VALUE rows = Qnil;
 
   sqlite3_reset(each_ctx->ctx->stmt);
-  sqlite3_clear_bindings(each_ctx->ctx->stmt);
-  Database_issue_query(each_ctx->ctx->db, each_ctx->ctx->sql);
-  bind_all_parameters_from_object(each_ctx->ctx->stmt, yield_value);
+  clear_bindings(each_ctx->ctx->stmt, each_ctx->ctx->pins);
+  Database_issue_query(each_ctx->ctx->db, each_ctx->ctx->sql, BATCH_QUERY_KIND(each_ctx->ctx, each_ctx->batch_mode));
+  bind_all_parameters_from_object(each_ctx->ctx->stmt, yield_value, &each_ctx->ctx->pins);
 
   batch_iterate(each_ctx->ctx, each_ctx->batch_mode, &rows);
   each_ctx->changes += sqlite3_changes(each_ctx->ctx->sqlite3_db);
@@ -711,9 +1009,9 @@ static inline VALUE batch_run_proc(query_ctx *ctx, enum batch_mode batch_mode) {
     if (NIL_P(params)) break;
 
     sqlite3_reset(ctx->stmt);
-    sqlite3_clear_bindings(ctx->stmt);
-    Database_issue_query(ctx->db, ctx->sql);
-    bind_all_parameters_from_object(ctx->stmt, params);
+    clear_bindings(ctx->stmt, ctx->pins);
+    Database_issue_query(ctx->db, ctx->sql, BATCH_QUERY_KIND(ctx, batch_mode));
+    bind_all_parameters_from_object(ctx->stmt, params, &ctx->pins);
 
     batch_iterate(ctx, batch_mode, &rows);
     changes += sqlite3_changes(ctx->sqlite3_db);
@@ -761,6 +1059,10 @@ VALUE safe_batch_query(query_ctx *ctx) {
       return batch_run(ctx, BATCH_QUERY_SPLAT);
     case QUERY_ARRAY:
       return batch_run(ctx, BATCH_QUERY_ARRAY);
+    case QUERY_OBJECT:
+      return batch_run(ctx, BATCH_QUERY_OBJECT);
+    case QUERY_LAZY:
+      return batch_run(ctx, BATCH_QUERY_LAZY);
     default:
       rb_raise(cError, "Invalid query mode (safe_batch_query)");
   }  
@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include "extralite.h"
+#include "ruby/debug.h"
 
 VALUE cDatabase;
 VALUE cBlob;
@@ -13,24 +16,41 @@ VALUE eArgumentError;
 
 ID ID_bind;
 ID ID_call;
+ID ID_decode_json;
 ID ID_each;
+ID ID_intern_set;
+ID ID_join;
 ID ID_keys;
 ID ID_new;
 ID ID_pragma;
 ID ID_strip;
 ID ID_to_s;
 ID ID_track;
+ID ID_track_patchset;
 
 VALUE SYM_at_least_once;
+VALUE SYM_bytes_copied;
+VALUE SYM_bytes_per_sec;
+VALUE SYM_bytes_total;
+VALUE SYM_eta;
 VALUE SYM_full;
+VALUE SYM_decode_json;
+VALUE SYM_decode_types;
 VALUE SYM_gvl_release_threshold;
+VALUE SYM_hard_heap_limit;
+VALUE SYM_intern;
+VALUE SYM_lookaside;
+VALUE SYM_major_gc_count;
 VALUE SYM_once;
+VALUE SYM_pages_per_step;
 VALUE SYM_none;
 VALUE SYM_normal;
 VALUE SYM_passive;
 VALUE SYM_pragma;
 VALUE SYM_read_only;
+VALUE SYM_release_on_gc;
 VALUE SYM_restart;
+VALUE SYM_soft_heap_limit;
 VALUE SYM_truncate;
 VALUE SYM_wal;
 
@@ -43,8 +63,87 @@ struct progress_handler global_progress_handler = {
   .call_count = 0
 };
 
+Database_t *open_databases = NULL;
+// sequence number of the last opened database
+static unsigned long long last_database_id = 0;
+VALUE gc_tracepoint = Qnil;
+size_t last_major_gc_count = 0;
+
 #define DB_GVL_MODE(db) Database_prepare_gvl_mode(db)
 
+static inline void open_databases_add(Database_t *db) {
+  db->prev_open = NULL;
+  db->next_open = open_databases;
+  if (open_databases) open_databases->prev_open = db;
+  open_databases = db;
+}
+
+// Number of SQLite connections opened by Extralite that are still alive,
+// including background connections used for snapshots and checkpoints. A
+// connection closed while statements or blob handles are still open is kept
+// alive by SQLite as a "zombie" until the last handle is finalized, so such
+// connections are tracked separately until then.
+static int live_connections = 0;
+
+struct zombie_connection {
+  sqlite3                   *db;
+  struct zombie_connection  *next;
+};
+
+static struct zombie_connection *zombie_connections = NULL;
+
+int connection_open(const char *filename, sqlite3 **db, int flags) {
+  int rc = sqlite3_open_v2(filename, db, flags, NULL);
+  if (*db) live_connections++;
+  return rc;
+}
+
+int connection_close(sqlite3 *db) {
+  if (!db) return SQLITE_OK;
+
+  int zombie = sqlite3_next_stmt(db, NULL) != NULL;
+  int rc = sqlite3_close_v2(db);
+  if (rc != SQLITE_OK) return rc;
+
+  if (zombie) {
+    struct zombie_connection *entry = malloc(sizeof(struct zombie_connection));
+    entry->db = db;
+    entry->next = zombie_connections;
+    zombie_connections = entry;
+  }
+  else
+    live_connections--;
+  return rc;
+}
+
+void connection_release_handle(sqlite3 *db) {
+  struct zombie_connection **ptr = &zombie_connections;
+  while (*ptr && (*ptr)->db != db) ptr = &(*ptr)->next;
+  if (!*ptr) return;
+
+  // the connection is freed once its last handle is finalized
+  sqlite3_stmt *stmt = sqlite3_next_stmt(db, NULL);
+  if (stmt && sqlite3_next_stmt(db, stmt)) return;
+
+  struct zombie_connection *entry = *ptr;
+  *ptr = entry->next;
+  free(entry);
+  live_connections--;
+}
+
+static inline void open_databases_remove(Database_t *db) {
+  if (db->prev_open)
+    db->prev_open->next_open = db->next_open;
+  else if (open_databases == db)
+    open_databases = db->next_open;
+  else
+    return;
+
+  if (db->next_open) db->next_open->prev_open = db->prev_open;
+  db->prev_open = NULL;
+  db->next_open = NULL;
+}
+
 static size_t Database_size(const void *ptr) {
   return sizeof(Database_t);
 }
@@ -53,17 +152,42 @@ static void Database_mark(void *ptr) {
   Database_t *db = ptr;
   rb_gc_mark_movable(db->trace_proc);
   rb_gc_mark_movable(db->progress_handler.proc);
+  rb_gc_mark_movable(db->json_columns);
+  rb_gc_mark_movable(db->intern_columns);
+  // the image is used in place by SQLite and must not be moved
+  rb_gc_mark(db->image);
+  checkpoint_mark(db);
+#ifdef EXTRALITE_ENABLE_CHANGESET
+  if (db->cdc) {
+    rb_gc_mark_movable(db->cdc->target);
+    rb_gc_mark_movable(db->cdc->tables);
+  }
+#endif
 }
 
 static void Database_compact(void *ptr) {
   Database_t *db = ptr;
   db->trace_proc            = rb_gc_location(db->trace_proc);
   db->progress_handler.proc = rb_gc_location(db->progress_handler.proc);
+  db->json_columns          = rb_gc_location(db->json_columns);
+  db->intern_columns        = rb_gc_location(db->intern_columns);
+#ifdef EXTRALITE_ENABLE_CHANGESET
+  if (db->cdc) {
+    db->cdc->target = rb_gc_location(db->cdc->target);
+    db->cdc->tables = rb_gc_location(db->cdc->tables);
+  }
+#endif
 }
 
 static void Database_free(void *ptr) {
   Database_t *db = ptr;
-  if (db->sqlite3_db) sqlite3_close_v2(db->sqlite3_db);
+  open_databases_remove(db);
+  checkpoint_stop(db, 0);
+#ifdef EXTRALITE_ENABLE_CHANGESET
+  cdc_free(db);
+#endif
+  if (db->sqlite3_db) connection_close(db->sqlite3_db);
+  profiler_db_free(db);
   free(ptr);
 }
 
@@ -76,9 +200,23 @@ static const rb_data_type_t Database_type = {
 static VALUE Database_allocate(VALUE klass) {
   Database_t *db = ALLOC(Database_t);
   db->sqlite3_db = NULL;
+  db->id = 0;
   db->trace_proc = Qnil;
   db->progress_handler.proc = Qnil;
   db->progress_handler.mode = PROGRESS_NONE;
+  db->prev_open = NULL;
+  db->next_open = NULL;
+  db->profiler = NULL;
+  db->cdc = NULL;
+  db->image = Qnil;
+  db->checkpoint = NULL;
+  db->decode_types = 0;
+  db->decode_json = 0;
+  db->json_flags = 0;
+  db->json_columns = Qnil;
+  db->intern = INTERN_NONE;
+  db->intern_columns = Qnil;
+  memset(&db->metrics, 0, sizeof(struct database_metrics));
   return TypedData_Wrap_Struct(klass, &Database_type, db);
 }
 
@@ -119,9 +257,39 @@ default_flags:
   return SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
 }
 
+static inline void lookaside_opts(VALUE value, int *slot_size, int *slot_count) {
+  if (TYPE(value) != T_ARRAY || RARRAY_LEN(value) != 2)
+    rb_raise(eArgumentError, "Expected lookaside setting as [slot_size, slot_count]");
+
+  *slot_size = NUM2INT(RARRAY_AREF(value, 0));
+  *slot_count = NUM2INT(RARRAY_AREF(value, 1));
+}
+
 void Database_apply_opts(VALUE self, Database_t *db, VALUE opts) {
   VALUE value = Qnil;
 
+  // :lookaside
+  value = rb_hash_aref(opts, SYM_lookaside);
+  if (!NIL_P(value)) {
+    int slot_size, slot_count;
+    lookaside_opts(value, &slot_size, &slot_count);
+    int rc = sqlite3_db_config(db->sqlite3_db, SQLITE_DBCONFIG_LOOKASIDE, NULL, slot_size, slot_count);
+    if (rc != SQLITE_OK)
+      rb_raise(cError, "Failed to set lookaside memory: %s", sqlite3_errstr(rc));
+  }
+
+  // :decode_types
+  value = rb_hash_aref(opts, SYM_decode_types);
+  if (!NIL_P(value)) db->decode_types = RTEST(value);
+
+  // :decode_json
+  value = rb_hash_aref(opts, SYM_decode_json);
+  if (!NIL_P(value)) rb_funcall(self, ID_decode_json, 1, value);
+
+  // :intern
+  value = rb_hash_aref(opts, SYM_intern);
+  if (!NIL_P(value)) rb_funcall(self, ID_intern_set, 1, value);
+
   // :gvl_release_threshold
   value = rb_hash_aref(opts, SYM_gvl_release_threshold);
   if (!NIL_P(value)) db->gvl_release_threshold = NUM2INT(value);
@@ -152,19 +320,56 @@ int Database_progress_handler(void *ptr) {
   db->progress_handler.call_count += 1;
   rb_funcall(db->progress_handler.proc, ID_call, 0);
 done:
+  if (profiler_active) profiler_sample(db);
   return 0;
 }
 
+// Installs the SQLite progress handler according to the database progress
+// handler mode. When the profiler is running, the profiler progress handler
+// is installed if the database has no progress handler of its own.
+void Database_install_progress_handler(Database_t *db) {
+  if (!db->sqlite3_db) return;
+
+  switch (db->progress_handler.mode) {
+    case PROGRESS_NORMAL:
+    case PROGRESS_AT_LEAST_ONCE:
+      sqlite3_progress_handler(db->sqlite3_db, db->progress_handler.tick, &Database_progress_handler, db);
+      return;
+    default:
+      if (profiler_active)
+        sqlite3_progress_handler(db->sqlite3_db, PROFILER_TICK, &profiler_progress_handler, db);
+      else
+        sqlite3_progress_handler(db->sqlite3_db, 0, NULL, NULL);
+  }
+}
+
 int Database_busy_handler(void *ptr, int v) {
   Database_t *db = (Database_t *)ptr;
   rb_funcall(db->progress_handler.proc, ID_call, 1, Qtrue);
   return 1;
 }
 
+static void Database_initialize_failed(Database_t *db) {
+  VALUE msg = rb_str_new_cstr(sqlite3_errmsg(db->sqlite3_db));
+  open_databases_remove(db);
+  connection_close(db->sqlite3_db);
+  db->sqlite3_db = NULL;
+  rb_raise(cError, "%"PRIsVALUE, msg);
+}
+
 /* Initializes a new SQLite database with the given path and options:
  *
+ * - `:decode_json` (`true`/`false`/`Array`): decodes JSON column values (see
+ *   `#decode_json`).
+ * - `:decode_types` (`true`/`false`): converts values according to the
+ *   declared column types (see `#decode_types=`).
  * - `:gvl_release_threshold` (`Integer`): sets the GVL release threshold (see
  *   `#gvl_release_threshold=`).
+ * - `:intern` (`:auto`/`Array`): returns text values as deduplicated frozen
+ *   strings (see `#intern=`).
+ * - `:lookaside` (`Array`): sets the [lookaside memory
+ *   allocator](https://sqlite.org/malloc.html#lookaside) slot size and slot
+ *   count for the database, e.g. `[1200, 100]`.
  * - `:pragma` (`Hash`): one or more pragmas to set upon opening the database.
  * - `:read_only` (`true`/`false`): opens the database in read-only mode if true.
  * - `:wal` (`true`/`false`): sets up the database for [WAL journaling
@@ -174,7 +379,7 @@ int Database_busy_handler(void *ptr, int v) {
  * @overload initialize(path)
  *   @param path [String] file path (or ':memory:' for memory database)
  *   @return [void]
- * @overload initialize(path, gvl_release_threshold: , on_progress: , read_only: , wal: )
+ * @overload initialize(path, decode_json: , decode_types: , gvl_release_threshold: , intern: , on_progress: , read_only: , wal: )
  *   @param path [String] file path (or ':memory:' for memory database)
  *   @param options [Hash] options for opening the database
  *   @return [void]
@@ -187,26 +392,22 @@ VALUE Database_initialize(int argc, VALUE *argv, VALUE self) {
   rb_scan_args(argc, argv, "11", &path, &opts);
   int flags = db_open_flags_from_opts(opts);
 
-  int rc = sqlite3_open_v2(StringValueCStr(path), &db->sqlite3_db, flags, NULL);
+  int rc = connection_open(StringValueCStr(path), &db->sqlite3_db, flags);
   if (rc) {
-    sqlite3_close_v2(db->sqlite3_db);
+    connection_close(db->sqlite3_db);
     db->sqlite3_db = NULL;
     rb_raise(cError, "%s", sqlite3_errstr(rc));
   }
+  open_databases_add(db);
+  db->id = ++last_database_id;
 
   // Enable extended result codes
   rc = sqlite3_extended_result_codes(db->sqlite3_db, 1);
-  if (rc) {
-    sqlite3_close_v2(db->sqlite3_db);
-    rb_raise(cError, "%s", sqlite3_errmsg(db->sqlite3_db));
-  }
+  if (rc) Database_initialize_failed(db);
 
 #ifdef HAVE_SQLITE3_ENABLE_LOAD_EXTENSION
   rc = sqlite3_enable_load_extension(db->sqlite3_db, 1);
-  if (rc) {
-    sqlite3_close_v2(db->sqlite3_db);
-    rb_raise(cError, "%s", sqlite3_errmsg(db->sqlite3_db));
-  }
+  if (rc) Database_initialize_failed(db);
 #endif
 
   db->trace_proc = Qnil;
@@ -216,11 +417,10 @@ VALUE Database_initialize(int argc, VALUE *argv, VALUE self) {
   db->progress_handler.tick_count = 0;
   db->progress_handler.call_count = 0;
   if (db->progress_handler.mode != PROGRESS_NONE) {
-      db->gvl_release_threshold = -1;
-    if (db->progress_handler.mode != PROGRESS_ONCE)
-      sqlite3_progress_handler(db->sqlite3_db, db->progress_handler.tick, &Database_progress_handler, db);
+    db->gvl_release_threshold = -1;
     sqlite3_busy_handler(db->sqlite3_db, &Database_busy_handler, db);
   }
+  Database_install_progress_handler(db);
 
   if (!NIL_P(opts)) Database_apply_opts(self, db, opts);
   return Qnil;
@@ -244,11 +444,21 @@ VALUE Database_close(VALUE self) {
   int rc;
   Database_t *db = self_to_database(self);
 
-  rc = sqlite3_close_v2(db->sqlite3_db);
+  checkpoint_stop(db, 1);
+#ifdef EXTRALITE_ENABLE_CHANGESET
+  // deliver any changes captured since the last flush before closing
+  if (db->cdc) {
+    if (db->cdc->pending_commits) cdc_flush(db);
+    cdc_free(db);
+  }
+#endif
+
+  rc = connection_close(db->sqlite3_db);
   if (rc) {
     rb_raise(cError, "%s", sqlite3_errmsg(db->sqlite3_db));
   }
 
+  open_databases_remove(db);
   db->sqlite3_db = NULL;
   return self;
 }
@@ -274,6 +484,16 @@ static inline VALUE Database_perform_query(int argc, VALUE *argv, VALUE self, VA
   sqlite3_stmt *stmt;
   VALUE sql = Qnil;
   VALUE transform = Qnil;
+  VALUE row_class = Qnil;
+
+  // in object mode the first parameter is the row class
+  if (query_mode == QUERY_OBJECT) {
+    rb_check_arity(argc, 2, UNLIMITED_ARGUMENTS);
+    row_class = row_class_check(argv[0]);
+    argc--;
+    argv++;
+  }
+
   // transform mode is set and the first parameter is not a string, so we expect
   // a transform.
   int got_transform = (TYPE(argv[0]) != T_STRING);
@@ -290,19 +510,21 @@ static inline VALUE Database_perform_query(int argc, VALUE *argv, VALUE self, VA
   sql = rb_funcall(argv[0], ID_strip, 0);
   if (RSTRING_LEN(sql) == 0) return Qnil;
 
-  Database_issue_query(db, sql);
+  Database_issue_query(db, sql, (call == safe_query_changes) ? METRICS_QUERY_EXECUTE : (int)query_mode);
   prepare_multi_stmt(DB_GVL_MODE(db), db->sqlite3_db, &stmt, sql);
   RB_GC_GUARD(sql);
 
   if (stmt == NULL) return Qnil;
 
-  bind_all_parameters(stmt, argc - 1, argv + 1);
   query_ctx ctx = QUERY_CTX(
     self, sql, db, stmt, Qnil, transform,
     query_mode, ROW_YIELD_OR_MODE(ROW_MULTI), ALL_ROWS
   );
+  ctx.row_class = row_class;
+  bind_all_parameters(stmt, argc - 1, argv + 1, &ctx.pins);
 
   VALUE result = rb_ensure(SAFE(call), (VALUE)&ctx, SAFE(cleanup_stmt), (VALUE)&ctx);
+  RB_GC_GUARD(ctx.pins);
   RB_GC_GUARD(result);
   return result;
 }
@@ -392,6 +614,54 @@ VALUE Database_query_array(int argc, VALUE *argv, VALUE self) {
   return Database_perform_query(argc, argv, self, safe_query_array, QUERY_ARRAY);
 }
 
+/* Runs a query returning rows as `Extralite::Row` instances. A row holds a
+ * compact copy of the raw column values, and creates Ruby objects for column
+ * values only when they are accessed. This is useful when selecting many
+ * columns, of which only a few are actually used. If a block is given, it will
+ * be called for each row. Otherwise, an array containing all rows is returned.
+ *
+ *     rows = db.query_lazy('select * from orders where customer_id = ?', 42)
+ *     rows.sum { |r| r[:total] }
+ *
+ * @overload query_lazy(sql, ...)
+ *   @param sql [String] SQL statement
+ *   @return [Array<Extralite::Row>, Integer] rows or total changes
+ * @overload query_lazy(transform, sql, ...)
+ *   @param transform [Proc] transform proc
+ *   @param sql [String] SQL statement
+ *   @return [Array<Extralite::Row>, Integer] rows or total changes
+ */
+VALUE Database_query_lazy(int argc, VALUE *argv, VALUE self) {
+  return Database_perform_query(argc, argv, self, safe_query_lazy, QUERY_LAZY);
+}
+
+/* Runs a query returning rows as instances of the given Struct or Data class.
+ * Columns are mapped to members by name once per query, and each row is
+ * created directly from the column values, without an intermediate hash. If a
+ * block is given, it will be called for each row. Otherwise, an array
+ * containing all rows is returned.
+ *
+ *     Point = Data.define(:x, :y)
+ *     db.query_as(Point, 'select x, y from points where x > ?', 10)
+ *     #=> [#<data Point x=11, y=2>, ...]
+ *
+ * Each column must match a member of the row class. Struct members without a
+ * matching column are set to nil.
+ *
+ * @overload query_as(row_class, sql, ...)
+ *   @param row_class [Class] Struct or Data class
+ *   @param sql [String] SQL statement
+ *   @return [Array<Struct, Data>, Integer] rows or total changes
+ * @overload query_as(row_class, transform, sql, ...)
+ *   @param row_class [Class] Struct or Data class
+ *   @param transform [Proc] transform proc
+ *   @param sql [String] SQL statement
+ *   @return [Array<Struct, Data>, Integer] rows or total changes
+ */
+VALUE Database_query_as(int argc, VALUE *argv, VALUE self) {
+  return Database_perform_query(argc, argv, self, safe_query_object, QUERY_OBJECT);
+}
+
 /* Runs a query returning a single row as a hash.
  *
  * Query parameters to be bound to placeholders in the query can be specified as
@@ -470,6 +740,43 @@ VALUE Database_query_single_array(int argc, VALUE *argv, VALUE self) {
   return Database_perform_query(argc, argv, self, safe_query_single_row_array, QUERY_ARRAY);
 }
 
+/* Runs a query returning a single row as an `Extralite::Row`, whose column
+ * values are converted to Ruby objects only when accessed.
+ *
+ *     row = db.query_single_lazy('select * from orders where id = ?', 42)
+ *     row[:total]
+ *
+ * @overload query_single_lazy(sql, ...) -> row
+ *   @param sql [String] SQL statement
+ *   @return [Extralite::Row, nil] row
+ * @overload query_single_lazy(transform, sql, ...) -> row
+ *   @param transform [Proc] transform proc
+ *   @param sql [String] SQL statement
+ *   @return [any] row
+ */
+VALUE Database_query_single_lazy(int argc, VALUE *argv, VALUE self) {
+  return Database_perform_query(argc, argv, self, safe_query_single_row_lazy, QUERY_LAZY);
+}
+
+/* Runs a query returning a single row as an instance of the given Struct or
+ * Data class.
+ *
+ *     db.query_single_as(Point, 'select x, y from points where id = ?', 42)
+ *
+ * @overload query_single_as(row_class, sql, ...) -> row
+ *   @param row_class [Class] Struct or Data class
+ *   @param sql [String] SQL statement
+ *   @return [Struct, Data, nil] row
+ * @overload query_single_as(row_class, transform, sql, ...) -> row
+ *   @param row_class [Class] Struct or Data class
+ *   @param transform [Proc] transform proc
+ *   @param sql [String] SQL statement
+ *   @return [any] row
+ */
+VALUE Database_query_single_as(int argc, VALUE *argv, VALUE self) {
+  return Database_perform_query(argc, argv, self, safe_query_single_row_object, QUERY_OBJECT);
+}
+
 /* call-seq:
  *   db.execute(sql, *parameters) -> changes
  *
@@ -783,6 +1090,52 @@ VALUE Database_prepare_array(int argc, VALUE *argv, VALUE self) {
   return Database_prepare(argc, argv, self, SYM_array);
 }
 
+/* call-seq:
+ *   db.prepare_lazy(sql) -> Extralite::Query
+ *   db.prepare_lazy(sql, *params) -> Extralite::Query
+ *   db.prepare_lazy(sql, *params) { ... } -> Extralite::Query
+ *
+ * Creates a prepared query with the given SQL query in lazy mode, returning
+ * rows as `Extralite::Row` instances. If query parameters are given, they are
+ * bound to the query. If a block is given, it is used as a transform proc.
+ *
+ * @param sql [String] SQL statement
+ * @param *params [Array<any>] parameters to bind
+ * @return [Extralite::Query] prepared query
+ */
+VALUE Database_prepare_lazy(int argc, VALUE *argv, VALUE self) {
+  return Database_prepare(argc, argv, self, SYM_lazy);
+}
+
+/* call-seq:
+ *   db.prepare_as(row_class, sql) -> Extralite::Query
+ *   db.prepare_as(row_class, sql, *params) -> Extralite::Query
+ *   db.prepare_as(row_class, sql, *params) { ... } -> Extralite::Query
+ *
+ * Creates a prepared query with the given SQL query in object mode, returning
+ * rows as instances of the given Struct or Data class. If query parameters are
+ * given, they are bound to the query. If a block is given, it is used as a
+ * transform proc.
+ *
+ *     Point = Struct.new(:x, :y)
+ *     db.prepare_as(Point, 'select x, y from points').to_a
+ *     #=> [#<struct Point x=1, y=2>, ...]
+ *
+ * @param row_class [Class] Struct or Data class
+ * @param sql [String] SQL statement
+ * @param *params [Array<any>] parameters to bind
+ * @return [Extralite::Query] prepared query
+ */
+VALUE Database_prepare_as(int argc, VALUE *argv, VALUE self) {
+  rb_check_arity(argc, 2, UNLIMITED_ARGUMENTS);
+
+  VALUE args[] = { self, argv[1], SYM_object, argv[0] };
+  VALUE query = rb_funcall_passing_block(cQuery, ID_new, 4, args);
+  if (argc > 2) rb_funcallv(query, ID_bind, argc - 2, argv + 2);
+  RB_GC_GUARD(query);
+  return query;
+}
+
 /* Interrupts a long running query. This method is to be called from a different
  * thread than the one running the query. Upon calling `#interrupt` the running
  * query will stop and raise an `Extralite::InterruptError` exception.
@@ -805,47 +1158,128 @@ typedef struct {
   int close_dst_on_cleanup;
   sqlite3_backup *backup;
   int block_given;
+  int yield_info;
   int rc;
+  int pages_per_step;
+  int max_pages_per_step;
+  int page_size;
+  double target_bytes_per_sec;
+  unsigned long long max_lock_ns;
+  unsigned long long start_ns;
+  unsigned long long step_ns;
+  int sleep_ms;
 } backup_ctx;
 
-#define BACKUP_STEP_MAX_PAGES 16
-#define BACKUP_SLEEP_MS       100
+#define BACKUP_STEP_MAX_PAGES   16
+#define BACKUP_SLEEP_MS         100
+#define BACKUP_PACING_MS        100
+#define BACKUP_MAX_STEP_PAGES   (1 << 20)
 
 void *backup_step_impl(void *ptr) {
   backup_ctx *ctx = (backup_ctx *)ptr;
-  ctx->rc = sqlite3_backup_step(ctx->backup, BACKUP_STEP_MAX_PAGES);
+  unsigned long long t0 = monotonic_ns();
+  ctx->rc = sqlite3_backup_step(ctx->backup, ctx->pages_per_step);
+  ctx->step_ns = monotonic_ns() - t0;
   return NULL;
 }
 
-void *backup_sleep_impl(void *unused) {
-  sqlite3_sleep(BACKUP_SLEEP_MS);
+void *backup_sleep_impl(void *ptr) {
+  backup_ctx *ctx = (backup_ctx *)ptr;
+  sqlite3_sleep(ctx->sleep_ms);
   return NULL;
 }
 
+static inline void backup_sleep(backup_ctx *ctx, unsigned long long ns) {
+  // shorter sleeps are made up for in subsequent steps
+  ctx->sleep_ms = (int)(ns / 1000000);
+  if (ctx->sleep_ms > 0) gvl_call(GVL_RELEASE, backup_sleep_impl, (void *)ctx);
+}
+
+static inline long long backup_bytes_copied(backup_ctx *ctx) {
+  int total = sqlite3_backup_pagecount(ctx->backup);
+  int remaining = sqlite3_backup_remaining(ctx->backup);
+  return (long long)(total - remaining) * ctx->page_size;
+}
+
+// Adjusts the number of pages copied in each step, so as to keep the time
+// spent holding the source database lock under max_lock_ns.
+static inline void backup_adjust_step(backup_ctx *ctx) {
+  if (!ctx->max_lock_ns || !ctx->step_ns || ctx->pages_per_step < 1) return;
+
+  if (ctx->step_ns > ctx->max_lock_ns) {
+    int pages = (int)((double)ctx->pages_per_step * ctx->max_lock_ns / ctx->step_ns);
+    ctx->pages_per_step = pages < 1 ? 1 : pages;
+  }
+  else if (ctx->step_ns < ctx->max_lock_ns / 2) {
+    int pages = ctx->pages_per_step * 2;
+    ctx->pages_per_step = pages > ctx->max_pages_per_step ? ctx->max_pages_per_step : pages;
+  }
+}
+
+// Sleeps for as long as needed to keep the backup throughput at or under the
+// target bandwidth.
+static inline void backup_throttle(backup_ctx *ctx) {
+  if (ctx->target_bytes_per_sec <= 0) return;
+
+  double expected_ns = backup_bytes_copied(ctx) / ctx->target_bytes_per_sec * 1e9;
+  unsigned long long elapsed_ns = monotonic_ns() - ctx->start_ns;
+  if (expected_ns > elapsed_ns)
+    backup_sleep(ctx, (unsigned long long)expected_ns - elapsed_ns);
+}
+
+static inline VALUE backup_progress_info(backup_ctx *ctx, int done) {
+  long long copied = backup_bytes_copied(ctx);
+  long long total = (long long)sqlite3_backup_pagecount(ctx->backup) * ctx->page_size;
+  double elapsed = (monotonic_ns() - ctx->start_ns) / 1e9;
+  double rate = elapsed > 0 ? copied / elapsed : 0;
+
+  VALUE info = rb_hash_new();
+  rb_hash_aset(info, SYM_bytes_copied, LL2NUM(copied));
+  rb_hash_aset(info, SYM_bytes_total, LL2NUM(total));
+  rb_hash_aset(info, SYM_bytes_per_sec, DBL2NUM(rate));
+  rb_hash_aset(info, SYM_eta, done ? DBL2NUM(0.0) : (rate > 0 ? DBL2NUM((total - copied) / rate) : Qnil));
+  rb_hash_aset(info, SYM_pages_per_step, INT2FIX(ctx->pages_per_step));
+  return info;
+}
+
+static inline void backup_yield(backup_ctx *ctx, VALUE remaining, VALUE total, int done) {
+  if (ctx->yield_info)
+    rb_yield_values(3, remaining, total, backup_progress_info(ctx, done));
+  else
+    rb_yield_values(2, remaining, total);
+}
+
 VALUE backup_safe_iterate(VALUE ptr) {
   backup_ctx *ctx = (backup_ctx *)ptr;
+  int busy_sleep_ms = 1;
   int done = 0;
 
+  ctx->start_ns = monotonic_ns();
   while (!done) {
     gvl_call(GVL_RELEASE, backup_step_impl, (void *)ctx);
     switch(ctx->rc) {
       case SQLITE_DONE:
         if (ctx->block_given) {
           VALUE total     = INT2FIX(sqlite3_backup_pagecount(ctx->backup));
-          rb_yield_values(2, total, total);
+          backup_yield(ctx, total, total, 1);
         }
         done = 1;
         continue;
       case SQLITE_OK:
+        busy_sleep_ms = 1;
+        backup_adjust_step(ctx);
         if (ctx->block_given) {
           VALUE remaining = INT2FIX(sqlite3_backup_remaining(ctx->backup));
           VALUE total     = INT2FIX(sqlite3_backup_pagecount(ctx->backup));
-          rb_yield_values(2, remaining, total);
+          backup_yield(ctx, remaining, total, 0);
         }
+        backup_throttle(ctx);
         continue;
       case SQLITE_BUSY:
       case SQLITE_LOCKED:
-        gvl_call(GVL_RELEASE, backup_sleep_impl, NULL);
+        // back off exponentially while the source or destination are locked
+        backup_sleep(ctx, busy_sleep_ms * 1000000ULL);
+        if (busy_sleep_ms < BACKUP_SLEEP_MS) busy_sleep_ms *= 2;
         continue;
       default:
         rb_raise(cError, "%s", sqlite3_errstr(ctx->rc));
@@ -861,10 +1295,66 @@ VALUE backup_cleanup(VALUE ptr) {
   sqlite3_backup_finish(ctx->backup);
 
   if (ctx->close_dst_on_cleanup)
-    sqlite3_close_v2(ctx->dst);
+    connection_close(ctx->dst);
   return Qnil;
 }
 
+static int backup_source_page_size(sqlite3 *db, VALUE name) {
+  char *sql = sqlite3_mprintf("pragma \"%w\".page_size", StringValueCStr(name));
+  sqlite3_stmt *stmt;
+  int page_size = 0;
+
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      page_size = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_free(sql);
+  return page_size > 0 ? page_size : 4096;
+}
+
+static void backup_parse_opts(backup_ctx *ctx, VALUE opts) {
+  static ID kw_ids[3];
+  VALUE kw_args[3];
+
+  ctx->pages_per_step = BACKUP_STEP_MAX_PAGES;
+  ctx->max_pages_per_step = BACKUP_MAX_STEP_PAGES;
+  ctx->target_bytes_per_sec = 0;
+  ctx->max_lock_ns = 0;
+  if (NIL_P(opts)) return;
+
+  if (!kw_ids[0]) {
+    CONST_ID(kw_ids[0], "pages_per_step");
+    CONST_ID(kw_ids[1], "target_mb_per_sec");
+    CONST_ID(kw_ids[2], "max_lock_ms");
+  }
+  rb_get_kwargs(opts, kw_ids, 0, 3, kw_args);
+
+  if (kw_args[1] != Qundef && !NIL_P(kw_args[1])) {
+    ctx->target_bytes_per_sec = NUM2DBL(kw_args[1]) * 1024 * 1024;
+    if (ctx->target_bytes_per_sec <= 0)
+      rb_raise(eArgumentError, "Invalid target_mb_per_sec value");
+
+    // limit each step to the amount of data copied in BACKUP_PACING_MS at the
+    // target rate, so the bandwidth is spread evenly
+    double pages = ctx->target_bytes_per_sec * BACKUP_PACING_MS / 1000 / ctx->page_size;
+    ctx->max_pages_per_step = pages < 1 ? 1 : (pages > BACKUP_MAX_STEP_PAGES ? BACKUP_MAX_STEP_PAGES : (int)pages);
+    if (ctx->pages_per_step > ctx->max_pages_per_step)
+      ctx->pages_per_step = ctx->max_pages_per_step;
+  }
+  if (kw_args[2] != Qundef && !NIL_P(kw_args[2])) {
+    double ms = NUM2DBL(kw_args[2]);
+    if (ms <= 0)
+      rb_raise(eArgumentError, "Invalid max_lock_ms value");
+    ctx->max_lock_ns = (unsigned long long)(ms * 1000000);
+  }
+  if (kw_args[0] != Qundef && !NIL_P(kw_args[0])) {
+    ctx->pages_per_step = NUM2INT(kw_args[0]);
+    if (ctx->pages_per_step == 0 || ctx->pages_per_step < -1)
+      rb_raise(eArgumentError, "Invalid pages_per_step value");
+  }
+}
+
 /* Creates a backup of the database to the given destination, which can be
  * either a filename or a database instance. In order to monitor the backup
  * progress you can pass a block that will be called periodically by the backup
@@ -876,30 +1366,68 @@ VALUE backup_cleanup(VALUE ptr) {
  *       puts "Backing up #{remaining}/#{total}"
  *     end
  * 
+ * If the block has a third required parameter, it is also passed a hash with
+ * the number of bytes copied (`:bytes_copied`) out of the total
+ * (`:bytes_total`), the observed throughput (`:bytes_per_sec`), the estimated
+ * remaining time in seconds (`:eta`) and the current step size
+ * (`:pages_per_step`).
+ * 
+ * The backup is performed in steps, copying `pages_per_step` pages at a time
+ * (default: 16, -1 copies the whole database in a single step). The source
+ * database is locked for the duration of each step. To limit the I/O used by
+ * the backup, pass `target_mb_per_sec`. To limit the time the source database
+ * is held locked, pass `max_lock_ms`, and the step size will be adjusted to
+ * keep each step under the given duration:
+ * 
+ *     db.backup('backup.db', target_mb_per_sec: 50, max_lock_ms: 10) do |_, _, info|
+ *       puts "#{info[:bytes_copied]}/#{info[:bytes_total]} ETA: #{info[:eta]&.round}s"
+ *     end
+ * 
+ * @overload backup(dest, src_db_name = 'main', dst_db_name = 'main', pages_per_step: 16, target_mb_per_sec: nil, max_lock_ms: nil)
  * @param dest [String, Extralite::Database] backup destination
  * @param src_db_name [String] source database name (default: "main")
  * @param dst_db_name [String] Destination database name (default: "main")
+ * @param pages_per_step [Integer] number of pages copied in each step
+ * @param target_mb_per_sec [Numeric, nil] maximum backup throughput in MiB/s
+ * @param max_lock_ms [Numeric, nil] maximum duration of each step
  * @yieldparam remaining [Integer] remaining page count
  * @yieldparam total [Integer] total page count
+ * @yieldparam info [Hash] progress info in bytes and ETA (optional)
  * @return [Extralite::Database] source database
  */
 VALUE Database_backup(int argc, VALUE *argv, VALUE self) {
   VALUE dst;
   VALUE src_name;
   VALUE dst_name;
-  rb_scan_args(argc, argv, "12", &dst, &src_name, &dst_name);
+  VALUE opts;
+  rb_scan_args(argc, argv, "12:", &dst, &src_name, &dst_name, &opts);
   if (src_name == Qnil) src_name = rb_str_new_literal("main");
   if (dst_name == Qnil) dst_name = rb_str_new_literal("main");
 
   int dst_is_fn = TYPE(dst) == T_STRING;
 
   Database_t *src = self_to_open_database(self);
+  backup_ctx ctx = {
+    .close_dst_on_cleanup = dst_is_fn,
+    .block_given          = rb_block_given_p(),
+    .page_size            = backup_source_page_size(src->sqlite3_db, src_name)
+  };
+  backup_parse_opts(&ctx, opts);
+  if (ctx.block_given) {
+    // the info hash is passed only to blocks with three or more required
+    // parameters, so that blocks taking optional or splat arguments keep
+    // receiving two arguments
+    int arity = rb_proc_arity(rb_block_proc());
+    int required = arity < 0 ? -arity - 1 : arity;
+    ctx.yield_info = required > 2;
+  }
+
   sqlite3 *dst_db;
 
   if (dst_is_fn) {
-    int rc = sqlite3_open(StringValueCStr(dst), &dst_db);
+    int rc = connection_open(StringValueCStr(dst), &dst_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
     if (rc) {
-      sqlite3_close_v2(dst_db);
+      connection_close(dst_db);
       rb_raise(cError, "%s", sqlite3_errmsg(dst_db));
     }
   }
@@ -914,11 +1442,12 @@ VALUE Database_backup(int argc, VALUE *argv, VALUE self) {
   backup = sqlite3_backup_init(dst_db, StringValueCStr(dst_name), src->sqlite3_db, StringValueCStr(src_name));
   if (!backup) {
     if (dst_is_fn)
-      sqlite3_close_v2(dst_db);
+      connection_close(dst_db);
     rb_raise(cError, "%s", sqlite3_errmsg(dst_db));
   }
 
-  backup_ctx ctx = { dst_db, dst_is_fn, backup, rb_block_given_p(), 0 };
+  ctx.dst = dst_db;
+  ctx.backup = backup;
   rb_ensure(SAFE(backup_safe_iterate), (VALUE)&ctx, SAFE(backup_cleanup), (VALUE)&ctx);
 
   RB_GC_GUARD(src_name);
@@ -927,6 +1456,116 @@ VALUE Database_backup(int argc, VALUE *argv, VALUE self) {
   return self;
 }
 
+#ifdef HAVE_SQLITE3_SERIALIZE
+/* Returns the content of the given database (default: "main") as a binary
+ * string. The returned string is an image of the database file, that can be
+ * loaded using `Database.deserialize`, or written to disk as an SQLite
+ * database file.
+ * 
+ *     image = db.serialize
+ *     copy = Extralite::Database.deserialize(image)
+ * 
+ * @param schema [String] database name (default: "main")
+ * @return [String] database image
+ */
+VALUE Database_serialize(int argc, VALUE *argv, VALUE self) {
+  Database_t *db = self_to_open_database(self);
+  VALUE schema;
+  sqlite3_int64 size = 0;
+
+  rb_scan_args(argc, argv, "01", &schema);
+  const char *name = NIL_P(schema) ? "main" : StringValueCStr(schema);
+
+  // in-memory databases are contiguous, and can be copied directly
+  unsigned char *ptr = sqlite3_serialize(db->sqlite3_db, name, &size, SQLITE_SERIALIZE_NOCOPY);
+  if (ptr) return rb_str_new((char *)ptr, size);
+
+  ptr = sqlite3_serialize(db->sqlite3_db, name, &size, 0);
+  if (!ptr) {
+    if (sqlite3_errcode(db->sqlite3_db) != SQLITE_OK)
+      rb_raise(cError, "%s", sqlite3_errmsg(db->sqlite3_db));
+    rb_raise(cError, "Failed to serialize database %s", name);
+  }
+
+  VALUE image = rb_str_new((char *)ptr, size);
+  sqlite3_free(ptr);
+  RB_GC_GUARD(schema);
+  return image;
+}
+
+/* Creates an in-memory database with the content of the given database image,
+ * as returned by `Database#serialize`. By default, the database is writable
+ * and resizable, and is loaded into a copy of the image. For read-only
+ * databases (`read_only: true`), a frozen image is used in place, without
+ * being copied, and is kept alive as long as the database.
+ * 
+ * Any other options are passed to `Database.new`.
+ * 
+ *     image = File.binread('fixtures.db').freeze
+ *     db = Extralite::Database.deserialize(image, read_only: true)
+ * 
+ * @overload deserialize(image, read_only: false, resizable: true, **opts)
+ * @param image [String] database image
+ * @param read_only [bool] whether the database is read-only
+ * @param resizable [bool] whether the database can grow beyond the image size
+ * @return [Extralite::Database] in-memory database
+ */
+VALUE Database_s_deserialize(int argc, VALUE *argv, VALUE klass) {
+  static ID kw_ids[2];
+  VALUE kw_args[2];
+  VALUE image;
+  VALUE opts;
+  int read_only = 0;
+  int resizable = 1;
+
+  rb_scan_args(argc, argv, "1:", &image, &opts);
+  StringValue(image);
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) {
+      CONST_ID(kw_ids[0], "read_only");
+      CONST_ID(kw_ids[1], "resizable");
+    }
+    // extracted options are removed from opts, the rest are passed to new
+    rb_get_kwargs(opts, kw_ids, 0, -3, kw_args);
+    if (kw_args[0] != Qundef) read_only = RTEST(kw_args[0]);
+    if (kw_args[1] != Qundef) resizable = RTEST(kw_args[1]);
+  }
+
+  VALUE args[2] = { rb_str_new_literal(":memory:"), opts };
+  VALUE self = NIL_P(opts) || RHASH_SIZE(opts) == 0 ?
+    rb_funcallv(klass, ID_new, 1, args) :
+    rb_funcallv_kw(klass, ID_new, 2, args, RB_PASS_KEYWORDS);
+  Database_t *db = self_to_open_database(self);
+
+  sqlite3_int64 size = RSTRING_LEN(image);
+  unsigned char *ptr;
+  unsigned int flags;
+
+  if (read_only && OBJ_FROZEN(image)) {
+    ptr = (unsigned char *)RSTRING_PTR(image);
+    flags = SQLITE_DESERIALIZE_READONLY;
+    RB_OBJ_WRITE(self, &db->image, image);
+  }
+  else {
+    ptr = sqlite3_malloc64(size ? size : 1);
+    if (!ptr) rb_raise(cError, "Failed to allocate memory for database image");
+    memcpy(ptr, RSTRING_PTR(image), size);
+    flags = SQLITE_DESERIALIZE_FREEONCLOSE;
+    if (read_only) flags |= SQLITE_DESERIALIZE_READONLY;
+    if (resizable) flags |= SQLITE_DESERIALIZE_RESIZEABLE;
+  }
+
+  // the buffer is freed by SQLite on failure if FREEONCLOSE is set
+  int rc = sqlite3_deserialize(db->sqlite3_db, "main", ptr, size, size, flags);
+  if (rc != SQLITE_OK) {
+    if (!NIL_P(db->image)) RB_OBJ_WRITE(self, &db->image, Qnil);
+    rb_raise(cError, "%s", sqlite3_errstr(rc));
+  }
+
+  return self;
+}
+#endif
+
 /* Returns runtime status values for the given op as an array containing the
  * current value and the high water mark value. To reset the high water mark,
  * pass true as reset.
@@ -984,6 +1623,426 @@ VALUE Database_status(int argc, VALUE *argv, VALUE self) {
   return rb_ary_new3(2, INT2NUM(cur), INT2NUM(hwm));
 }
 
+/* Returns the number of bytes of heap memory currently used by the database's
+ * page cache. This is a shortcut for
+ * `db.status(Extralite::SQLITE_DBSTATUS_CACHE_USED)[0]`.
+ *
+ * @return [Integer] page cache memory usage in bytes
+ */
+VALUE Database_cache_used(VALUE self) {
+  Database_t *db = self_to_open_database(self);
+  int cur, hwm;
+
+  int rc = sqlite3_db_status(db->sqlite3_db, SQLITE_DBSTATUS_CACHE_USED, &cur, &hwm, 0);
+  if (rc != SQLITE_OK) rb_raise(cError, "%s", sqlite3_errstr(rc));
+
+  return INT2NUM(cur);
+}
+
+/* Flushes dirty pages in the database's page cache to disk. For more
+ * information see: https://sqlite.org/c3ref/db_cacheflush.html
+ *
+ * @return [Extralite::Database] database
+ */
+VALUE Database_cache_flush(VALUE self) {
+  Database_t *db = self_to_open_database(self);
+
+  int rc = sqlite3_db_cacheflush(db->sqlite3_db);
+  if (rc != SQLITE_OK) rb_raise(cError, "%s", sqlite3_errstr(rc));
+
+  return self;
+}
+
+/* Frees as much heap memory as possible from the database's page cache. For
+ * more information see: https://sqlite.org/c3ref/db_release_memory.html
+ *
+ * @return [Extralite::Database] database
+ */
+VALUE Database_release_memory(VALUE self) {
+  Database_t *db = self_to_open_database(self);
+
+  int rc = sqlite3_db_release_memory(db->sqlite3_db);
+  if (rc != SQLITE_OK) rb_raise(cError, "%s", sqlite3_errstr(rc));
+
+  return self;
+}
+
+/*
+This function releases page cache memory for all open databases. It is called
+from inside the GC, so it must not allocate Ruby objects or block. A database
+that is currently in use by another thread (with its mutex held) is skipped.
+*/
+static void open_databases_release_memory(void) {
+  for (Database_t *db = open_databases; db; db = db->next_open) {
+    sqlite3_mutex *mutex = sqlite3_db_mutex(db->sqlite3_db);
+    if (!mutex || sqlite3_mutex_try(mutex) != SQLITE_OK) continue;
+
+    sqlite3_db_release_memory(db->sqlite3_db);
+    sqlite3_mutex_leave(mutex);
+  }
+}
+
+static void Extralite_gc_exit_hook(VALUE tpval, void *data) {
+  size_t major_gc_count = rb_gc_stat(SYM_major_gc_count);
+  if (major_gc_count == last_major_gc_count) return;
+
+  last_major_gc_count = major_gc_count;
+  open_databases_release_memory();
+}
+
+static inline void Extralite_set_release_on_gc(int enabled) {
+  if (enabled && NIL_P(gc_tracepoint)) {
+    last_major_gc_count = rb_gc_stat(SYM_major_gc_count);
+    gc_tracepoint = rb_tracepoint_new(0, RUBY_INTERNAL_EVENT_GC_EXIT, Extralite_gc_exit_hook, NULL);
+    rb_tracepoint_enable(gc_tracepoint);
+  }
+  else if (!enabled && !NIL_P(gc_tracepoint)) {
+    rb_tracepoint_disable(gc_tracepoint);
+    gc_tracepoint = Qnil;
+  }
+}
+
+#define DEFAULT_PAGECACHE_SLOT_SIZE (4096 + 128)
+
+static inline void configure_check_rc(int rc, const char *option) {
+  if (rc != SQLITE_OK)
+    rb_raise(cError, "Failed to configure %s: %s", option, sqlite3_errstr(rc));
+}
+
+/* call-seq:
+ *   Extralite.configure(**opts) -> Extralite
+ *
+ * Sets global SQLite memory allocation settings. This method can only be
+ * called while no database is open, as SQLite is shut down and reinitialized
+ * in order for the settings to take effect. This includes databases that were
+ * closed while queries or blobs on them are still open, as well as running
+ * snapshots and background checkpoints. The following options are accepted:
+ *
+ * - `:lookaside` (`Array`): default [lookaside](https://sqlite.org/malloc.html#lookaside)
+ *   slot size and slot count for new databases, e.g. `[1200, 100]`.
+ * - `:pagecache` (`Integer`, `Array`): size in bytes of the page cache memory
+ *   pool, or an array containing the slot size and slot count. The memory is
+ *   allocated by each database connection in a single bulk allocation.
+ * - `:memstatus` (`true`/`false`): enables or disables memory allocation
+ *   statistics. Disabling memory statistics removes a global mutex from every
+ *   memory allocation, but causes `Extralite.runtime_status` to return zero
+ *   for memory related status values.
+ * - `:mmap_size` (`Integer`): default memory-mapped I/O size in bytes.
+ *
+ *     Extralite.configure(lookaside: [1200, 100], memstatus: false)
+ *
+ * For more information see: https://sqlite.org/c3ref/c_config_covering_index_scan.html
+ *
+ * @param [Hash] opts configuration options
+ * @option opts [Array<Integer>] :lookaside lookaside slot size and count
+ * @option opts [Integer, Array<Integer>] :pagecache page cache pool size
+ * @option opts [bool] :memstatus enable memory statistics
+ * @option opts [Integer] :mmap_size default memory-mapped I/O size
+ * @return [Extralite] Extralite
+ */
+VALUE Extralite_configure(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[4];
+  VALUE kw_args[4];
+  VALUE opts;
+  int rc;
+
+  rb_scan_args(argc, argv, "00:", &opts);
+  if (NIL_P(opts)) return self;
+
+  if (!kw_ids[0]) {
+    CONST_ID(kw_ids[0], "lookaside");
+    CONST_ID(kw_ids[1], "pagecache");
+    CONST_ID(kw_ids[2], "memstatus");
+    CONST_ID(kw_ids[3], "mmap_size");
+  }
+  rb_get_kwargs(opts, kw_ids, 0, 4, kw_args);
+
+  if (live_connections)
+    rb_raise(cError, "Cannot configure SQLite while database connections are open");
+
+  rc = sqlite3_shutdown();
+  if (rc != SQLITE_OK) rb_raise(cError, "Failed to shut down SQLite: %s", sqlite3_errstr(rc));
+
+  if (kw_args[0] != Qundef) {
+    int slot_size, slot_count;
+    lookaside_opts(kw_args[0], &slot_size, &slot_count);
+    configure_check_rc(sqlite3_config(SQLITE_CONFIG_LOOKASIDE, slot_size, slot_count), "lookaside");
+  }
+  if (kw_args[1] != Qundef) {
+    int slot_size, slot_count;
+    if (TYPE(kw_args[1]) == T_ARRAY)
+      lookaside_opts(kw_args[1], &slot_size, &slot_count);
+    else {
+      slot_size = DEFAULT_PAGECACHE_SLOT_SIZE;
+      slot_count = (int)(NUM2LL(kw_args[1]) / slot_size);
+    }
+    configure_check_rc(sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, slot_size, slot_count), "pagecache");
+  }
+  if (kw_args[2] != Qundef)
+    configure_check_rc(sqlite3_config(SQLITE_CONFIG_MEMSTATUS, RTEST(kw_args[2]) ? 1 : 0), "memstatus");
+  if (kw_args[3] != Qundef) {
+    sqlite3_int64 mmap_size = NUM2LL(kw_args[3]);
+    configure_check_rc(sqlite3_config(SQLITE_CONFIG_MMAP_SIZE, mmap_size, (sqlite3_int64)-1), "mmap_size");
+  }
+
+  rc = sqlite3_initialize();
+  if (rc != SQLITE_OK) rb_raise(cError, "Failed to initialize SQLite: %s", sqlite3_errstr(rc));
+
+  return self;
+}
+
+/* call-seq:
+ *   Extralite.memory_policy(**opts) -> policy
+ *
+ * Sets the global memory policy for SQLite and returns the current policy as a
+ * hash. Options that are not given are left unchanged. The following options
+ * are accepted:
+ *
+ * - `:soft_heap_limit` (`Integer`): sets the [soft heap
+ *   limit](https://sqlite.org/c3ref/hard_heap_limit64.html) in bytes. SQLite
+ *   will try to keep its heap usage under this limit by releasing page cache
+ *   memory. A value of 0 removes the limit.
+ * - `:hard_heap_limit` (`Integer`): sets the hard heap limit in bytes. Memory
+ *   allocations that would exceed this limit fail with `SQLITE_NOMEM`. A value
+ *   of 0 removes the limit.
+ * - `:release_on_gc` (`true`/`false`): if true, page cache memory is released
+ *   for all open databases after each major GC.
+ *
+ *     Extralite.memory_policy(soft_heap_limit: 64 << 20, release_on_gc: true)
+ *     #=> { soft_heap_limit: 67108864, hard_heap_limit: 0, release_on_gc: true }
+ *
+ * @param [Hash] opts memory policy options
+ * @option opts [Integer] :soft_heap_limit soft heap limit in bytes
+ * @option opts [Integer] :hard_heap_limit hard heap limit in bytes
+ * @option opts [bool] :release_on_gc release memory after major GC
+ * @return [Hash] current memory policy
+ */
+VALUE Extralite_memory_policy(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[3];
+  VALUE kw_args[3];
+  VALUE opts;
+  VALUE policy;
+
+  rb_scan_args(argc, argv, "00:", &opts);
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) {
+      CONST_ID(kw_ids[0], "soft_heap_limit");
+      CONST_ID(kw_ids[1], "hard_heap_limit");
+      CONST_ID(kw_ids[2], "release_on_gc");
+    }
+
+    rb_get_kwargs(opts, kw_ids, 0, 3, kw_args);
+    if (kw_args[0] != Qundef) sqlite3_soft_heap_limit64(NUM2LL(kw_args[0]));
+    if (kw_args[1] != Qundef) {
+#ifdef HAVE_SQLITE3_HARD_HEAP_LIMIT64
+      sqlite3_hard_heap_limit64(NUM2LL(kw_args[1]));
+#else
+      rb_raise(cError, "Hard heap limit is not supported by this version of SQLite");
+#endif
+    }
+    if (kw_args[2] != Qundef) Extralite_set_release_on_gc(RTEST(kw_args[2]));
+  }
+
+  policy = rb_hash_new();
+  rb_hash_aset(policy, SYM_soft_heap_limit, LL2NUM(sqlite3_soft_heap_limit64(-1)));
+#ifdef HAVE_SQLITE3_HARD_HEAP_LIMIT64
+  rb_hash_aset(policy, SYM_hard_heap_limit, LL2NUM(sqlite3_hard_heap_limit64(-1)));
+#endif
+  rb_hash_aset(policy, SYM_release_on_gc, NIL_P(gc_tracepoint) ? Qfalse : Qtrue);
+  RB_GC_GUARD(policy);
+  return policy;
+}
+
+enum metric_aggregate {
+  METRIC_SUM,
+  METRIC_MAX
+};
+
+typedef long long (*metric_getter)(Database_t *db, int arg);
+
+struct metric_def {
+  const char            *family;
+  const char            *type;
+  const char            *help;
+  const char            *labels;
+  metric_getter         getter;
+  int                   arg;
+  enum metric_aggregate aggregate;
+};
+
+static long long metric_queries(Database_t *db, int kind) {
+  return db->metrics.queries[kind];
+}
+
+static long long metric_rows(Database_t *db, int unused) {
+  return db->metrics.rows;
+}
+
+static long long metric_gvl_releases(Database_t *db, int unused) {
+  return db->metrics.gvl_releases;
+}
+
+static long long metric_busy_errors(Database_t *db, int unused) {
+  return db->metrics.busy_errors;
+}
+
+static long long metric_db_status(Database_t *db, int op) {
+  int cur = 0, hwm = 0;
+  sqlite3_db_status(db->sqlite3_db, op, &cur, &hwm, 0);
+  return cur;
+}
+
+// For the lookaside hit and miss counters, SQLite reports the count in the
+// high-water value, and the current value is always zero.
+static long long metric_db_status_hwm(Database_t *db, int op) {
+  int cur = 0, hwm = 0;
+  sqlite3_db_status(db->sqlite3_db, op, &cur, &hwm, 0);
+  return hwm;
+}
+
+static long long metric_wal_size(Database_t *db, int unused) {
+  const char *filename = sqlite3_db_filename(db->sqlite3_db, "main");
+  if (!filename || !*filename) return 0;
+
+  char wal_filename[4096];
+  struct stat st;
+  snprintf(wal_filename, sizeof(wal_filename), "%s-wal", filename);
+  return stat(wal_filename, &st) ? 0 : (long long)st.st_size;
+}
+
+static const struct metric_def metric_defs[] = {
+  { "extralite_queries", "counter", "Queries issued by query mode", "mode=\"hash\"", metric_queries, QUERY_HASH, METRIC_SUM },
+  { "extralite_queries", "counter", NULL, "mode=\"splat\"", metric_queries, QUERY_SPLAT, METRIC_SUM },
+  { "extralite_queries", "counter", NULL, "mode=\"array\"", metric_queries, QUERY_ARRAY, METRIC_SUM },
+  { "extralite_queries", "counter", NULL, "mode=\"object\"", metric_queries, QUERY_OBJECT, METRIC_SUM },
+  { "extralite_queries", "counter", NULL, "mode=\"lazy\"", metric_queries, QUERY_LAZY, METRIC_SUM },
+  { "extralite_queries", "counter", NULL, "mode=\"execute\"", metric_queries, METRICS_QUERY_EXECUTE, METRIC_SUM },
+  { "extralite_rows", "counter", "Rows fetched", NULL, metric_rows, 0, METRIC_SUM },
+  { "extralite_gvl_releases", "counter", "GVL releases while stepping through queries", NULL, metric_gvl_releases, 0, METRIC_SUM },
+  { "extralite_busy_errors", "counter", "Queries failed with a busy error", NULL, metric_busy_errors, 0, METRIC_SUM },
+  { "extralite_cache_hits", "counter", "Page cache hits", NULL, metric_db_status, SQLITE_DBSTATUS_CACHE_HIT, METRIC_SUM },
+  { "extralite_cache_misses", "counter", "Page cache misses", NULL, metric_db_status, SQLITE_DBSTATUS_CACHE_MISS, METRIC_SUM },
+  { "extralite_cache_writes", "counter", "Page cache writes", NULL, metric_db_status, SQLITE_DBSTATUS_CACHE_WRITE, METRIC_SUM },
+  { "extralite_cache_spills", "counter", "Page cache spills", NULL, metric_db_status, SQLITE_DBSTATUS_CACHE_SPILL, METRIC_SUM },
+  { "extralite_cache_used_bytes", "gauge", "Page cache memory used", NULL, metric_db_status, SQLITE_DBSTATUS_CACHE_USED, METRIC_SUM },
+  { "extralite_lookaside_used", "gauge", "Lookaside slots in use", NULL, metric_db_status, SQLITE_DBSTATUS_LOOKASIDE_USED, METRIC_SUM },
+  { "extralite_lookaside_hits", "counter", "Lookaside allocation hits", NULL, metric_db_status_hwm, SQLITE_DBSTATUS_LOOKASIDE_HIT, METRIC_SUM },
+  { "extralite_lookaside_misses", "counter", "Lookaside allocation misses by reason", "reason=\"size\"", metric_db_status_hwm, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, METRIC_SUM },
+  { "extralite_lookaside_misses", "counter", NULL, "reason=\"full\"", metric_db_status_hwm, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, METRIC_SUM },
+  { "extralite_wal_size_bytes", "gauge", "WAL file size", NULL, metric_wal_size, 0, METRIC_MAX },
+  { NULL }
+};
+
+#define METRIC_LABEL_BUFFER_SIZE 32
+
+// Databases without a file (in-memory and temporary databases) are labeled by
+// their sequence number, since their metrics are unrelated to each other.
+static inline const char *metric_db_label(Database_t *db, char *buf) {
+  const char *filename = sqlite3_db_filename(db->sqlite3_db, "main");
+  if (filename && *filename) return filename;
+
+  snprintf(buf, METRIC_LABEL_BUFFER_SIZE, ":memory:%llu", db->id);
+  return buf;
+}
+
+static inline void metric_cat_label_value(VALUE str, const char *value) {
+  for (const char *c = value; *c; c++) {
+    switch (*c) {
+      case '\\':  rb_str_cat_cstr(str, "\\\\"); break;
+      case '"':   rb_str_cat_cstr(str, "\\\""); break;
+      case '\n':  rb_str_cat_cstr(str, "\\n"); break;
+      default:    rb_str_cat(str, c, 1);
+    }
+  }
+}
+
+/*
+This function formats metrics for the given databases in OpenMetrics text
+format. Samples for databases with the same filename are aggregated, so
+multiple connections to the same database are reported as a single series.
+*/
+static VALUE metrics_text(Database_t **dbs, int count) {
+  VALUE str = rb_str_new_literal("");
+  char buf[64];
+  const char **labels = ALLOCA_N(const char *, count);
+  char *label_buffers = ALLOCA_N(char, count * METRIC_LABEL_BUFFER_SIZE);
+  for (int i = 0; i < count; i++)
+    labels[i] = metric_db_label(dbs[i], label_buffers + i * METRIC_LABEL_BUFFER_SIZE);
+
+  for (const struct metric_def *def = metric_defs; def->family; def++) {
+    if (def->help) {
+      rb_str_catf(str, "# TYPE %s %s\n", def->family, def->type);
+      rb_str_catf(str, "# HELP %s %s.\n", def->family, def->help);
+    }
+
+    for (int i = 0; i < count; i++) {
+      const char *label = labels[i];
+      int seen = 0;
+      for (int j = 0; j < i && !seen; j++)
+        seen = !strcmp(label, labels[j]);
+      if (seen) continue;
+
+      long long value = def->getter(dbs[i], def->arg);
+      for (int j = i + 1; j < count; j++) {
+        if (strcmp(label, labels[j])) continue;
+
+        long long other = def->getter(dbs[j], def->arg);
+        if (def->aggregate == METRIC_SUM)
+          value += other;
+        else if (other > value)
+          value = other;
+      }
+
+      rb_str_cat_cstr(str, def->family);
+      if (def->type[0] == 'c') rb_str_cat_cstr(str, "_total");
+      rb_str_cat_cstr(str, "{db=\"");
+      metric_cat_label_value(str, label);
+      rb_str_cat_cstr(str, "\"");
+      if (def->labels) {
+        rb_str_cat_cstr(str, ",");
+        rb_str_cat_cstr(str, def->labels);
+      }
+      snprintf(buf, sizeof(buf), "} %lld\n", value);
+      rb_str_cat_cstr(str, buf);
+    }
+  }
+  rb_str_cat_cstr(str, "# EOF\n");
+  return str;
+}
+
+/* Returns metrics for the database in [OpenMetrics](https://openmetrics.io/)
+ * text format, suitable for scraping by Prometheus. The metrics include query
+ * counts by query mode, rows fetched, GVL releases, busy errors, page cache
+ * and lookaside statistics and the WAL file size. Counters are kept by
+ * Extralite for each database, so collecting metrics is cheap.
+ *
+ *     db.metrics
+ *     #=> "# TYPE extralite_queries counter\n..."
+ *
+ * @return [String] metrics text
+ */
+VALUE Database_metrics(VALUE self) {
+  Database_t *db = self_to_open_database(self);
+  return metrics_text(&db, 1);
+}
+
+/* Returns metrics for all open databases in [OpenMetrics](https://openmetrics.io/)
+ * text format. Metrics for connections to the same database file are
+ * aggregated. See also `Database#metrics`.
+ *
+ * @return [String] metrics text
+ */
+VALUE Extralite_metrics_text(VALUE self) {
+  int count = 0;
+  for (Database_t *db = open_databases; db; db = db->next_open) count++;
+
+  Database_t **dbs = ALLOCA_N(Database_t *, count);
+  count = 0;
+  for (Database_t *db = open_databases; db; db = db->next_open) dbs[count++] = db;
+
+  return metrics_text(dbs, count);
+}
+
 /* Returns the current limit for the given category. If a new value is given,
  * sets the limit to the new value and returns the previous value.
  * 
@@ -1079,7 +2138,39 @@ VALUE Database_track_changes(int argc, VALUE *argv, VALUE self) {
   VALUE changeset = rb_funcall(cChangeset, ID_new, 0);
   VALUE tables = rb_ary_new_from_values(argc, argv);
 
-  rb_funcall(changeset, ID_track, 2, self, tables);
+  VALUE args[] = { self, tables };
+  rb_funcall_passing_block(changeset, ID_track, 2, args);
+
+  RB_GC_GUARD(changeset);
+  RB_GC_GUARD(tables);
+  return changeset;
+}
+
+/* call-seq:
+ *   db.track_patches(*tables) { ... } -> changeset
+ *
+ * Tracks changes to the database and returns a patchset. Patchsets are more
+ * compact than changesets, as they do not include the original values of
+ * updated and deleted rows (other than the primary key), and are suitable for
+ * replicating changes to a database known to match the tracked one. Passing a
+ * value of nil causes all tables to be tracked.
+ *
+ *     patchset = db.track_patches(:foo, :bar) do
+ *       perform_a_bunch_of_queries
+ *     end
+ *     patchset.apply(replica)
+ *
+ * @param *tables [Array<String, Symbol>] table(s) to track
+ * @return [Extralite::Changeset] patchset
+ */
+VALUE Database_track_patches(int argc, VALUE *argv, VALUE self) {
+  self_to_open_database(self);
+
+  VALUE changeset = rb_funcall(cChangeset, ID_new, 0);
+  VALUE tables = rb_ary_new_from_values(argc, argv);
+
+  VALUE args[] = { self, tables };
+  rb_funcall_passing_block(changeset, ID_track_patchset, 2, args);
 
   RB_GC_GUARD(changeset);
   RB_GC_GUARD(tables);
@@ -1090,7 +2181,7 @@ VALUE Database_track_changes(int argc, VALUE *argv, VALUE self) {
 void Database_reset_progress_handler(VALUE self, Database_t *db) {
   db->progress_handler.mode = PROGRESS_NONE;
   RB_OBJ_WRITE(self, &db->progress_handler.proc, Qnil);
-  sqlite3_progress_handler(db->sqlite3_db, 0, NULL, NULL);
+  Database_install_progress_handler(db);
   sqlite3_busy_handler(db->sqlite3_db, NULL, NULL);
 }
 
@@ -1102,7 +2193,9 @@ static inline enum progress_handler_mode symbol_to_progress_mode(VALUE mode) {
   rb_raise(eArgumentError, "Invalid progress handler mode");
 }
 
-inline void Database_issue_query(Database_t *db, VALUE sql) {
+inline void Database_issue_query(Database_t *db, VALUE sql, int query_kind) {
+  db->metrics.queries[query_kind]++;
+  if (profiler_active) profiler_capture_caller(db);
   if (db->trace_proc != Qnil) rb_funcall(db->trace_proc, ID_call, 1, sql);
   switch (db->progress_handler.mode) {
     case PROGRESS_AT_LEAST_ONCE:
@@ -1241,8 +2334,7 @@ VALUE Database_on_progress(int argc, VALUE *argv, VALUE self) {
   // The PROGRESS_ONCE mode works by invoking the progress handler proc exactly
   // once, before iterating over the result set, so in that mode we don't
   // actually need to set the progress handler at the sqlite level.
-  if (prog.mode != PROGRESS_ONCE)
-    sqlite3_progress_handler(db->sqlite3_db, prog.tick, &Database_progress_handler, db);
+  Database_install_progress_handler(db);
   if (prog.mode != PROGRESS_NONE)
     sqlite3_busy_handler(db->sqlite3_db, &Database_busy_handler, db);
 
@@ -1473,6 +2565,9 @@ void Init_ExtraliteDatabase(void) {
   rb_define_singleton_method(mExtralite, "runtime_status", Extralite_runtime_status, -1);
   rb_define_singleton_method(mExtralite, "sqlite3_version", Extralite_sqlite3_version, 0);
   rb_define_singleton_method(mExtralite, "on_progress", Extralite_on_progress, -1);
+  rb_define_singleton_method(mExtralite, "configure", Extralite_configure, -1);
+  rb_define_singleton_method(mExtralite, "memory_policy", Extralite_memory_policy, -1);
+  rb_define_singleton_method(mExtralite, "metrics_text", Extralite_metrics_text, 0);
 
   cDatabase = rb_define_class_under(mExtralite, "Database", rb_cObject);
   rb_define_alloc_func(cDatabase, Database_allocate);
@@ -1484,6 +2579,8 @@ void Init_ExtraliteDatabase(void) {
   rb_define_method(cDatabase, "batch_query_splat",       Database_batch_query_splat, 2);
   rb_define_method(cDatabase, "batch_query_hash",       Database_batch_query, 2);
   rb_define_method(cDatabase, "busy_timeout=",          Database_busy_timeout_set, 1);
+  rb_define_method(cDatabase, "cache_flush",            Database_cache_flush, 0);
+  rb_define_method(cDatabase, "cache_used",             Database_cache_used, 0);
   rb_define_method(cDatabase, "changes",                Database_changes, 0);
   rb_define_method(cDatabase, "close",                  Database_close, 0);
   rb_define_method(cDatabase, "closed?",                Database_closed_p, 0);
@@ -1504,25 +2601,38 @@ void Init_ExtraliteDatabase(void) {
   rb_define_method(cDatabase, "interrupt",              Database_interrupt, 0);
   rb_define_method(cDatabase, "last_insert_rowid",      Database_last_insert_rowid, 0);
   rb_define_method(cDatabase, "limit",                  Database_limit, -1);
+  rb_define_method(cDatabase, "metrics",                Database_metrics, 0);
 
   #ifdef HAVE_SQLITE3_LOAD_EXTENSION
   rb_define_method(cDatabase, "load_extension",         Database_load_extension, 1);
   #endif
 
+  #ifdef HAVE_SQLITE3_SERIALIZE
+  rb_define_method(cDatabase, "serialize",              Database_serialize, -1);
+  rb_define_singleton_method(cDatabase, "deserialize",  Database_s_deserialize, -1);
+  #endif
+
   rb_define_method(cDatabase, "on_progress",            Database_on_progress, -1);
   rb_define_method(cDatabase, "prepare",                Database_prepare_hash, -1);
   rb_define_method(cDatabase, "prepare_splat",          Database_prepare_splat, -1);
   rb_define_method(cDatabase, "prepare_array",          Database_prepare_array, -1);
+  rb_define_method(cDatabase, "prepare_as",             Database_prepare_as, -1);
   rb_define_method(cDatabase, "prepare_hash",           Database_prepare_hash, -1);
+  rb_define_method(cDatabase, "prepare_lazy",           Database_prepare_lazy, -1);
   rb_define_method(cDatabase, "query",                  Database_query, -1);
   rb_define_method(cDatabase, "query_splat",            Database_query_splat, -1);
   rb_define_method(cDatabase, "query_array",            Database_query_array, -1);
+  rb_define_method(cDatabase, "query_as",               Database_query_as, -1);
   rb_define_method(cDatabase, "query_hash",             Database_query, -1);
+  rb_define_method(cDatabase, "query_lazy",             Database_query_lazy, -1);
   rb_define_method(cDatabase, "query_single",           Database_query_single, -1);
   rb_define_method(cDatabase, "query_single_array",     Database_query_single_array, -1);
+  rb_define_method(cDatabase, "query_single_as",        Database_query_single_as, -1);
   rb_define_method(cDatabase, "query_single_splat",     Database_query_single_splat, -1);
   rb_define_method(cDatabase, "query_single_hash",      Database_query_single, -1);
+  rb_define_method(cDatabase, "query_single_lazy",      Database_query_single_lazy, -1);
   rb_define_method(cDatabase, "read_only?",             Database_read_only_p, 0);
+  rb_define_method(cDatabase, "release_memory",         Database_release_memory, 0);
   rb_define_method(cDatabase, "status",                 Database_status, -1);
   rb_define_method(cDatabase, "total_changes",          Database_total_changes, 0);
   rb_define_method(cDatabase, "trace",                  Database_trace, 0);
@@ -1530,6 +2640,7 @@ void Init_ExtraliteDatabase(void) {
 
   #ifdef EXTRALITE_ENABLE_CHANGESET
   rb_define_method(cDatabase, "track_changes",          Database_track_changes, -1);
+  rb_define_method(cDatabase, "track_patches",          Database_track_patches, -1);
   #endif
   
   rb_define_method(cDatabase, "transaction_active?",    Database_transaction_active_p, 0);
@@ -1544,41 +2655,72 @@ void Init_ExtraliteDatabase(void) {
 
   ID_bind         = rb_intern("bind");
   ID_call         = rb_intern("call");
+  ID_decode_json  = rb_intern("decode_json");
   ID_each         = rb_intern("each");
+  ID_intern_set   = rb_intern("intern=");
+  ID_join         = rb_intern("join");
   ID_keys         = rb_intern("keys");
   ID_new          = rb_intern("new");
   ID_pragma       = rb_intern("pragma");
   ID_strip        = rb_intern("strip");
   ID_to_s         = rb_intern("to_s");
   ID_track        = rb_intern("track");
+  ID_track_patchset = rb_intern("track_patchset");
 
   SYM_at_least_once         = ID2SYM(rb_intern("at_least_once"));
+  SYM_bytes_copied          = ID2SYM(rb_intern("bytes_copied"));
+  SYM_bytes_per_sec         = ID2SYM(rb_intern("bytes_per_sec"));
+  SYM_bytes_total           = ID2SYM(rb_intern("bytes_total"));
+  SYM_decode_json           = ID2SYM(rb_intern("decode_json"));
+  SYM_decode_types          = ID2SYM(rb_intern("decode_types"));
+  SYM_eta                   = ID2SYM(rb_intern("eta"));
   SYM_full                  = ID2SYM(rb_intern("full"));
   SYM_gvl_release_threshold = ID2SYM(rb_intern("gvl_release_threshold"));
+  SYM_hard_heap_limit       = ID2SYM(rb_intern("hard_heap_limit"));
+  SYM_intern                = ID2SYM(rb_intern("intern"));
+  SYM_lookaside             = ID2SYM(rb_intern("lookaside"));
+  SYM_major_gc_count        = ID2SYM(rb_intern("major_gc_count"));
   SYM_once                  = ID2SYM(rb_intern("once"));
+  SYM_pages_per_step        = ID2SYM(rb_intern("pages_per_step"));
   SYM_none                  = ID2SYM(rb_intern("none"));
   SYM_normal                = ID2SYM(rb_intern("normal"));
   SYM_passive               = ID2SYM(rb_intern("passive"));
   SYM_pragma                = ID2SYM(rb_intern("pragma"));
   SYM_read_only             = ID2SYM(rb_intern("read_only"));
+  SYM_release_on_gc         = ID2SYM(rb_intern("release_on_gc"));
   SYM_restart               = ID2SYM(rb_intern("restart"));
+  SYM_soft_heap_limit       = ID2SYM(rb_intern("soft_heap_limit"));
   SYM_truncate              = ID2SYM(rb_intern("truncate"));
   SYM_wal                   = ID2SYM(rb_intern("wal"));
 
   rb_gc_register_mark_object(SYM_at_least_once);
+  rb_gc_register_mark_object(SYM_bytes_copied);
+  rb_gc_register_mark_object(SYM_bytes_per_sec);
+  rb_gc_register_mark_object(SYM_bytes_total);
+  rb_gc_register_mark_object(SYM_decode_json);
+  rb_gc_register_mark_object(SYM_decode_types);
+  rb_gc_register_mark_object(SYM_eta);
   rb_gc_register_mark_object(SYM_full);
   rb_gc_register_mark_object(SYM_gvl_release_threshold);
+  rb_gc_register_mark_object(SYM_hard_heap_limit);
+  rb_gc_register_mark_object(SYM_intern);
+  rb_gc_register_mark_object(SYM_lookaside);
+  rb_gc_register_mark_object(SYM_major_gc_count);
   rb_gc_register_mark_object(SYM_once);
+  rb_gc_register_mark_object(SYM_pages_per_step);
   rb_gc_register_mark_object(SYM_none);
   rb_gc_register_mark_object(SYM_normal);
   rb_gc_register_mark_object(SYM_passive);
   rb_gc_register_mark_object(SYM_pragma);
   rb_gc_register_mark_object(SYM_read_only);
+  rb_gc_register_mark_object(SYM_release_on_gc);
   rb_gc_register_mark_object(SYM_restart);
+  rb_gc_register_mark_object(SYM_soft_heap_limit);
   rb_gc_register_mark_object(SYM_truncate);
   rb_gc_register_mark_object(SYM_wal);
 
   rb_gc_register_mark_object(global_progress_handler.proc);
+  rb_gc_register_address(&gc_tracepoint);
 
   UTF8_ENCODING = rb_utf8_encoding();
 }
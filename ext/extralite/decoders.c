@@ -0,0 +1,738 @@
+#include <stdio.h>
+#include <strings.h>
+#include <math.h>
+#include "extralite.h"
+
+/*
+ * Column value decoders. When enabled for a database, the declared type of
+ * each result column is looked up once per statement execution, and values of
+ * columns with a recognized declared type are converted directly into the
+ * corresponding Ruby objects:
+ *
+ * - `date`: Date
+ * - `datetime`, `timestamp`: Time
+ * - `bool`, `boolean`, `bit`: true/false
+ * - `decimal`, `numeric`, `money`: BigDecimal
+ *
+ * Independently, JSON decoding can be enabled for columns with a `json` or
+ * `jsonb` declared type, and for columns selected by name (see json.c).
+ *
+ * Text values of low-cardinality columns can also be interned: each distinct
+ * value is converted once into a frozen, deduplicated string, which is then
+ * reused for all subsequent rows (and, for prepared queries, executions).
+ *
+ * Values that cannot be converted are returned as is.
+ */
+
+static ID ID_BigDecimal;
+static ID ID_jd;
+
+static VALUE cDate = Qnil;
+static VALUE decimal_kw = Qnil;
+static int bigdecimal_loaded = 0;
+
+static VALUE date_class(void) {
+  if (NIL_P(cDate)) {
+    rb_require("date");
+    cDate = rb_const_get(rb_cObject, rb_intern("Date"));
+    rb_gc_register_mark_object(cDate);
+  }
+  return cDate;
+}
+
+static inline void require_bigdecimal(void) {
+  if (!bigdecimal_loaded) {
+    rb_require("bigdecimal");
+    bigdecimal_loaded = 1;
+  }
+}
+
+static inline int name_match(const char *decltype, size_t len, const char *name) {
+  return (strlen(name) == len) && !strncasecmp(decltype, name, len);
+}
+
+// Returns the decoder for the given declared column type. As in SQLite's
+// type affinity rules, any parenthesized size or precision is ignored.
+static enum column_decoder decoder_for_decltype(const char *decltype) {
+  if (!decltype) return DECODER_NONE;
+
+  size_t len = strcspn(decltype, "(");
+  while (len > 0 && decltype[len - 1] == ' ') len--;
+
+  if (name_match(decltype, len, "date"))
+    return DECODER_DATE;
+  if (name_match(decltype, len, "datetime") || name_match(decltype, len, "timestamp"))
+    return DECODER_TIME;
+  if (name_match(decltype, len, "boolean") || name_match(decltype, len, "bool") ||
+      name_match(decltype, len, "bit"))
+    return DECODER_BOOLEAN;
+  if (name_match(decltype, len, "decimal") || name_match(decltype, len, "numeric") ||
+      name_match(decltype, len, "money"))
+    return DECODER_DECIMAL;
+  if (name_match(decltype, len, "json") || name_match(decltype, len, "jsonb"))
+    return DECODER_JSON;
+  return DECODER_NONE;
+}
+
+static inline int column_name_p(VALUE columns, const char *name) {
+  if (NIL_P(columns)) return 0;
+
+  long len = strlen(name);
+  for (long i = 0; i < RARRAY_LEN(columns); i++) {
+    VALUE column = RARRAY_AREF(columns, i);
+    if (RSTRING_LEN(column) == len && !memcmp(RSTRING_PTR(column), name, len)) return 1;
+  }
+  return 0;
+}
+
+static inline enum column_decoder column_decoder(Database_t *db, sqlite3_stmt *stmt, int col) {
+  if (db->decode_json && column_name_p(db->json_columns, sqlite3_column_name(stmt, col)))
+    return DECODER_JSON;
+
+  enum column_decoder kind = decoder_for_decltype(sqlite3_column_decltype(stmt, col));
+  if (kind == DECODER_JSON ? !db->decode_json : !db->decode_types)
+    kind = DECODER_NONE;
+  if (kind != DECODER_NONE) return kind;
+
+  switch (db->intern) {
+    case INTERN_COLUMNS:
+      return column_name_p(db->intern_columns, sqlite3_column_name(stmt, col)) ?
+        DECODER_INTERN : DECODER_NONE;
+    case INTERN_AUTO:
+      return DECODER_INTERN_AUTO;
+    default:
+      return DECODER_NONE;
+  }
+}
+
+static void intern_setup(struct column_decoders *decoders, query_ctx *ctx);
+
+struct column_decoders *column_decoders_setup(struct column_decoders *decoders, query_ctx *ctx, int column_count) {
+  Database_t *db = ctx->db;
+  if (!(db->decode_types || db->decode_json || db->intern) || !column_count) return NULL;
+
+  int found = 0;
+  decoders->count = column_count;
+  decoders->json_flags = db->json_flags;
+  decoders->buffer = 0;
+  decoders->intern_table = Qnil;
+  decoders->kinds = (column_count > MAX_EMBEDDED_DECODERS) ?
+    rb_alloc_tmp_buffer((volatile VALUE *)&decoders->buffer, column_count) : decoders->embedded;
+
+  for (int i = 0; i < column_count; i++) {
+    decoders->kinds[i] = column_decoder(db, ctx->stmt, i);
+    if (decoders->kinds[i] != DECODER_NONE) found = 1;
+  }
+  if (db->intern) intern_setup(decoders, ctx);
+  return found ? decoders : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static inline int parse_digits(const char **ptr, const char *end, int count, int *value) {
+  const char *p = *ptr;
+  if (end - p < count) return 0;
+
+  int v = 0;
+  for (int i = 0; i < count; i++, p++) {
+    if (*p < '0' || *p > '9') return 0;
+    v = v * 10 + (*p - '0');
+  }
+  *value = v;
+  *ptr = p;
+  return 1;
+}
+
+static inline int days_in_month(int year, int month) {
+  static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  if (month == 2 && (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0)))
+    return 29;
+  return days[month - 1];
+}
+
+// Parses a YYYY-MM-DD date, returning true if valid.
+static inline int parse_date(const char **ptr, const char *end, int *year, int *month, int *day) {
+  if (!parse_digits(ptr, end, 4, year)) return 0;
+  if (*ptr == end || **ptr != '-') return 0;
+  (*ptr)++;
+  if (!parse_digits(ptr, end, 2, month)) return 0;
+  if (*ptr == end || **ptr != '-') return 0;
+  (*ptr)++;
+  if (!parse_digits(ptr, end, 2, day)) return 0;
+
+  return (*month >= 1 && *month <= 12 && *day >= 1 && *day <= days_in_month(*year, *month));
+}
+
+// Returns the number of days since the Unix epoch for the given civil date
+// (see http://howardhinnant.github.io/date_algorithms.html#days_from_civil).
+static inline long long days_from_civil(int year, int month, int day) {
+  year -= month <= 2;
+  long long era = (year >= 0 ? year : year - 399) / 400;
+  long long yoe = year - era * 400;
+  long long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static VALUE decode_date(const char *str, int len) {
+  const char *end = str + len;
+  int year, month, day;
+  if (!parse_date(&str, end, &year, &month, &day) || str != end) return Qnil;
+
+  VALUE args[] = { INT2FIX(year), INT2FIX(month), INT2FIX(day) };
+  return rb_funcallv(date_class(), ID_new, 3, args);
+}
+
+// Parses an ISO 8601 timestamp of the form `YYYY-MM-DD[( |T)HH:MM[:SS[.fff]]]`,
+// optionally followed by a `Z` or `[+-]HH[:]MM` UTC offset. As with SQLite's
+// date and time functions, timestamps without a UTC offset are assumed to be
+// in UTC.
+static VALUE decode_time(const char *str, int len) {
+  const char *end = str + len;
+  int year, month, day;
+  int hour = 0, min = 0, sec = 0;
+  long nsec = 0;
+  int offset = INT_MAX - 1; // UTC
+
+  if (!parse_date(&str, end, &year, &month, &day)) return Qnil;
+  if (str == end) goto done;
+
+  if (*str != 'T' && *str != 't' && *str != ' ') return Qnil;
+  str++;
+  if (!parse_digits(&str, end, 2, &hour)) return Qnil;
+  if (str == end || *str != ':') return Qnil;
+  str++;
+  if (!parse_digits(&str, end, 2, &min)) return Qnil;
+  if (str < end && *str == ':') {
+    str++;
+    if (!parse_digits(&str, end, 2, &sec)) return Qnil;
+    if (str < end && *str == '.') {
+      str++;
+      long scale = 100000000;
+      if (str == end || *str < '0' || *str > '9') return Qnil;
+      for (; str < end && *str >= '0' && *str <= '9'; str++) {
+        nsec += (*str - '0') * scale;
+        scale /= 10;
+      }
+    }
+  }
+  if (hour > 23 || min > 59 || sec > 60) return Qnil;
+
+  if (str < end && *str == ' ') str++;
+  if (str == end) goto done;
+
+  if (*str == 'Z' || *str == 'z')
+    str++;
+  else if (*str == '+' || *str == '-') {
+    int sign = (*str == '-') ? -1 : 1;
+    int offset_hour, offset_min = 0;
+    str++;
+    if (!parse_digits(&str, end, 2, &offset_hour)) return Qnil;
+    if (str < end && *str == ':') str++;
+    if (str < end && !parse_digits(&str, end, 2, &offset_min)) return Qnil;
+    if (offset_hour > 23 || offset_min > 59) return Qnil;
+    offset = sign * (offset_hour * 3600 + offset_min * 60);
+  }
+  if (str != end) return Qnil;
+
+done:
+  {
+    struct timespec ts;
+    long long secs = days_from_civil(year, month, day) * 86400 + hour * 3600 + min * 60 + sec;
+    if (offset != INT_MAX - 1) secs -= offset;
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = nsec;
+    return rb_time_timespec_new(&ts, offset);
+  }
+}
+
+// Returns true or false for a recognized boolean literal (matched case
+// insensitively), or Qundef for any other text.
+static inline VALUE decode_boolean_text(const char *str, int len) {
+  static const char *true_values[] = {"1", "t", "true", "y", "yes", "on"};
+  static const char *false_values[] = {"0", "f", "false", "n", "no", "off"};
+  for (size_t i = 0; i < sizeof(true_values) / sizeof(true_values[0]); i++)
+    if (name_match(str, len, true_values[i])) return Qtrue;
+  for (size_t i = 0; i < sizeof(false_values) / sizeof(false_values[0]); i++)
+    if (name_match(str, len, false_values[i])) return Qfalse;
+  return Qundef;
+}
+
+static inline VALUE decode_decimal(struct raw_value *v) {
+  VALUE str;
+  char buf[32];
+
+  require_bigdecimal();
+  switch (v->type) {
+    case SQLITE_INTEGER:
+      sqlite3_snprintf(sizeof(buf), buf, "%lld", v->i);
+      str = rb_str_new_cstr(buf);
+      break;
+    case SQLITE_FLOAT:
+      // same formatting SQLite uses for converting real values to text
+      sqlite3_snprintf(sizeof(buf), buf, "%!.15g", v->d);
+      str = rb_str_new_cstr(buf);
+      break;
+    default:
+      str = rb_str_new(v->ptr, v->len);
+  }
+  VALUE args[] = { str, decimal_kw };
+  VALUE value = rb_funcallv_kw(rb_mKernel, ID_BigDecimal, 2, args, RB_PASS_KEYWORDS);
+  if (NIL_P(value)) {
+    rb_enc_associate(str, UTF8_ENCODING);
+    return str;
+  }
+  return value;
+}
+
+// Julian day number of the Unix epoch
+#define JULIAN_DAY_EPOCH 2440587.5
+
+// Numeric timestamps carry no offset, and are returned in UTC like text
+// timestamps without one.
+static inline VALUE time_utc_new(time_t sec, long nsec) {
+  struct timespec ts = { .tv_sec = sec, .tv_nsec = nsec };
+  return rb_time_timespec_new(&ts, INT_MAX - 1);
+}
+
+static inline VALUE decode_julian_day_time(double jd) {
+  double secs = (jd - JULIAN_DAY_EPOCH) * 86400;
+  double whole = floor(secs);
+  long nsec = (long)round((secs - whole) * 1e9);
+  if (nsec == 1000000000) {
+    whole += 1;
+    nsec = 0;
+  }
+  return time_utc_new((time_t)whole, nsec);
+}
+
+static inline double raw_value_double(struct raw_value *v) {
+  return (v->type == SQLITE_INTEGER) ? (double)v->i : v->d;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The intern table is an open-addressing hash table mapping text values to
+// interned strings. A prepared query keeps its table across executions, and
+// the table starts small and grows on demand, up to a fixed maximum size.
+#define INTERN_TABLE_MIN_SIZE 64
+#define INTERN_TABLE_MAX_SIZE 4096
+#define INTERN_TABLE_FULL_P(count, size) ((count) >= (size) * 3 / 4)
+
+// In auto mode, only short values are interned, and interning is turned off
+// for columns that keep producing new values.
+#define INTERN_AUTO_MAX_LEN 64
+#define INTERN_AUTO_MAX_MISSES 256
+
+typedef struct {
+  int       size;
+  int       count;
+  int       column_count;
+  VALUE     *strings;
+  uint32_t  *hashes;
+  int       *misses;
+} InternTable_t;
+
+static void InternTable_mark(void *ptr) {
+  InternTable_t *table = ptr;
+  for (int i = 0; i < table->size; i++)
+    if (table->strings[i]) rb_gc_mark_movable(table->strings[i]);
+}
+
+static void InternTable_compact(void *ptr) {
+  InternTable_t *table = ptr;
+  for (int i = 0; i < table->size; i++)
+    if (table->strings[i]) table->strings[i] = rb_gc_location(table->strings[i]);
+}
+
+static void InternTable_free(void *ptr) {
+  InternTable_t *table = ptr;
+  xfree(table->strings);
+  xfree(table->hashes);
+  xfree(table->misses);
+  xfree(ptr);
+}
+
+static size_t InternTable_size(const void *ptr) {
+  const InternTable_t *table = ptr;
+  return sizeof(InternTable_t) + table->size * (sizeof(VALUE) + sizeof(uint32_t)) +
+    table->column_count * sizeof(int);
+}
+
+static const rb_data_type_t InternTable_type = {
+    "InternTable",
+    {InternTable_mark, InternTable_free, InternTable_size, InternTable_compact},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+VALUE intern_table_new(void) {
+  InternTable_t *table = ZALLOC(InternTable_t);
+  VALUE obj = TypedData_Wrap_Struct(0, &InternTable_type, table);
+  table->strings = ZALLOC_N(VALUE, INTERN_TABLE_MIN_SIZE);
+  table->hashes = ALLOC_N(uint32_t, INTERN_TABLE_MIN_SIZE);
+  table->size = INTERN_TABLE_MIN_SIZE;
+  return obj;
+}
+
+static inline InternTable_t *intern_table(VALUE obj) {
+  return RTYPEDDATA_DATA(obj);
+}
+
+// Resets the per-column miss counts if the column count has changed (e.g.
+// after the statement has been reprepared following a schema change).
+static void intern_table_columns_setup(InternTable_t *table, int column_count) {
+  if (table->column_count == column_count) return;
+
+  REALLOC_N(table->misses, int, column_count);
+  memset(table->misses, 0, column_count * sizeof(int));
+  table->column_count = column_count;
+}
+
+static inline int intern_table_slot(InternTable_t *table, uint32_t hash, const char *ptr, long len) {
+  int mask = table->size - 1;
+  int idx = hash & mask;
+  while (table->strings[idx]) {
+    VALUE str = table->strings[idx];
+    if (table->hashes[idx] == hash && RSTRING_LEN(str) == len && !memcmp(RSTRING_PTR(str), ptr, len))
+      break;
+    idx = (idx + 1) & mask;
+  }
+  return idx;
+}
+
+// Doubles the table size. The new arrays are allocated before the table is
+// updated, since allocating may trigger a GC run which marks the table.
+static void intern_table_grow(InternTable_t *table) {
+  int size = table->size * 2;
+  VALUE *strings = ZALLOC_N(VALUE, size);
+  uint32_t *hashes = ALLOC_N(uint32_t, size);
+  int mask = size - 1;
+  for (int i = 0; i < table->size; i++) {
+    if (!table->strings[i]) continue;
+    int idx = table->hashes[i] & mask;
+    while (strings[idx]) idx = (idx + 1) & mask;
+    strings[idx] = table->strings[i];
+    hashes[idx] = table->hashes[i];
+  }
+  xfree(table->strings);
+  xfree(table->hashes);
+  table->strings = strings;
+  table->hashes = hashes;
+  table->size = size;
+}
+
+static inline int intern_auto_p(enum column_decoder kind, long len) {
+  return kind == DECODER_INTERN || len <= INTERN_AUTO_MAX_LEN;
+}
+
+VALUE intern_text_value(VALUE obj, unsigned char *kinds, int col, const char *ptr, long len) {
+  enum column_decoder kind = kinds[col];
+  if (!intern_auto_p(kind, len)) return utf8_str_new(ptr, len);
+
+  InternTable_t *table = intern_table(obj);
+  uint32_t hash = (uint32_t)rb_memhash(ptr, len);
+  int idx = intern_table_slot(table, hash, ptr, len);
+  if (table->strings[idx]) return table->strings[idx];
+
+  VALUE str = rb_enc_interned_str(ptr, len, UTF8_ENCODING);
+  if (INTERN_TABLE_FULL_P(table->count, table->size) && table->size < INTERN_TABLE_MAX_SIZE) {
+    intern_table_grow(table);
+    idx = intern_table_slot(table, hash, ptr, len);
+  }
+  if (!INTERN_TABLE_FULL_P(table->count, table->size)) {
+    RB_OBJ_WRITE(obj, &table->strings[idx], str);
+    table->hashes[idx] = hash;
+    table->count++;
+  }
+  if (kind == DECODER_INTERN_AUTO && col < table->column_count &&
+      ++table->misses[col] >= INTERN_AUTO_MAX_MISSES)
+    kinds[col] = DECODER_NONE;
+  return str;
+}
+
+// Sets up the intern table for a query execution. Prepared queries pass in
+// their own table, so values and miss counts are kept across executions, and
+// columns found to have too many distinct values stay uninterned.
+static void intern_setup(struct column_decoders *decoders, query_ctx *ctx) {
+  int found = 0;
+  for (int i = 0; i < decoders->count; i++) {
+    enum column_decoder kind = decoders->kinds[i];
+    if (kind == DECODER_INTERN || kind == DECODER_INTERN_AUTO) found = 1;
+  }
+  if (!found) return;
+
+  if (NIL_P(ctx->intern_table)) ctx->intern_table = intern_table_new();
+  InternTable_t *table = intern_table(ctx->intern_table);
+  intern_table_columns_setup(table, decoders->count);
+  for (int i = 0; i < decoders->count; i++)
+    if (decoders->kinds[i] == DECODER_INTERN_AUTO && table->misses[i] >= INTERN_AUTO_MAX_MISSES)
+      decoders->kinds[i] = DECODER_NONE;
+  decoders->intern_table = ctx->intern_table;
+}
+
+VALUE decode_raw_value(enum column_decoder kind, int json_flags, struct raw_value *v) {
+  VALUE value = Qundef;
+
+  if (v->type == SQLITE_NULL) return Qnil;
+  if (kind == DECODER_JSON) {
+    switch (v->type) {
+      case SQLITE_TEXT:
+        value = json_decode_text(v->ptr, v->len, json_flags);
+        break;
+      case SQLITE_BLOB:
+        value = json_decode_jsonb(v->ptr, v->len, json_flags);
+        break;
+    }
+    return (value != Qundef) ? value : raw_value_to_ruby(v);
+  }
+  if (v->type == SQLITE_BLOB) return raw_value_to_ruby(v);
+
+  switch (kind) {
+    case DECODER_DATE:
+      if (v->type == SQLITE_TEXT) {
+        value = decode_date(v->ptr, v->len);
+        if (!NIL_P(value)) return value;
+      }
+      else {
+        // numeric values are treated as julian day numbers
+        VALUE jd = LL2NUM((long long)floor(raw_value_double(v) + 0.5));
+        return rb_funcallv(date_class(), ID_jd, 1, &jd);
+      }
+      break;
+    case DECODER_TIME:
+      switch (v->type) {
+        case SQLITE_TEXT:
+          value = decode_time(v->ptr, v->len);
+          if (!NIL_P(value)) return value;
+          break;
+        case SQLITE_INTEGER:
+          // integer values are treated as Unix timestamps
+          return time_utc_new((time_t)v->i, 0);
+        case SQLITE_FLOAT:
+          // real values are treated as julian day numbers
+          return decode_julian_day_time(v->d);
+      }
+      break;
+    case DECODER_BOOLEAN:
+      switch (v->type) {
+        case SQLITE_INTEGER:
+          return v->i ? Qtrue : Qfalse;
+        case SQLITE_FLOAT:
+          return v->d != 0.0 ? Qtrue : Qfalse;
+        default:
+          value = decode_boolean_text(v->ptr, v->len);
+          if (value != Qundef) return value;
+      }
+      break;
+    case DECODER_DECIMAL:
+      return decode_decimal(v);
+    default:
+      break;
+  }
+  return raw_value_to_ruby(v);
+}
+
+VALUE decode_column_value(struct column_decoders *decoders, sqlite3_stmt *stmt, int col) {
+  int type = sqlite3_column_type(stmt, col);
+  enum column_decoder kind = decoders->kinds[col];
+  if (kind == DECODER_NONE || type == SQLITE_NULL) return get_column_value(stmt, col, type);
+  if (kind == DECODER_INTERN || kind == DECODER_INTERN_AUTO) {
+    if (type != SQLITE_TEXT) return get_column_value(stmt, col, type);
+    return intern_text_value(decoders->intern_table, decoders->kinds, col,
+      (const char *)sqlite3_column_text(stmt, col), sqlite3_column_bytes(stmt, col));
+  }
+
+  struct raw_value v;
+  raw_value_read(stmt, col, type, &v);
+  return decode_raw_value(kind, decoders->json_flags, &v);
+}
+
+/* Returns true if values are converted according to the declared column type.
+ *
+ * @return [bool] whether column types are decoded
+ */
+VALUE Database_decode_types_get(VALUE self) {
+  Database_t *db = self_to_database(self);
+  return db->decode_types ? Qtrue : Qfalse;
+}
+
+/* Enables or disables conversion of values according to the declared type of
+ * the result columns. When enabled, values are converted as follows:
+ *
+ * - `date`: `Date` (from ISO 8601 text or a julian day number).
+ * - `datetime`, `timestamp`: `Time` (from ISO 8601 text, a Unix timestamp
+ *   integer or a julian day number). Numeric values and text values without a
+ *   UTC offset are returned in UTC.
+ * - `bool`, `boolean`, `bit`: `true` or `false` (from a number, or from one of
+ *   `1`/`t`/`true`/`y`/`yes`/`on` or `0`/`f`/`false`/`n`/`no`/`off`, in any
+ *   case).
+ * - `decimal`, `numeric`, `money`: `BigDecimal`.
+ *
+ * Values that cannot be converted, and values of columns with any other
+ * declared type (or no declared type at all, such as expressions), are
+ * returned as is.
+ *
+ *     db.decode_types = true
+ *     db.execute('create table events (at datetime, done boolean)')
+ *     db.execute('insert into events values (?, ?)', '2024-05-01 10:00:00', 1)
+ *     db.query_single('select * from events')
+ *     #=> { at: 2024-05-01 10:00:00 UTC, done: true }
+ *
+ * @param value [bool] whether to decode column types
+ * @return [bool] whether column types are decoded
+ */
+VALUE Database_decode_types_set(VALUE self, VALUE value) {
+  Database_t *db = self_to_database(self);
+  db->decode_types = RTEST(value);
+  return value;
+}
+
+static ID ID_freeze;
+static ID ID_symbolize_names;
+
+/* call-seq:
+ *   db.decode_json(columns = true, symbolize_names: false, freeze: false) -> db
+ *
+ * Enables or disables decoding of JSON column values into Ruby objects. JSON
+ * values are decoded for columns with a `json` or `jsonb` declared type, and
+ * for any result columns with the given names. JSON text is parsed natively,
+ * and JSONB values (SQLite's binary JSON format, stored as blobs) are decoded
+ * directly without being converted to text.
+ *
+ * Values that are not valid JSON (or JSONB) are returned as is.
+ *
+ *     db.decode_json([:doc], symbolize_names: true)
+ *     db.query_single_splat("select json_object('a', 1) as doc")
+ *     #=> { a: 1 }
+ *
+ * @param columns [true, false, Array<String, Symbol>] columns to decode (true
+ *   for declared types only, false to disable JSON decoding)
+ * @param symbolize_names [bool] whether to convert object keys to symbols
+ * @param freeze [bool] whether to return frozen (deduplicated) strings, arrays
+ *   and hashes
+ * @return [Extralite::Database] database
+ */
+VALUE Database_decode_json(int argc, VALUE *argv, VALUE self) {
+  Database_t *db = self_to_database(self);
+  VALUE columns;
+  VALUE opts;
+  if (!rb_scan_args(argc, argv, "01:", &columns, &opts)) columns = Qtrue;
+
+  int flags = 0;
+  if (!NIL_P(opts)) {
+    ID keys[] = { ID_symbolize_names, ID_freeze };
+    VALUE values[2];
+    rb_get_kwargs(opts, keys, 0, 2, values);
+    if (values[0] != Qundef && RTEST(values[0])) flags |= JSON_SYMBOLIZE_NAMES;
+    if (values[1] != Qundef && RTEST(values[1])) flags |= JSON_FREEZE;
+  }
+
+  VALUE names = Qnil;
+  if (TYPE(columns) == T_ARRAY) {
+    names = rb_ary_new_capa(RARRAY_LEN(columns));
+    for (long i = 0; i < RARRAY_LEN(columns); i++) {
+      VALUE name = RARRAY_AREF(columns, i);
+      if (SYMBOL_P(name)) name = rb_sym2str(name);
+      rb_ary_push(names, rb_str_new_frozen(StringValue(name)));
+    }
+    rb_obj_freeze(names);
+  }
+  else if (columns != Qtrue && RTEST(columns))
+    rb_raise(rb_eArgError, "Expected true, false or an array of column names");
+
+  db->decode_json = RTEST(columns);
+  db->json_flags = flags;
+  RB_OBJ_WRITE(self, &db->json_columns, names);
+  return self;
+}
+
+static VALUE SYM_auto;
+
+/* Returns the string interning setting.
+ *
+ * @return [:auto, Array<Symbol>, false] interning setting
+ */
+VALUE Database_intern_get(VALUE self) {
+  Database_t *db = self_to_database(self);
+  switch (db->intern) {
+    case INTERN_AUTO:
+      return SYM_auto;
+    case INTERN_COLUMNS: {
+      long len = RARRAY_LEN(db->intern_columns);
+      VALUE columns = rb_ary_new_capa(len);
+      for (long i = 0; i < len; i++)
+        rb_ary_push(columns, rb_str_intern(RARRAY_AREF(db->intern_columns, i)));
+      return columns;
+    }
+    default:
+      return Qfalse;
+  }
+}
+
+/* Sets the string interning setting. When enabled, text values of the selected
+ * columns are returned as frozen, deduplicated strings. Repeated values are
+ * looked up in a small table kept for the duration of each query (or across
+ * executions of a prepared query), so that low-cardinality columns (statuses,
+ * country codes, tags) produce a single string object per distinct value
+ * rather than a new string per row.
+ *
+ * Interning can be enabled for columns selected by name, or for all columns
+ * using `:auto`. In auto mode, only values up to 64 bytes long are interned,
+ * and interning is turned off for any column that keeps producing new values.
+ * Columns that are decoded according to their declared type or
+ * as JSON are not interned.
+ *
+ *     db.intern = [:status, :country]
+ *     a, b = db.query_splat("select status from orders where status = 'shipped'")
+ *     a.frozen? #=> true
+ *     a.equal?(b) #=> true
+ *
+ * @param value [:auto, Array<String, Symbol>, false, nil] columns to intern
+ * @return [:auto, Array<String, Symbol>, false, nil] columns to intern
+ */
+VALUE Database_intern_set(VALUE self, VALUE value) {
+  Database_t *db = self_to_database(self);
+  VALUE names = Qnil;
+  int mode = INTERN_NONE;
+
+  if (value == SYM_auto)
+    mode = INTERN_AUTO;
+  else if (TYPE(value) == T_ARRAY) {
+    names = rb_ary_new_capa(RARRAY_LEN(value));
+    for (long i = 0; i < RARRAY_LEN(value); i++) {
+      VALUE name = RARRAY_AREF(value, i);
+      if (SYMBOL_P(name)) name = rb_sym2str(name);
+      rb_ary_push(names, rb_str_new_frozen(StringValue(name)));
+    }
+    rb_obj_freeze(names);
+    mode = INTERN_COLUMNS;
+  }
+  else if (RTEST(value))
+    rb_raise(rb_eArgError, "Expected :auto, false or an array of column names");
+
+  db->intern = mode;
+  RB_OBJ_WRITE(self, &db->intern_columns, names);
+  return value;
+}
+
+void Init_ExtraliteDecoders(void) {
+  rb_define_method(cDatabase, "decode_json",    Database_decode_json, -1);
+  rb_define_method(cDatabase, "decode_types",   Database_decode_types_get, 0);
+  rb_define_method(cDatabase, "decode_types=",  Database_decode_types_set, 1);
+  rb_define_method(cDatabase, "intern",         Database_intern_get, 0);
+  rb_define_method(cDatabase, "intern=",        Database_intern_set, 1);
+
+  SYM_auto = ID2SYM(rb_intern("auto"));
+  rb_gc_register_mark_object(SYM_auto);
+
+  ID_freeze           = rb_intern("freeze");
+  ID_symbolize_names  = rb_intern("symbolize_names");
+
+  ID_BigDecimal = rb_intern("BigDecimal");
+  ID_jd         = rb_intern("jd");
+
+  decimal_kw = rb_hash_new();
+  rb_hash_aset(decimal_kw, ID2SYM(rb_intern("exception")), Qfalse);
+  rb_obj_freeze(decimal_kw);
+  rb_gc_register_mark_object(decimal_kw);
+}
@@ -9,14 +9,19 @@ $CFLAGS << ' -Wno-unused-function'
 # enable the session extension
 $defs << '-DSQLITE_ENABLE_SESSION'
 $defs << '-DSQLITE_ENABLE_PREUPDATE_HOOK'
+$defs << '-DSQLITE_ENABLE_STMT_SCANSTATUS'
 $defs << '-DEXTRALITE_ENABLE_CHANGESET'
 
 $defs << '-DHAVE_SQLITE3_ENABLE_LOAD_EXTENSION'
 $defs << '-DHAVE_SQLITE3_LOAD_EXTENSION'
 $defs << '-DHAVE_SQLITE3_PREPARE_V2'
 $defs << '-DHAVE_SQLITE3_ERROR_OFFSET'
+$defs << '-DHAVE_SQLITE3_HARD_HEAP_LIMIT64'
+$defs << '-DHAVE_SQLITE3_STMT_SCANSTATUS'
+$defs << '-DHAVE_SQLITE3_SERIALIZE'
 $defs << '-DHAVE_SQLITE3SESSION_CHANGESET'
 
 have_func('usleep')
+have_func('rb_hash_new_capa', 'ruby.h')
 dir_config('extralite_ext')
 create_makefile('extralite_ext')
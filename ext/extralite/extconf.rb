@@ -81,7 +81,11 @@ else
   have_func('sqlite3_load_extension')
   have_func('sqlite3_prepare_v2')
   have_func('sqlite3_error_offset')
+  have_func('sqlite3_hard_heap_limit64')
+  have_func('sqlite3_stmt_scanstatus')
+  have_func('sqlite3_serialize')
   have_func('sqlite3session_changeset')
+  have_func('rb_hash_new_capa', 'ruby.h')
 
   if have_type('sqlite3_session', 'sqlite.h')
     $defs << '-DEXTRALITE_ENABLE_CHANGESET'
@@ -4,6 +4,7 @@
 #include "ruby.h"
 #include "ruby/thread.h"
 #include "ruby/encoding.h"
+#include <time.h>
 
 #ifdef EXTRALITE_NO_BUNDLE
 #include <sqlite3.h>
@@ -26,7 +27,11 @@ extern VALUE cDatabase;
 extern VALUE cQuery;
 extern VALUE cIterator;
 extern VALUE cChangeset;
+extern VALUE cChangeGroup;
 extern VALUE cBlob;
+extern VALUE cBlobIO;
+extern VALUE cRow;
+extern VALUE cSnapshot;
 
 extern VALUE cError;
 extern VALUE cSQLError;
@@ -36,14 +41,21 @@ extern VALUE cParameterError;
 
 extern ID ID_call;
 extern ID ID_each;
+extern ID ID_join;
 extern ID ID_keys;
 extern ID ID_new;
 extern ID ID_strip;
 extern ID ID_to_s;
 extern ID ID_track;
 
+extern VALUE SYM_full;
+extern VALUE SYM_passive;
+extern VALUE SYM_restart;
+extern VALUE SYM_truncate;
 extern VALUE SYM_splat;
 extern VALUE SYM_array;
+extern VALUE SYM_object;
+extern VALUE SYM_lazy;
 extern VALUE SYM_hash;
 
 enum progress_handler_mode {
@@ -62,18 +74,65 @@ struct progress_handler {
   int                         call_count;
 };
 
-typedef struct {
+enum query_mode {
+  QUERY_HASH,
+  QUERY_SPLAT,
+  QUERY_ARRAY,
+  QUERY_OBJECT,
+  QUERY_LAZY
+};
+
+// index of execute queries in the query counters, following the query modes
+#define METRICS_QUERY_EXECUTE (QUERY_LAZY + 1)
+#define METRICS_QUERY_KINDS   (QUERY_LAZY + 2)
+
+struct database_metrics {
+  unsigned long long  queries[METRICS_QUERY_KINDS];
+  unsigned long long  rows;
+  unsigned long long  gvl_releases;
+  unsigned long long  busy_errors;
+};
+
+typedef struct Database_t {
   sqlite3                 *sqlite3_db;
   VALUE                   trace_proc;
   int                     gvl_release_threshold;
   struct progress_handler progress_handler;
-} Database_t;
+  struct database_metrics metrics;
 
-enum query_mode {
-  QUERY_HASH,
-  QUERY_SPLAT,
-  QUERY_ARRAY
-};
+  // list of open databases, used for releasing memory on GC
+  struct Database_t       *prev_open;
+  struct Database_t       *next_open;
+
+  // sequence number assigned when the database is opened, used for labeling
+  // metrics of databases without a file
+  unsigned long long      id;
+
+  // sampling profiler state (see profiler.c)
+  struct profiler_db_state *profiler;
+
+  // change data capture state (see changeset.c)
+  struct cdc_state        *cdc;
+
+  // database image used without copying by Database.deserialize
+  VALUE                   image;
+
+  // background WAL checkpointer state (see checkpoint.c)
+  struct checkpoint_state *checkpoint;
+
+  // whether values are decoded according to declared column types (see
+  // decoders.c)
+  int                     decode_types;
+
+  // JSON decoding settings (see decoders.c)
+  int                     decode_json;
+  int                     json_flags;
+  VALUE                   json_columns;
+
+  // string interning settings (see decoders.c)
+  int                     intern;
+  VALUE                   intern_columns;
+} Database_t;
 
 typedef struct {
   VALUE               db;
@@ -85,6 +144,15 @@ typedef struct {
   int                 eof;
   int                 closed;
   enum query_mode     query_mode;
+
+  // strings bound with SQLITE_STATIC, kept alive until rebound
+  VALUE               pins;
+
+  // Struct or Data class used for rows in object mode
+  VALUE               row_class;
+
+  // interned strings and per-column miss counts (see decoders.c)
+  VALUE               intern_table;
 } Query_t;
 
 typedef struct {
@@ -92,10 +160,46 @@ typedef struct {
 } Iterator_t;
 
 #ifdef EXTRALITE_ENABLE_CHANGESET
+struct changeset_apply_stats {
+  long long       applied;
+  long long       conflicts;
+  long long       replaced;
+  long long       omitted;
+};
+
 typedef struct {
   int             changeset_len;
   void            *changeset_ptr;
+  int             patchset;
+  struct changeset_apply_stats apply_stats;
+
+  // number of operations using the changeset buffer, during which the
+  // changeset cannot be modified
+  int             busy;
 } Changeset_t;
+
+struct cdc_state {
+  sqlite3_session *session;
+  VALUE           target;
+  VALUE           tables;
+  int             flush_every;
+  int             patchset;
+  int             pending_commits;
+};
+
+void cdc_flush(Database_t *db);
+void cdc_free(Database_t *db);
+
+// Flushes captured changes once the configured number of commits is reached.
+// Called after a statement is done, finalized or reset, and after a changeset
+// is applied, as changesets cannot be generated from within the commit hook.
+// Nothing is flushed while a transaction is open, since the session would
+// then also hold its uncommitted changes.
+#define CDC_FLUSH_PENDING(db) \
+  if ((db)->cdc && (db)->cdc->pending_commits >= (db)->cdc->flush_every && \
+      sqlite3_get_autocommit((db)->sqlite3_db)) cdc_flush(db)
+#else
+#define CDC_FLUSH_PENDING(db)
 #endif
 
 enum row_mode {
@@ -121,6 +225,15 @@ typedef struct {
 
   int                 eof;
   int                 step_count;
+
+  // strings bound with SQLITE_STATIC (see bind_parameter_value)
+  VALUE               pins;
+
+  // Struct or Data class used for rows in object mode
+  VALUE               row_class;
+
+  // table of interned strings, kept by prepared queries (see decoders.c)
+  VALUE               intern_table;
 } query_ctx;
 
 enum gvl_mode {
@@ -145,15 +258,146 @@ enum gvl_mode {
   row_mode, \
   max_rows, \
   0, \
-  0 \
+  0, \
+  Qnil, \
+  Qnil, \
+  Qnil \
 }
 
 #define DEFAULT_GVL_RELEASE_THRESHOLD 1000
 #define DEFAULT_PROGRESS_HANDLER_PERIOD 1000
 #define DEFAULT_PROGRESS_HANDLER_TICK 10
+#define PROFILER_TICK 100
 
 extern rb_encoding *UTF8_ENCODING;
 
+VALUE utf8_str_new(const char *ptr, long len);
+
+static inline VALUE get_column_value(sqlite3_stmt *stmt, int col, int type) {
+  switch (type) {
+    case SQLITE_NULL:
+      return Qnil;
+    case SQLITE_INTEGER:
+      return LL2NUM(sqlite3_column_int64(stmt, col));
+    case SQLITE_FLOAT:
+      return DBL2NUM(sqlite3_column_double(stmt, col));
+    case SQLITE_TEXT:
+      return utf8_str_new((char *)sqlite3_column_text(stmt, col), (long)sqlite3_column_bytes(stmt, col));
+    case SQLITE_BLOB:
+      return rb_str_new((const char *)sqlite3_column_blob(stmt, col), (long)sqlite3_column_bytes(stmt, col));
+    default:
+      rb_raise(cError, "Unknown column type: %d", type);
+  }
+
+  return Qnil;
+}
+
+// A column value, either read from a statement or copied into a lazy row (see
+// row.c). Text and blob values point to the value bytes.
+struct raw_value {
+  int           type;
+  int           len;
+  union {
+    sqlite3_int64 i;
+    double        d;
+    const char    *ptr;
+  };
+};
+
+static inline void raw_value_read(sqlite3_stmt *stmt, int col, int type, struct raw_value *v) {
+  v->type = type;
+  v->len = 0;
+  switch (type) {
+    case SQLITE_INTEGER:
+      v->i = sqlite3_column_int64(stmt, col);
+      break;
+    case SQLITE_FLOAT:
+      v->d = sqlite3_column_double(stmt, col);
+      break;
+    case SQLITE_TEXT:
+      v->ptr = (const char *)sqlite3_column_text(stmt, col);
+      v->len = sqlite3_column_bytes(stmt, col);
+      break;
+    case SQLITE_BLOB:
+      v->ptr = (const char *)sqlite3_column_blob(stmt, col);
+      v->len = sqlite3_column_bytes(stmt, col);
+      break;
+  }
+}
+
+static inline VALUE raw_value_to_ruby(struct raw_value *v) {
+  switch (v->type) {
+    case SQLITE_NULL:
+      return Qnil;
+    case SQLITE_INTEGER:
+      return LL2NUM(v->i);
+    case SQLITE_FLOAT:
+      return DBL2NUM(v->d);
+    case SQLITE_TEXT:
+      return utf8_str_new(v->ptr, (long)v->len);
+    case SQLITE_BLOB:
+      return rb_str_new(v->ptr, (long)v->len);
+    default:
+      rb_raise(cError, "Unknown column type: %d", v->type);
+  }
+
+  return Qnil;
+}
+
+enum column_decoder {
+  DECODER_NONE = 0,
+  DECODER_DATE,
+  DECODER_TIME,
+  DECODER_BOOLEAN,
+  DECODER_DECIMAL,
+  DECODER_JSON,
+  DECODER_INTERN,
+  DECODER_INTERN_AUTO
+};
+
+enum intern_mode {
+  INTERN_NONE = 0,
+  INTERN_COLUMNS,
+  INTERN_AUTO
+};
+
+#define JSON_SYMBOLIZE_NAMES  1
+#define JSON_FREEZE           2
+
+#define MAX_EMBEDDED_DECODERS 32
+
+// per-execution table of column decoders (see decoders.c)
+struct column_decoders {
+  int                 count;
+  int                 json_flags;
+  VALUE               buffer;
+  unsigned char       *kinds;
+  unsigned char       embedded[MAX_EMBEDDED_DECODERS];
+
+  // table of interned strings, or Qnil if no column is interned
+  VALUE               intern_table;
+};
+
+struct column_decoders *column_decoders_setup(struct column_decoders *decoders, query_ctx *ctx, int column_count);
+VALUE decode_column_value(struct column_decoders *decoders, sqlite3_stmt *stmt, int col);
+VALUE decode_raw_value(enum column_decoder kind, int json_flags, struct raw_value *v);
+VALUE intern_table_new(void);
+VALUE intern_text_value(VALUE intern_table, unsigned char *kinds, int col, const char *ptr, long len);
+VALUE row_layout_new(sqlite3_stmt *stmt, int column_count, struct column_decoders *decoders);
+VALUE row_new(VALUE layout, sqlite3_stmt *stmt);
+VALUE json_decode_text(const char *ptr, long len, int flags);
+VALUE json_decode_jsonb(const char *ptr, long len, int flags);
+
+#define COLUMN_VALUE(stmt, col, decoders) ((decoders) ? \
+  decode_column_value(decoders, stmt, col) : \
+  get_column_value(stmt, col, sqlite3_column_type(stmt, col)))
+
+static inline unsigned long long monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 typedef VALUE (*safe_query_impl)(query_ctx *);
 
 VALUE safe_batch_execute(query_ctx *ctx);
@@ -168,6 +412,11 @@ VALUE safe_query_hash(query_ctx *ctx);
 VALUE safe_query_single_row_hash(query_ctx *ctx);
 VALUE safe_query_single_row_splat(query_ctx *ctx);
 VALUE safe_query_single_row_array(query_ctx *ctx);
+VALUE safe_query_object(query_ctx *ctx);
+VALUE safe_query_single_row_object(query_ctx *ctx);
+VALUE safe_query_lazy(query_ctx *ctx);
+VALUE safe_query_single_row_lazy(query_ctx *ctx);
+VALUE row_class_check(VALUE klass);
 
 VALUE Query_each(VALUE self);
 VALUE Query_next(int argc, VALUE *argv, VALUE self);
@@ -175,16 +424,33 @@ VALUE Query_to_a(VALUE self);
 
 void prepare_single_stmt(enum gvl_mode mode, sqlite3 *db, sqlite3_stmt **stmt, VALUE sql);
 void prepare_multi_stmt(enum gvl_mode mode, sqlite3 *db, sqlite3_stmt **stmt, VALUE sql);
-void bind_all_parameters(sqlite3_stmt *stmt, int argc, VALUE *argv);
-void bind_all_parameters_from_object(sqlite3_stmt *stmt, VALUE obj);
+void bind_all_parameters(sqlite3_stmt *stmt, int argc, VALUE *argv, VALUE *pins);
+void bind_all_parameters_from_object(sqlite3_stmt *stmt, VALUE obj, VALUE *pins);
+void clear_bindings(sqlite3_stmt *stmt, VALUE pins);
 int stmt_iterate(query_ctx *ctx);
 VALUE cleanup_stmt(query_ctx *ctx);
 
-void Database_issue_query(Database_t *db, VALUE sql);
+void Database_issue_query(Database_t *db, VALUE sql, int query_kind);
 sqlite3 *Database_sqlite3_db(VALUE self);
 enum gvl_mode Database_prepare_gvl_mode(Database_t *db);
 Database_t *self_to_database(VALUE self);
 
+extern Database_t *open_databases;
+int connection_open(const char *filename, sqlite3 **db, int flags);
+int connection_close(sqlite3 *db);
+void connection_release_handle(sqlite3 *db);
+void Database_install_progress_handler(Database_t *db);
+
+extern int profiler_active;
+void profiler_sample(Database_t *db);
+int profiler_progress_handler(void *ptr);
+void profiler_capture_caller(Database_t *db);
+void profiler_db_free(Database_t *db);
+
+int checkpoint_mode_symbol_to_int(VALUE mode);
+void checkpoint_mark(Database_t *db);
+void checkpoint_stop(Database_t *db, int join);
+
 void *gvl_call(enum gvl_mode mode, void *(*fn)(void *), void *data);
 
 #endif /* EXTRALITE_H */
@@ -3,6 +3,12 @@
 void Init_ExtraliteDatabase();
 void Init_ExtraliteQuery();
 void Init_ExtraliteIterator();
+void Init_ExtraliteProfiler();
+void Init_ExtraliteCheckpoint();
+void Init_ExtraliteSnapshot();
+void Init_ExtraliteBlobIO();
+void Init_ExtraliteDecoders();
+void Init_ExtraliteRow();
 #ifdef EXTRALITE_ENABLE_CHANGESET
 void Init_ExtraliteChangeset();
 #endif
@@ -13,6 +19,12 @@ void Init_extralite_ext(void) {
   Init_ExtraliteDatabase();
   Init_ExtraliteQuery();
   Init_ExtraliteIterator();
+  Init_ExtraliteProfiler();
+  Init_ExtraliteCheckpoint();
+  Init_ExtraliteSnapshot();
+  Init_ExtraliteBlobIO();
+  Init_ExtraliteDecoders();
+  Init_ExtraliteRow();
 #ifdef EXTRALITE_ENABLE_CHANGESET
   Init_ExtraliteChangeset();
 #endif
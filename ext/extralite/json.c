@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "extralite.h"
+
+/*
+ * JSON decoding of column values into Ruby objects. JSON text is parsed
+ * according to RFC 8259. JSONB values are decoded by walking SQLite's binary
+ * JSON format (https://sqlite.org/jsonb.html) directly, without converting it
+ * to text first.
+ *
+ * All decoding functions return Qundef if the given value is malformed.
+ */
+
+#define JSON_MAX_DEPTH 1000
+
+struct json_parser {
+  const char  *ptr;
+  const char  *end;
+  int         flags;
+  int         depth;
+};
+
+static inline VALUE json_string(const char *ptr, long len, int flags) {
+  if (flags & JSON_FREEZE)
+    return rb_enc_interned_str(ptr, len, UTF8_ENCODING);
+  return rb_enc_str_new(ptr, len, UTF8_ENCODING);
+}
+
+static inline VALUE json_key(VALUE str, int flags) {
+  if (flags & JSON_SYMBOLIZE_NAMES)
+    return rb_str_intern(str);
+  // hash string keys are frozen anyway, deduplicate them
+  return rb_str_to_interned_str(str);
+}
+
+static inline VALUE json_container_done(VALUE obj, int flags) {
+  if (flags & JSON_FREEZE) rb_obj_freeze(obj);
+  return obj;
+}
+
+// Returns a NUL-terminated copy of the given number text, using the given
+// buffer if large enough, or a temporary string otherwise.
+static inline const char *number_cstr(const char *ptr, long len, char *buf, size_t buf_size, VALUE *tmp) {
+  if ((size_t)len < buf_size) {
+    memcpy(buf, ptr, len);
+    buf[len] = 0;
+    return buf;
+  }
+  *tmp = rb_str_new(ptr, len);
+  return RSTRING_PTR(*tmp);
+}
+
+static inline int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static inline int parse_hex(const char *ptr, const char *end, int count, uint32_t *value) {
+  if (end - ptr < count) return 0;
+  uint32_t v = 0;
+  for (int i = 0; i < count; i++) {
+    int h = hex_value(ptr[i]);
+    if (h < 0) return 0;
+    v = (v << 4) | h;
+  }
+  *value = v;
+  return 1;
+}
+
+static inline char *utf8_encode(char *out, uint32_t cp) {
+  if (cp < 0x80)
+    *out++ = cp;
+  else if (cp < 0x800) {
+    *out++ = 0xC0 | (cp >> 6);
+    *out++ = 0x80 | (cp & 0x3F);
+  }
+  else if (cp < 0x10000) {
+    *out++ = 0xE0 | (cp >> 12);
+    *out++ = 0x80 | ((cp >> 6) & 0x3F);
+    *out++ = 0x80 | (cp & 0x3F);
+  }
+  else {
+    *out++ = 0xF0 | (cp >> 18);
+    *out++ = 0x80 | ((cp >> 12) & 0x3F);
+    *out++ = 0x80 | ((cp >> 6) & 0x3F);
+    *out++ = 0x80 | (cp & 0x3F);
+  }
+  return out;
+}
+
+// Unescapes the given string contents into a new Ruby string. If json5 is
+// true, the additional escapes allowed by JSON5 are also accepted.
+static VALUE json_unescape(const char *ptr, const char *end, int flags, int json5) {
+  VALUE str = rb_enc_str_new(NULL, end - ptr, UTF8_ENCODING);
+  char *out = RSTRING_PTR(str);
+  char *start = out;
+
+  while (ptr < end) {
+    if (*ptr != '\\') {
+      *out++ = *ptr++;
+      continue;
+    }
+    if (++ptr == end) return Qundef;
+
+    uint32_t cp;
+    char c = *ptr++;
+    switch (c) {
+      case '"': case '\\': case '/':
+        *out++ = c;
+        break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'u':
+        if (!parse_hex(ptr, end, 4, &cp)) return Qundef;
+        ptr += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          uint32_t low;
+          if (end - ptr >= 6 && ptr[0] == '\\' && ptr[1] == 'u' &&
+              parse_hex(ptr + 2, end, 4, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            ptr += 6;
+          }
+          else
+            cp = 0xFFFD;
+        }
+        else if (cp >= 0xDC00 && cp <= 0xDFFF)
+          cp = 0xFFFD;
+        out = utf8_encode(out, cp);
+        break;
+      default:
+        if (!json5) return Qundef;
+        switch (c) {
+          case '\'': *out++ = '\''; break;
+          case 'v': *out++ = '\v'; break;
+          case '0': *out++ = '\0'; break;
+          case 'x':
+            if (!parse_hex(ptr, end, 2, &cp)) return Qundef;
+            ptr += 2;
+            out = utf8_encode(out, cp);
+            break;
+          case '\r':
+            // line continuation
+            if (ptr < end && *ptr == '\n') ptr++;
+            break;
+          case '\n':
+            break;
+          default:
+            return Qundef;
+        }
+    }
+  }
+
+  rb_str_set_len(str, out - start);
+  if (flags & JSON_FREEZE) str = rb_str_to_interned_str(str);
+  return str;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON text
+
+static VALUE json_parse_value(struct json_parser *parser);
+
+static inline void json_skip_ws(struct json_parser *parser) {
+  while (parser->ptr < parser->end) {
+    switch (*parser->ptr) {
+      case ' ': case '\t': case '\n': case '\r':
+        parser->ptr++;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+static inline int json_match(struct json_parser *parser, const char *literal, int len) {
+  if (parser->end - parser->ptr < len || memcmp(parser->ptr, literal, len)) return 0;
+  parser->ptr += len;
+  return 1;
+}
+
+static VALUE json_parse_string(struct json_parser *parser) {
+  const char *start = ++parser->ptr;
+  int escaped = 0;
+
+  while (parser->ptr < parser->end) {
+    unsigned char c = *parser->ptr;
+    if (c == '"') {
+      const char *end = parser->ptr++;
+      return escaped ?
+        json_unescape(start, end, parser->flags, 0) :
+        json_string(start, end - start, parser->flags);
+    }
+    if (c < 0x20) return Qundef;
+    if (c == '\\') {
+      escaped = 1;
+      parser->ptr++;
+    }
+    parser->ptr++;
+  }
+  return Qundef;
+}
+
+// Maximum number of digits guaranteed to fit in a long long
+#define JSON_MAX_INT_DIGITS 18
+
+static VALUE json_parse_number(struct json_parser *parser) {
+  const char *start = parser->ptr;
+  const char *p = start;
+  int is_float = 0;
+
+  if (p < parser->end && *p == '-') p++;
+  if (p == parser->end) return Qundef;
+  if (*p == '0')
+    p++;
+  else if (*p >= '1' && *p <= '9')
+    while (p < parser->end && *p >= '0' && *p <= '9') p++;
+  else
+    return Qundef;
+
+  if (p < parser->end && *p == '.') {
+    is_float = 1;
+    if (++p == parser->end || *p < '0' || *p > '9') return Qundef;
+    while (p < parser->end && *p >= '0' && *p <= '9') p++;
+  }
+  if (p < parser->end && (*p == 'e' || *p == 'E')) {
+    is_float = 1;
+    if (++p < parser->end && (*p == '+' || *p == '-')) p++;
+    if (p == parser->end || *p < '0' || *p > '9') return Qundef;
+    while (p < parser->end && *p >= '0' && *p <= '9') p++;
+  }
+  parser->ptr = p;
+
+  long len = p - start;
+  if (!is_float && len - (*start == '-') <= JSON_MAX_INT_DIGITS) {
+    long long v = 0;
+    for (const char *d = start + (*start == '-'); d < p; d++) v = v * 10 + (*d - '0');
+    return LL2NUM(*start == '-' ? -v : v);
+  }
+
+  VALUE tmp = Qnil;
+  char buf[64];
+  const char *str = number_cstr(start, len, buf, sizeof(buf), &tmp);
+  VALUE value = is_float ? DBL2NUM(strtod(str, NULL)) : rb_cstr2inum(str, 10);
+  RB_GC_GUARD(tmp);
+  return value;
+}
+
+static VALUE json_parse_array(struct json_parser *parser) {
+  VALUE array = rb_ary_new();
+  parser->ptr++;
+  json_skip_ws(parser);
+  if (parser->ptr < parser->end && *parser->ptr == ']') {
+    parser->ptr++;
+    return json_container_done(array, parser->flags);
+  }
+
+  while (1) {
+    VALUE value = json_parse_value(parser);
+    if (value == Qundef) return Qundef;
+    rb_ary_push(array, value);
+
+    json_skip_ws(parser);
+    if (parser->ptr == parser->end) return Qundef;
+    if (*parser->ptr == ']') {
+      parser->ptr++;
+      return json_container_done(array, parser->flags);
+    }
+    if (*parser->ptr++ != ',') return Qundef;
+  }
+}
+
+static VALUE json_parse_object(struct json_parser *parser) {
+  VALUE hash = rb_hash_new();
+  parser->ptr++;
+  json_skip_ws(parser);
+  if (parser->ptr < parser->end && *parser->ptr == '}') {
+    parser->ptr++;
+    return json_container_done(hash, parser->flags);
+  }
+
+  while (1) {
+    json_skip_ws(parser);
+    if (parser->ptr == parser->end || *parser->ptr != '"') return Qundef;
+    VALUE key = json_parse_string(parser);
+    if (key == Qundef) return Qundef;
+
+    json_skip_ws(parser);
+    if (parser->ptr == parser->end || *parser->ptr++ != ':') return Qundef;
+    VALUE value = json_parse_value(parser);
+    if (value == Qundef) return Qundef;
+    rb_hash_aset(hash, json_key(key, parser->flags), value);
+
+    json_skip_ws(parser);
+    if (parser->ptr == parser->end) return Qundef;
+    if (*parser->ptr == '}') {
+      parser->ptr++;
+      return json_container_done(hash, parser->flags);
+    }
+    if (*parser->ptr++ != ',') return Qundef;
+  }
+}
+
+static VALUE json_parse_value(struct json_parser *parser) {
+  json_skip_ws(parser);
+  if (parser->ptr == parser->end) return Qundef;
+
+  VALUE value;
+  switch (*parser->ptr) {
+    case '{':
+    case '[':
+      if (++parser->depth > JSON_MAX_DEPTH) return Qundef;
+      value = (*parser->ptr == '{') ? json_parse_object(parser) : json_parse_array(parser);
+      parser->depth--;
+      return value;
+    case '"':
+      return json_parse_string(parser);
+    case 't':
+      return json_match(parser, "true", 4) ? Qtrue : Qundef;
+    case 'f':
+      return json_match(parser, "false", 5) ? Qfalse : Qundef;
+    case 'n':
+      return json_match(parser, "null", 4) ? Qnil : Qundef;
+    default:
+      return json_parse_number(parser);
+  }
+}
+
+VALUE json_decode_text(const char *ptr, long len, int flags) {
+  struct json_parser parser = { ptr, ptr + len, flags, 0 };
+  VALUE value = json_parse_value(&parser);
+  if (value == Qundef) return Qundef;
+
+  json_skip_ws(&parser);
+  return (parser.ptr == parser.end) ? value : Qundef;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSONB
+
+enum jsonb_type {
+  JSONB_NULL    = 0,
+  JSONB_TRUE    = 1,
+  JSONB_FALSE   = 2,
+  JSONB_INT     = 3,
+  JSONB_INT5    = 4,
+  JSONB_FLOAT   = 5,
+  JSONB_FLOAT5  = 6,
+  JSONB_TEXT    = 7,
+  JSONB_TEXTJ   = 8,
+  JSONB_TEXT5   = 9,
+  JSONB_TEXTRAW = 10,
+  JSONB_ARRAY   = 11,
+  JSONB_OBJECT  = 12
+};
+
+// Reads the element header at the parser's position, returning the element
+// type and setting the payload size. Returns -1 if the header is malformed.
+static inline int jsonb_header(struct json_parser *parser, uint64_t *size) {
+  const unsigned char *p = (const unsigned char *)parser->ptr;
+  if (parser->ptr >= parser->end) return -1;
+
+  int type = p[0] & 0x0F;
+  int size_bytes;
+  switch (p[0] >> 4) {
+    case 12: size_bytes = 1; break;
+    case 13: size_bytes = 2; break;
+    case 14: size_bytes = 4; break;
+    case 15: size_bytes = 8; break;
+    default:
+      *size = p[0] >> 4;
+      size_bytes = 0;
+  }
+  if (parser->end - parser->ptr < 1 + size_bytes) return -1;
+  if (size_bytes) {
+    *size = 0;
+    for (int i = 1; i <= size_bytes; i++) *size = (*size << 8) | p[i];
+  }
+  parser->ptr += 1 + size_bytes;
+  if ((uint64_t)(parser->end - parser->ptr) < *size) return -1;
+  return type;
+}
+
+static VALUE jsonb_number(const char *ptr, uint64_t size, int is_float) {
+  if (size == 0) return Qundef;
+
+  VALUE tmp = Qnil;
+  char buf[64];
+  const char *str = number_cstr(ptr, size, buf, sizeof(buf), &tmp);
+  if (is_float) return DBL2NUM(strtod(str, NULL));
+
+  // JSON5 integers may be hexadecimal
+  const char *digits = (*str == '-' || *str == '+') ? str + 1 : str;
+  int base = (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) ? 16 : 10;
+  VALUE value = rb_cstr2inum(str, base);
+  RB_GC_GUARD(tmp);
+  return value;
+}
+
+static VALUE jsonb_parse_value(struct json_parser *parser) {
+  uint64_t size = 0;
+  int type = jsonb_header(parser, &size);
+  if (type < 0) return Qundef;
+
+  const char *payload = parser->ptr;
+  parser->ptr += size;
+
+  switch (type) {
+    case JSONB_NULL:
+      return Qnil;
+    case JSONB_TRUE:
+      return Qtrue;
+    case JSONB_FALSE:
+      return Qfalse;
+    case JSONB_INT:
+    case JSONB_INT5:
+      return jsonb_number(payload, size, 0);
+    case JSONB_FLOAT:
+    case JSONB_FLOAT5:
+      return jsonb_number(payload, size, 1);
+    case JSONB_TEXT:
+    case JSONB_TEXTRAW:
+      return json_string(payload, size, parser->flags);
+    case JSONB_TEXTJ:
+    case JSONB_TEXT5:
+      return json_unescape(payload, payload + size, parser->flags, type == JSONB_TEXT5);
+    case JSONB_ARRAY:
+    case JSONB_OBJECT:
+      {
+        if (++parser->depth > JSON_MAX_DEPTH) return Qundef;
+        const char *end = parser->end;
+        parser->end = parser->ptr;
+        parser->ptr = payload;
+
+        VALUE container = (type == JSONB_ARRAY) ? rb_ary_new() : rb_hash_new();
+        while (parser->ptr < parser->end) {
+          VALUE value = jsonb_parse_value(parser);
+          if (value == Qundef) return Qundef;
+          if (type == JSONB_ARRAY)
+            rb_ary_push(container, value);
+          else {
+            if (TYPE(value) != T_STRING || parser->ptr == parser->end) return Qundef;
+            VALUE key = value;
+            value = jsonb_parse_value(parser);
+            if (value == Qundef) return Qundef;
+            rb_hash_aset(container, json_key(key, parser->flags), value);
+          }
+        }
+        parser->end = end;
+        parser->depth--;
+        return json_container_done(container, parser->flags);
+      }
+    default:
+      return Qundef;
+  }
+}
+
+VALUE json_decode_jsonb(const char *ptr, long len, int flags) {
+  struct json_parser parser = { ptr, ptr + len, flags, 0 };
+  VALUE value = jsonb_parse_value(&parser);
+  return (parser.ptr == parser.end) ? value : Qundef;
+}
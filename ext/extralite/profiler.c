@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+#include "extralite.h"
+#include "ruby/debug.h"
+#include "ruby/thread_native.h"
+
+/*
+ * Document-module: Extralite::Profiler
+ *
+ * This module implements a sampling profiler for SQLite queries. While the
+ * profiler is running, a progress handler is installed on all open databases
+ * (and any database opened subsequently), which periodically samples the
+ * statement currently being executed and the query plan loop it is in. Samples
+ * are collapsed into stacks made of the Ruby caller that issued the query, the
+ * SQL text and the query plan node, in the format used by flamegraph tools:
+ *
+ *     Extralite::Profiler.start(interval_us: 500)
+ *     run_some_queries
+ *     File.write('queries.folded', Extralite::Profiler.stop)
+ *
+ *     # flamegraph.pl queries.folded > queries.svg
+ */
+
+#define PROFILER_DEFAULT_INTERVAL_US  1000
+#define PROFILER_INITIAL_CAPACITY     256
+#define PROFILER_CALLER_MAX           256
+#define PROFILER_SQL_MAX              256
+#define PROFILER_NODE_MAX             128
+#define PROFILER_MAX_LOOPS            32
+#define PROFILER_STACK_MAX (PROFILER_CALLER_MAX + PROFILER_SQL_MAX + PROFILER_NODE_MAX + 8)
+
+// per-database profiler state, allocated when the profiler is first installed
+// on the database
+struct profiler_db_state {
+  char                caller[PROFILER_CALLER_MAX];
+  unsigned long long  last_sample_ns;
+  sqlite3_stmt        *stmt;
+  sqlite3_int64       visits[PROFILER_MAX_LOOPS];
+};
+
+struct profiler_entry {
+  char                *stack;
+  unsigned long       hash;
+  unsigned long long  count;
+};
+
+int profiler_active = 0;
+
+static unsigned long long profiler_interval_ns;
+static rb_nativethread_lock_t profiler_lock;
+static struct profiler_entry *profiler_entries = NULL;
+static size_t profiler_capacity = 0;
+static size_t profiler_size = 0;
+
+// Copies a frame of the stack into dest, replacing stack separators and
+// collapsing whitespace. Returns the number of bytes written.
+static size_t copy_frame(char *dest, size_t max, const char *src, size_t len) {
+  size_t pos = 0;
+  int space = 1;
+  if (max == 0) return 0;
+
+  for (size_t i = 0; i < len && pos < max - 1; i++) {
+    char c = src[i];
+    switch (c) {
+      case ' ': case '\t': case '\n': case '\r':
+        if (space) continue;
+        dest[pos++] = ' ';
+        space = 1;
+        continue;
+      case ';':
+        c = ',';
+    }
+    dest[pos++] = c;
+    space = 0;
+  }
+  if (pos && dest[pos - 1] == ' ') pos--;
+  dest[pos] = 0;
+  return pos;
+}
+
+static inline unsigned long stack_hash(const char *str) {
+  unsigned long h = 2166136261UL;
+  while (*str) {
+    h ^= (unsigned char)*str++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+static void profiler_entries_grow(void) {
+  size_t new_capacity = profiler_capacity ? profiler_capacity * 2 : PROFILER_INITIAL_CAPACITY;
+  struct profiler_entry *entries = calloc(new_capacity, sizeof(struct profiler_entry));
+
+  for (size_t i = 0; i < profiler_capacity; i++) {
+    struct profiler_entry *entry = profiler_entries + i;
+    if (!entry->stack) continue;
+
+    size_t idx = entry->hash & (new_capacity - 1);
+    while (entries[idx].stack) idx = (idx + 1) & (new_capacity - 1);
+    entries[idx] = *entry;
+  }
+  free(profiler_entries);
+  profiler_entries = entries;
+  profiler_capacity = new_capacity;
+}
+
+// Adds a sample for the given stack. Must be called with the profiler lock
+// held.
+static void profiler_record(const char *stack) {
+  if (profiler_size * 2 >= profiler_capacity) profiler_entries_grow();
+
+  unsigned long hash = stack_hash(stack);
+  size_t idx = hash & (profiler_capacity - 1);
+  while (profiler_entries[idx].stack) {
+    struct profiler_entry *entry = profiler_entries + idx;
+    if (entry->hash == hash && !strcmp(entry->stack, stack)) {
+      entry->count++;
+      return;
+    }
+    idx = (idx + 1) & (profiler_capacity - 1);
+  }
+
+  profiler_entries[idx].stack = strdup(stack);
+  profiler_entries[idx].hash = hash;
+  profiler_entries[idx].count = 1;
+  profiler_size++;
+}
+
+static void profiler_entries_free(void) {
+  for (size_t i = 0; i < profiler_capacity; i++)
+    free(profiler_entries[i].stack);
+  free(profiler_entries);
+  profiler_entries = NULL;
+  profiler_capacity = 0;
+  profiler_size = 0;
+}
+
+static inline struct profiler_db_state *profiler_db_state(Database_t *db) {
+  if (!db->profiler) {
+    db->profiler = calloc(1, sizeof(struct profiler_db_state));
+    strcpy(db->profiler->caller, "-");
+  }
+  return db->profiler;
+}
+
+// Returns the currently running statement. Statements are kept by SQLite in
+// reverse order of preparation, so when queries are nested the innermost one
+// is found first.
+static inline sqlite3_stmt *running_stmt(sqlite3 *sqlite3_db) {
+  sqlite3_stmt *stmt = sqlite3_next_stmt(sqlite3_db, NULL);
+  while (stmt) {
+    if (sqlite3_stmt_busy(stmt)) return stmt;
+    stmt = sqlite3_next_stmt(sqlite3_db, stmt);
+  }
+  return NULL;
+}
+
+#ifdef HAVE_SQLITE3_STMT_SCANSTATUS
+// Determines the query plan loop in which the statement is currently running,
+// by picking the loop with the most rows visited since the last sample taken
+// for the same statement.
+static size_t running_loop(struct profiler_db_state *state, sqlite3_stmt *stmt, char *dest, size_t max) {
+  int same_stmt = state->stmt == stmt;
+  sqlite3_int64 max_delta = -1;
+  const char *explain = NULL;
+
+  for (int idx = 0; idx < PROFILER_MAX_LOOPS; idx++) {
+    sqlite3_int64 visits;
+    const char *loop_explain;
+    if (sqlite3_stmt_scanstatus(stmt, idx, SQLITE_SCANSTAT_NVISIT, &visits)) break;
+    sqlite3_stmt_scanstatus(stmt, idx, SQLITE_SCANSTAT_EXPLAIN, &loop_explain);
+
+    sqlite3_int64 delta = same_stmt ? visits - state->visits[idx] : visits;
+    if (delta > max_delta) {
+      max_delta = delta;
+      explain = loop_explain;
+    }
+    state->visits[idx] = visits;
+  }
+  state->stmt = stmt;
+
+  if (!explain) return 0;
+  return copy_frame(dest, max, explain, strlen(explain));
+}
+#endif
+
+// Takes a sample for the given database if the sampling interval has elapsed.
+// This function may be called without holding the GVL.
+void profiler_sample(Database_t *db) {
+  struct profiler_db_state *state = db->profiler;
+  if (!profiler_active || !state) return;
+
+  unsigned long long now = monotonic_ns();
+  if (now - state->last_sample_ns < profiler_interval_ns) return;
+  state->last_sample_ns = now;
+
+  sqlite3_stmt *stmt = running_stmt(db->sqlite3_db);
+  if (!stmt) return;
+
+  char stack[PROFILER_STACK_MAX];
+  size_t len = strlen(state->caller);
+  memcpy(stack, state->caller, len);
+  stack[len++] = ';';
+
+  const char *sql = sqlite3_sql(stmt);
+  if (sql) len += copy_frame(stack + len, PROFILER_SQL_MAX, sql, strlen(sql));
+
+#ifdef HAVE_SQLITE3_STMT_SCANSTATUS
+  stack[len++] = ';';
+  size_t node_len = running_loop(state, stmt, stack + len, PROFILER_NODE_MAX);
+  if (!node_len) len--;
+  len += node_len;
+#endif
+  stack[len] = 0;
+
+  rb_nativethread_lock_lock(&profiler_lock);
+  if (profiler_active) profiler_record(stack);
+  rb_nativethread_lock_unlock(&profiler_lock);
+}
+
+int profiler_progress_handler(void *ptr) {
+  profiler_sample((Database_t *)ptr);
+  return 0;
+}
+
+// Records the Ruby location from which a query is issued. The first frame
+// with a source location is used.
+void profiler_capture_caller(Database_t *db) {
+  struct profiler_db_state *state = profiler_db_state(db);
+  VALUE frames[8];
+  int lines[8];
+  int count = rb_profile_frames(0, 8, frames, lines);
+
+  for (int i = 0; i < count; i++) {
+    VALUE path = rb_profile_frame_path(frames[i]);
+    if (NIL_P(path)) continue;
+
+    VALUE label = rb_profile_frame_full_label(frames[i]);
+    VALUE frame = rb_sprintf("%"PRIsVALUE" (%"PRIsVALUE":%d)", label, path, lines[i]);
+    copy_frame(state->caller, PROFILER_CALLER_MAX, RSTRING_PTR(frame), RSTRING_LEN(frame));
+    RB_GC_GUARD(frame);
+    return;
+  }
+  strcpy(state->caller, "-");
+}
+
+void profiler_db_free(Database_t *db) {
+  free(db->profiler);
+  db->profiler = NULL;
+}
+
+static void profiler_install(void) {
+  for (Database_t *db = open_databases; db; db = db->next_open) {
+    struct profiler_db_state *state = profiler_db_state(db);
+    state->last_sample_ns = 0;
+    state->stmt = NULL;
+    Database_install_progress_handler(db);
+  }
+}
+
+/* call-seq:
+ *   Extralite::Profiler.start(interval_us: 1000) -> true
+ *
+ * Starts the profiler, sampling running queries on all open databases every
+ * `interval_us` microseconds.
+ *
+ * @param opts [Hash] profiler options
+ * @option opts [Integer] :interval_us sampling interval in microseconds
+ * @return [true]
+ */
+VALUE Profiler_start(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[1];
+  VALUE opts;
+  VALUE interval = Qundef;
+
+  rb_scan_args(argc, argv, "00:", &opts);
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) CONST_ID(kw_ids[0], "interval_us");
+    rb_get_kwargs(opts, kw_ids, 0, 1, &interval);
+  }
+
+  long interval_us = (interval == Qundef) ? PROFILER_DEFAULT_INTERVAL_US : NUM2LONG(interval);
+  if (interval_us <= 0)
+    rb_raise(rb_eArgError, "Invalid sampling interval (expect integer > 0)");
+  if (profiler_active)
+    rb_raise(cError, "Profiler is already running");
+
+  rb_nativethread_lock_lock(&profiler_lock);
+  profiler_entries_free();
+  profiler_interval_ns = (unsigned long long)interval_us * 1000;
+  profiler_active = 1;
+  rb_nativethread_lock_unlock(&profiler_lock);
+
+  profiler_install();
+  return Qtrue;
+}
+
+static int profiler_entry_cmp(const void *a, const void *b) {
+  const struct profiler_entry *e1 = a;
+  const struct profiler_entry *e2 = b;
+  if (e1->count != e2->count) return e1->count < e2->count ? 1 : -1;
+  return strcmp(e1->stack, e2->stack);
+}
+
+/* call-seq:
+ *   Extralite::Profiler.stop -> collapsed_stacks
+ *
+ * Stops the profiler and returns the collected samples as collapsed stacks,
+ * one line per stack, in the format `caller;sql;plan_node count`. Lines are
+ * ordered by descending sample count. If the profiler is not running, nil is
+ * returned.
+ *
+ * @return [String, nil] collapsed stacks
+ */
+VALUE Profiler_stop(VALUE self) {
+  if (!profiler_active) return Qnil;
+
+  rb_nativethread_lock_lock(&profiler_lock);
+  profiler_active = 0;
+  rb_nativethread_lock_unlock(&profiler_lock);
+
+  for (Database_t *db = open_databases; db; db = db->next_open)
+    Database_install_progress_handler(db);
+
+  size_t count = 0;
+  for (size_t i = 0; i < profiler_capacity; i++)
+    if (profiler_entries[i].stack) profiler_entries[count++] = profiler_entries[i];
+  if (count) qsort(profiler_entries, count, sizeof(struct profiler_entry), profiler_entry_cmp);
+
+  VALUE str = rb_utf8_str_new("", 0);
+  for (size_t i = 0; i < count; i++)
+    rb_str_catf(str, "%s %llu\n", profiler_entries[i].stack, profiler_entries[i].count);
+
+  // entries were compacted, so only the first count entries hold stacks
+  for (size_t i = count; i < profiler_capacity; i++) profiler_entries[i].stack = NULL;
+  profiler_entries_free();
+  return str;
+}
+
+/* Returns true if the profiler is running.
+ *
+ * @return [bool] is profiler running
+ */
+VALUE Profiler_running_p(VALUE self) {
+  return profiler_active ? Qtrue : Qfalse;
+}
+
+void Init_ExtraliteProfiler(void) {
+  VALUE mExtralite = rb_define_module("Extralite");
+  VALUE mProfiler = rb_define_module_under(mExtralite, "Profiler");
+
+  rb_define_singleton_method(mProfiler, "start", Profiler_start, -1);
+  rb_define_singleton_method(mProfiler, "stop", Profiler_stop, 0);
+  rb_define_singleton_method(mProfiler, "running?", Profiler_running_p, 0);
+
+  rb_nativethread_lock_initialize(&profiler_lock);
+}
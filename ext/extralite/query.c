@@ -17,6 +17,8 @@ ID ID_slice;
 VALUE SYM_hash;
 VALUE SYM_splat;
 VALUE SYM_array;
+VALUE SYM_object;
+VALUE SYM_lazy;
 
 #define DB_GVL_MODE(query) Database_prepare_gvl_mode(query->db_struct)
 
@@ -29,6 +31,9 @@ static void Query_mark(void *ptr) {
   rb_gc_mark_movable(query->db);
   rb_gc_mark_movable(query->sql);
   rb_gc_mark_movable(query->transform_proc);
+  rb_gc_mark_movable(query->pins);
+  rb_gc_mark_movable(query->row_class);
+  rb_gc_mark_movable(query->intern_table);
 }
 
 static void Query_compact(void *ptr) {
@@ -36,11 +41,17 @@ static void Query_compact(void *ptr) {
   query->db = rb_gc_location(query->db);
   query->sql = rb_gc_location(query->sql);
   query->transform_proc = rb_gc_location(query->transform_proc);
+  query->pins = rb_gc_location(query->pins);
+  query->row_class = rb_gc_location(query->row_class);
+  query->intern_table = rb_gc_location(query->intern_table);
 }
 
 static void Query_free(void *ptr) {
   Query_t *query = ptr;
-  if (query->stmt) sqlite3_finalize(query->stmt);
+  if (query->stmt) {
+    connection_release_handle(query->sqlite3_db);
+    sqlite3_finalize(query->stmt);
+  }
   free(ptr);
 }
 
@@ -55,6 +66,9 @@ static VALUE Query_allocate(VALUE klass) {
   query->db = Qnil;
   query->sql = Qnil;
   query->transform_proc = Qnil;
+  query->pins = Qnil;
+  query->row_class = Qnil;
+  query->intern_table = Qnil;
   query->sqlite3_db = NULL;
   query->stmt = NULL;
   return TypedData_Wrap_Struct(klass, &Query_type, query);
@@ -70,6 +84,8 @@ static inline enum query_mode symbol_to_query_mode(VALUE sym) {
   if (sym == SYM_hash)          return QUERY_HASH;
   if (sym == SYM_splat)         return QUERY_SPLAT;
   if (sym == SYM_array)         return QUERY_ARRAY;
+  if (sym == SYM_object)        return QUERY_OBJECT;
+  if (sym == SYM_lazy)          return QUERY_LAZY;
 
   rb_raise(cError, "Invalid query mode");
 }
@@ -82,11 +98,20 @@ static inline VALUE query_mode_to_symbol(enum query_mode query_mode) {
       return SYM_splat;
     case QUERY_ARRAY:
       return SYM_array;
+    case QUERY_OBJECT:
+      return SYM_object;
+    case QUERY_LAZY:
+      return SYM_lazy;
     default:
       rb_raise(cError, "Invalid mode");
   }
 }
 
+static inline void query_mode_check(Query_t *query, enum query_mode query_mode) {
+  if (query_mode == QUERY_OBJECT && NIL_P(query->row_class))
+    rb_raise(cError, "Object mode requires a row class (see Database#prepare_as)");
+}
+
 /* Initializes a new prepared query with the given database and SQL string. A
  * `Query` is normally instantiated by calling `Database#prepare`:
  *
@@ -95,10 +120,14 @@ static inline VALUE query_mode_to_symbol(enum query_mode query_mode) {
  * @param db [Extralite::Database] associated database
  * @param sql [String] SQL string
  * @param mode [Symbol] query mode
+ * @param row_class [Class, nil] Struct or Data class for rows in object mode
  * @return [void]
  */
-VALUE Query_initialize(VALUE self, VALUE db, VALUE sql, VALUE mode) {
+VALUE Query_initialize(int argc, VALUE *argv, VALUE self) {
   Query_t *query = self_to_query(self);
+  VALUE db, sql, mode, row_class;
+
+  rb_scan_args(argc, argv, "31", &db, &sql, &mode, &row_class);
 
   sql = rb_funcall(sql, ID_strip, 0);
   if (!RSTRING_LEN(sql))
@@ -108,6 +137,8 @@ VALUE Query_initialize(VALUE self, VALUE db, VALUE sql, VALUE mode) {
   RB_OBJ_WRITE(self, &query->sql, sql);
   if (rb_block_given_p())
     RB_OBJ_WRITE(self, &query->transform_proc, rb_block_proc());
+  if (!NIL_P(row_class))
+    RB_OBJ_WRITE(self, &query->row_class, row_class_check(row_class));
 
   query->db = db;
   query->db_struct = self_to_database(db);
@@ -116,6 +147,7 @@ VALUE Query_initialize(VALUE self, VALUE db, VALUE sql, VALUE mode) {
   query->closed = 0;
   query->eof = 0;
   query->query_mode = symbol_to_query_mode(mode);
+  query_mode_check(query, query->query_mode);
 
   return Qnil;
 }
@@ -123,20 +155,41 @@ VALUE Query_initialize(VALUE self, VALUE db, VALUE sql, VALUE mode) {
 static inline void query_reset(Query_t *query) {
   if (!query->stmt)
     prepare_single_stmt(DB_GVL_MODE(query), query->sqlite3_db, &query->stmt, query->sql);
-  Database_issue_query(query->db_struct, query->sql);
+  Database_issue_query(query->db_struct, query->sql, query->query_mode);
   sqlite3_reset(query->stmt);
+  CDC_FLUSH_PENDING(query->db_struct);
   query->eof = 0;
 }
 
-static inline void query_reset_and_bind(Query_t *query, int argc, VALUE * argv) {
+// Clears the bindings of the query's statement, and returns the (cleared)
+// array holding strings bound to it with SQLITE_STATIC. The array is owned by
+// the query, so strings stay pinned even if binding or a batch run is
+// interrupted by an exception.
+static inline VALUE *query_clear_bindings(VALUE self, Query_t *query) {
+  if (NIL_P(query->pins))
+    RB_OBJ_WRITE(self, &query->pins, rb_ary_new());
+  clear_bindings(query->stmt, query->pins);
+  return &query->pins;
+}
+
+// Returns the query's table of interned strings, which is kept across
+// executions, or nil if interning is off for the database.
+static inline VALUE query_intern_table(VALUE self, Query_t *query) {
+  if (!query->db_struct->intern) return Qnil;
+  if (NIL_P(query->intern_table))
+    RB_OBJ_WRITE(self, &query->intern_table, intern_table_new());
+  return query->intern_table;
+}
+
+static inline void query_reset_and_bind(VALUE self, Query_t *query, int query_kind, int argc, VALUE * argv) {
   if (!query->stmt)
     prepare_single_stmt(DB_GVL_MODE(query), query->sqlite3_db, &query->stmt, query->sql);
-  Database_issue_query(query->db_struct, query->sql);
+  Database_issue_query(query->db_struct, query->sql, query_kind);
   sqlite3_reset(query->stmt);
+  CDC_FLUSH_PENDING(query->db_struct);
   query->eof = 0;
   if (argc > 0) {
-    sqlite3_clear_bindings(query->stmt);
-    bind_all_parameters(query->stmt, argc, argv);
+    bind_all_parameters(query->stmt, argc, argv, query_clear_bindings(self, query));
   }
 }
 
@@ -186,7 +239,7 @@ VALUE Query_bind(int argc, VALUE *argv, VALUE self) {
   Query_t *query = self_to_query(self);
   if (query->closed) rb_raise(cError, "Query is closed");
 
-  query_reset_and_bind(query, argc, argv);
+  query_reset_and_bind(self, query, query->query_mode, argc, argv);
   return self;
 }
 
@@ -221,6 +274,8 @@ static inline VALUE Query_perform_next(VALUE self, int max_rows, safe_query_impl
     ROW_YIELD_OR_MODE(max_rows == SINGLE_ROW ? ROW_SINGLE : ROW_MULTI),
     MAX_ROWS(max_rows)
   );
+  ctx.row_class = query->row_class;
+  ctx.intern_table = query_intern_table(self, query);
   VALUE result = call(&ctx);
   query->eof = ctx.eof;
   return (ctx.row_mode == ROW_YIELD) ? self : result;
@@ -236,6 +291,10 @@ inline safe_query_impl query_impl(enum query_mode query_mode) {
       return safe_query_splat;
     case QUERY_ARRAY:
       return safe_query_array;
+    case QUERY_OBJECT:
+      return safe_query_object;
+    case QUERY_LAZY:
+      return safe_query_lazy;
     default:
       rb_raise(cError, "Invalid query mode (query_impl)");
   }
@@ -313,7 +372,7 @@ VALUE Query_each(VALUE self) {
  */
 VALUE Query_execute(int argc, VALUE *argv, VALUE self) {
   Query_t *query = self_to_query(self);
-  query_reset_and_bind(query, argc, argv);
+  query_reset_and_bind(self, query, METRICS_QUERY_EXECUTE, argc, argv);
   return Query_perform_next(self, ALL_ROWS, safe_query_changes);
 }
 
@@ -394,6 +453,8 @@ VALUE Query_batch_execute(VALUE self, VALUE parameters) {
     ROW_YIELD_OR_MODE(ROW_MULTI),
     ALL_ROWS
   );
+  sqlite3_reset(query->stmt);
+  ctx.pins = *query_clear_bindings(self, query);
   return safe_batch_execute(&ctx);
 }
 
@@ -443,6 +504,10 @@ VALUE Query_batch_query(VALUE self, VALUE parameters) {
     ROW_YIELD_OR_MODE(ROW_MULTI),
     ALL_ROWS
   );
+  sqlite3_reset(query->stmt);
+  ctx.pins = *query_clear_bindings(self, query);
+  ctx.row_class = query->row_class;
+  ctx.intern_table = query_intern_table(self, query);
   return safe_batch_query(&ctx);
 }
 
@@ -490,9 +555,10 @@ VALUE Query_clone(VALUE self) {
   VALUE args[] = {
     query->db,
     query->sql,
-    query_mode_to_symbol(query->query_mode)
+    query_mode_to_symbol(query->query_mode),
+    query->row_class
   };
-  return rb_funcall_with_block(cQuery, ID_new, 3, args, query->transform_proc);
+  return rb_funcall_with_block(cQuery, ID_new, 4, args, query->transform_proc);
 }
 
 /* Closes the query. Attempting to run a closed query will raise an error.
@@ -502,10 +568,13 @@ VALUE Query_clone(VALUE self) {
 VALUE Query_close(VALUE self) {
   Query_t *query = self_to_query(self);
   if (query->stmt) {
+    connection_release_handle(query->sqlite3_db);
     sqlite3_finalize(query->stmt);
     query->stmt = NULL;
+    CDC_FLUSH_PENDING(query->db_struct);
   }
   query->closed = 1;
+  RB_OBJ_WRITE(self, &query->pins, Qnil);
   return self;
 }
 
@@ -596,17 +665,31 @@ VALUE Query_mode_get(VALUE self) {
 /* call-seq:
  *   query.mode = mode
  * 
- * Sets the query mode. This can be one of `:hash`, `:splat`, `:array`.
+ * Sets the query mode. This can be one of `:hash`, `:splat`, `:array`,
+ * `:lazy` or `:object`. The `:object` mode is available only for queries created with
+ * `Database#prepare_as`.
  *
  * @param mode [Symbol] query mode
  * @return [Symbol] query mode
  */
 VALUE Query_mode_set(VALUE self, VALUE mode) {
   Query_t *query = self_to_query(self);
-  query->query_mode = symbol_to_query_mode(mode);
+  enum query_mode query_mode = symbol_to_query_mode(mode);
+  query_mode_check(query, query_mode);
+  query->query_mode = query_mode;
   return mode;
 }
 
+/* Returns the Struct or Data class used for rows in object mode, or nil if the
+ * query was not created with `Database#prepare_as`.
+ *
+ * @return [Class, nil] row class
+ */
+VALUE Query_row_class(VALUE self) {
+  Query_t *query = self_to_query(self);
+  return query->row_class;
+}
+
 void Init_ExtraliteQuery(void) {
   VALUE mExtralite = rb_define_module("Extralite");
 
@@ -627,12 +710,13 @@ void Init_ExtraliteQuery(void) {
   rb_define_method(cQuery, "<<",             Query_execute_chevrons, 1);
   rb_define_method(cQuery, "batch_execute",  Query_batch_execute, 1);
   rb_define_method(cQuery, "batch_query",    Query_batch_query, 1);
-  rb_define_method(cQuery, "initialize",     Query_initialize, 3);
+  rb_define_method(cQuery, "initialize",     Query_initialize, -1);
   rb_define_method(cQuery, "inspect",        Query_inspect, 0);
   rb_define_method(cQuery, "mode",           Query_mode_get, 0);
   rb_define_method(cQuery, "mode=",          Query_mode_set, 1);
   rb_define_method(cQuery, "next",           Query_next, -1);
   rb_define_method(cQuery, "reset",          Query_reset, 0);
+  rb_define_method(cQuery, "row_class",      Query_row_class, 0);
   rb_define_method(cQuery, "sql",            Query_sql, 0);
   rb_define_method(cQuery, "status",         Query_status, -1);
   rb_define_method(cQuery, "to_a",           Query_to_a, 0);
@@ -644,8 +728,12 @@ void Init_ExtraliteQuery(void) {
   SYM_hash          = ID2SYM(rb_intern("hash"));
   SYM_splat          = ID2SYM(rb_intern("splat"));
   SYM_array           = ID2SYM(rb_intern("array"));
+  SYM_object          = ID2SYM(rb_intern("object"));
+  SYM_lazy            = ID2SYM(rb_intern("lazy"));
 
   rb_gc_register_mark_object(SYM_hash);
   rb_gc_register_mark_object(SYM_splat);
   rb_gc_register_mark_object(SYM_array);
+  rb_gc_register_mark_object(SYM_object);
+  rb_gc_register_mark_object(SYM_lazy);
 }
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "extralite.h"
+
+/*
+ * Document-class: Extralite::Row
+ *
+ * This class represents a row returned by a query in lazy mode (see
+ * `Database#query_lazy` and `Database#prepare_lazy`). A `Row` holds a compact
+ * copy of the row's raw column values, made while stepping through the query.
+ * Ruby objects for column values are created only when the values are
+ * accessed, so reading a few columns out of a wide row allocates much less
+ * than converting the entire row to a hash:
+ *
+ *     rows = db.query_lazy('select * from orders')
+ *     rows.map { |r| r[:total] }
+ *
+ * Column values are accessed by column name (as a symbol or a string) or by
+ * column index. Once created, column values are cached in the row. Column
+ * names are looked up in an index shared by all the rows returned by the same
+ * query execution.
+ */
+
+VALUE cRow;
+
+// column layout shared by all rows of a single query execution
+typedef struct {
+  int           column_count;
+  int           json_flags;
+  int           decode;
+  VALUE         names;
+  VALUE         index;
+  VALUE         intern_table;
+  unsigned char kinds[];
+} RowLayout_t;
+
+static void RowLayout_mark(void *ptr) {
+  RowLayout_t *layout = ptr;
+  rb_gc_mark_movable(layout->names);
+  rb_gc_mark_movable(layout->index);
+  rb_gc_mark_movable(layout->intern_table);
+}
+
+static void RowLayout_compact(void *ptr) {
+  RowLayout_t *layout = ptr;
+  layout->names = rb_gc_location(layout->names);
+  layout->index = rb_gc_location(layout->index);
+  layout->intern_table = rb_gc_location(layout->intern_table);
+}
+
+static size_t RowLayout_size(const void *ptr) {
+  const RowLayout_t *layout = ptr;
+  return sizeof(RowLayout_t) + (layout->decode ? layout->column_count : 0);
+}
+
+static const rb_data_type_t RowLayout_type = {
+    "RowLayout",
+    {RowLayout_mark, RUBY_TYPED_DEFAULT_FREE, RowLayout_size, RowLayout_compact},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+// raw column value, text and blob values are stored at offset from the end
+// of the row's cells
+struct row_cell {
+  int           type;
+  int           len;
+  union {
+    sqlite3_int64 i;
+    double        d;
+    size_t        offset;
+  };
+};
+
+typedef struct {
+  VALUE           layout;
+  int             column_count;
+  size_t          data_len;
+  VALUE           *values;
+  struct row_cell cells[];
+} Row_t;
+
+static void Row_mark(void *ptr) {
+  Row_t *row = ptr;
+  rb_gc_mark_movable(row->layout);
+  if (row->values)
+    for (int i = 0; i < row->column_count; i++) rb_gc_mark_movable(row->values[i]);
+}
+
+static void Row_compact(void *ptr) {
+  Row_t *row = ptr;
+  row->layout = rb_gc_location(row->layout);
+  if (row->values)
+    for (int i = 0; i < row->column_count; i++) row->values[i] = rb_gc_location(row->values[i]);
+}
+
+static void Row_free(void *ptr) {
+  Row_t *row = ptr;
+  if (row->values) xfree(row->values);
+  xfree(ptr);
+}
+
+static size_t Row_size(const void *ptr) {
+  const Row_t *row = ptr;
+  return sizeof(Row_t) + row->column_count * sizeof(struct row_cell) + row->data_len +
+    (row->values ? row->column_count * sizeof(VALUE) : 0);
+}
+
+static const rb_data_type_t Row_type = {
+    "Row",
+    {Row_mark, Row_free, Row_size, Row_compact},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static inline Row_t *self_to_row(VALUE obj) {
+  Row_t *row;
+  TypedData_Get_Struct((obj), Row_t, &Row_type, (row));
+  return row;
+}
+
+static inline RowLayout_t *row_layout(Row_t *row) {
+  return RTYPEDDATA_DATA(row->layout);
+}
+
+// Creates the column layout for rows returned by the given statement. The
+// layout is created once per query execution.
+VALUE row_layout_new(sqlite3_stmt *stmt, int column_count, struct column_decoders *decoders) {
+  RowLayout_t *layout = ruby_xmalloc(sizeof(RowLayout_t) + (decoders ? column_count : 0));
+  layout->column_count = column_count;
+  layout->json_flags = decoders ? decoders->json_flags : 0;
+  layout->decode = decoders != NULL;
+  layout->names = Qnil;
+  layout->index = Qnil;
+  layout->intern_table = Qnil;
+  if (decoders) memcpy(layout->kinds, decoders->kinds, column_count);
+
+  VALUE obj = TypedData_Wrap_Struct(0, &RowLayout_type, layout);
+  VALUE names = rb_ary_new_capa(column_count);
+  VALUE index = rb_hash_new();
+  for (int i = 0; i < column_count; i++) {
+    VALUE name = ID2SYM(rb_intern(sqlite3_column_name(stmt, i)));
+    rb_ary_push(names, name);
+    rb_hash_aset(index, name, INT2FIX(i));
+  }
+  RB_OBJ_WRITE(obj, &layout->names, rb_obj_freeze(names));
+  RB_OBJ_WRITE(obj, &layout->index, rb_obj_freeze(index));
+  if (decoders) RB_OBJ_WRITE(obj, &layout->intern_table, decoders->intern_table);
+  return obj;
+}
+
+static inline int cell_has_data(int type) {
+  return type == SQLITE_TEXT || type == SQLITE_BLOB;
+}
+
+// Creates a row holding a copy of the current row of the given statement.
+VALUE row_new(VALUE layout, sqlite3_stmt *stmt) {
+  int column_count = ((RowLayout_t *)RTYPEDDATA_DATA(layout))->column_count;
+  size_t data_len = 0;
+
+  for (int i = 0; i < column_count; i++)
+    if (cell_has_data(sqlite3_column_type(stmt, i)))
+      data_len += sqlite3_column_bytes(stmt, i);
+
+  Row_t *row = ruby_xmalloc(sizeof(Row_t) + column_count * sizeof(struct row_cell) + data_len);
+  char *data = (char *)(row->cells + column_count);
+  size_t offset = 0;
+  row->layout = Qnil;
+  row->column_count = column_count;
+  row->data_len = data_len;
+  row->values = NULL;
+
+  for (int i = 0; i < column_count; i++) {
+    struct row_cell *cell = row->cells + i;
+    struct raw_value v;
+    raw_value_read(stmt, i, sqlite3_column_type(stmt, i), &v);
+    cell->type = v.type;
+    cell->len = v.len;
+    switch (v.type) {
+      case SQLITE_INTEGER:
+        cell->i = v.i;
+        break;
+      case SQLITE_FLOAT:
+        cell->d = v.d;
+        break;
+      case SQLITE_TEXT:
+      case SQLITE_BLOB:
+        if (v.len) memcpy(data + offset, v.ptr, v.len);
+        cell->offset = offset;
+        offset += v.len;
+        break;
+    }
+  }
+
+  VALUE obj = TypedData_Wrap_Struct(cRow, &Row_type, row);
+  RB_OBJ_WRITE(obj, &row->layout, layout);
+  return obj;
+}
+
+static VALUE row_value(VALUE self, Row_t *row, int idx) {
+  if (!row->values) {
+    VALUE *values = ALLOC_N(VALUE, row->column_count);
+    for (int i = 0; i < row->column_count; i++) values[i] = Qundef;
+    row->values = values;
+  }
+  if (row->values[idx] != Qundef) return row->values[idx];
+
+  RowLayout_t *layout = row_layout(row);
+  struct row_cell *cell = row->cells + idx;
+  struct raw_value v;
+  v.type = cell->type;
+  v.len = cell->len;
+  switch (cell->type) {
+    case SQLITE_INTEGER:
+      v.i = cell->i;
+      break;
+    case SQLITE_FLOAT:
+      v.d = cell->d;
+      break;
+    default:
+      v.ptr = (const char *)(row->cells + row->column_count) + cell->offset;
+  }
+
+  VALUE value;
+  switch (layout->decode ? layout->kinds[idx] : DECODER_NONE) {
+    case DECODER_NONE:
+      value = raw_value_to_ruby(&v);
+      break;
+    case DECODER_INTERN:
+    case DECODER_INTERN_AUTO:
+      value = (v.type == SQLITE_TEXT) ?
+        intern_text_value(layout->intern_table, layout->kinds, idx, v.ptr, v.len) :
+        raw_value_to_ruby(&v);
+      break;
+    default:
+      value = decode_raw_value(layout->kinds[idx], layout->json_flags, &v);
+  }
+  RB_OBJ_WRITE(self, &row->values[idx], value);
+  RB_GC_GUARD(self);
+  return value;
+}
+
+// Returns the column index for the given key, or -1 if not found.
+static int row_key_index(Row_t *row, VALUE key) {
+  if (RB_INTEGER_TYPE_P(key)) {
+    long idx = NUM2LONG(key);
+    if (idx < 0) idx += row->column_count;
+    return (idx >= 0 && idx < row->column_count) ? (int)idx : -1;
+  }
+  if (RB_TYPE_P(key, T_STRING)) {
+    ID id = rb_check_id(&key);
+    if (!id) return -1;
+    key = ID2SYM(id);
+  }
+  VALUE idx = rb_hash_lookup2(row_layout(row)->index, key, Qnil);
+  return NIL_P(idx) ? -1 : FIX2INT(idx);
+}
+
+/* Returns the value for the given column name or index, or nil if the row has
+ * no such column.
+ *
+ *     row = db.query_single_lazy('select 1 as a, 2 as b')
+ *     row[:b]  #=> 2
+ *     row['b'] #=> 2
+ *     row[0]   #=> 1
+ *
+ * @param key [Symbol, String, Integer] column name or index
+ * @return [any] column value
+ */
+VALUE Row_aref(VALUE self, VALUE key) {
+  Row_t *row = self_to_row(self);
+  int idx = row_key_index(row, key);
+  return (idx < 0) ? Qnil : row_value(self, row, idx);
+}
+
+/* call-seq:
+ *   row.fetch(key) -> value
+ *   row.fetch(key, default) -> value
+ *   row.fetch(key) { |key| ... } -> value
+ *
+ * Returns the value for the given column name or index. If the row has no such
+ * column, returns the given default value or the result of calling the given
+ * block. Otherwise, a `KeyError` is raised.
+ *
+ * @param key [Symbol, String, Integer] column name or index
+ * @return [any] column value
+ */
+VALUE Row_fetch(int argc, VALUE *argv, VALUE self) {
+  VALUE key, default_value;
+  int with_default = rb_scan_args(argc, argv, "11", &key, &default_value) == 2;
+  Row_t *row = self_to_row(self);
+  int idx = row_key_index(row, key);
+  if (idx >= 0) return row_value(self, row, idx);
+
+  if (rb_block_given_p()) return rb_yield(key);
+  if (with_default) return default_value;
+  rb_raise(rb_eKeyError, "key not found: %"PRIsVALUE, rb_inspect(key));
+}
+
+/* Returns true if the row has a column with the given name or index.
+ *
+ * @param key [Symbol, String, Integer] column name or index
+ * @return [bool] whether the column exists
+ */
+VALUE Row_key_p(VALUE self, VALUE key) {
+  return row_key_index(self_to_row(self), key) >= 0 ? Qtrue : Qfalse;
+}
+
+/* Returns the column names for the row.
+ *
+ * @return [Array<Symbol>] column names
+ */
+VALUE Row_keys(VALUE self) {
+  return rb_ary_dup(row_layout(self_to_row(self))->names);
+}
+
+/* Returns the column values for the row.
+ *
+ * @return [Array<any>] column values
+ */
+VALUE Row_values(VALUE self) {
+  Row_t *row = self_to_row(self);
+  VALUE values = rb_ary_new_capa(row->column_count);
+  for (int i = 0; i < row->column_count; i++)
+    rb_ary_push(values, row_value(self, row, i));
+  return values;
+}
+
+/* Returns the row as a hash mapping column names to values.
+ *
+ * @return [Hash] row hash
+ */
+VALUE Row_to_h(VALUE self) {
+  Row_t *row = self_to_row(self);
+  VALUE names = row_layout(row)->names;
+  VALUE hash = rb_hash_new();
+  for (int i = 0; i < row->column_count; i++)
+    rb_hash_aset(hash, RARRAY_AREF(names, i), row_value(self, row, i));
+  RB_GC_GUARD(names);
+  return hash;
+}
+
+/* Returns the number of columns in the row.
+ *
+ * @return [Integer] column count
+ */
+VALUE Row_size_get(VALUE self) {
+  return INT2FIX(self_to_row(self)->column_count);
+}
+
+/* Returns true if the given row or hash has the same columns and values.
+ *
+ * @param other [Extralite::Row, Hash] other row
+ * @return [bool] whether rows are equal
+ */
+VALUE Row_eq(VALUE self, VALUE other) {
+  if (rb_obj_is_kind_of(other, cRow))
+    other = Row_to_h(other);
+  else if (!RB_TYPE_P(other, T_HASH))
+    return Qfalse;
+  return rb_equal(Row_to_h(self), other);
+}
+
+/* Returns a string representation of the row, including all column values.
+ *
+ * @return [String] string representation
+ */
+VALUE Row_inspect(VALUE self) {
+  VALUE cname = rb_class_name(CLASS_OF(self));
+  VALUE hash = Row_to_h(self);
+  return rb_sprintf("#<%"PRIsVALUE" %"PRIsVALUE">", cname, rb_inspect(hash));
+}
+
+void Init_ExtraliteRow(void) {
+  VALUE mExtralite = rb_define_module("Extralite");
+
+  cRow = rb_define_class_under(mExtralite, "Row", rb_cObject);
+  rb_undef_alloc_func(cRow);
+
+  rb_define_method(cRow, "[]",        Row_aref, 1);
+  rb_define_method(cRow, "==",        Row_eq, 1);
+  rb_define_method(cRow, "fetch",     Row_fetch, -1);
+  rb_define_method(cRow, "has_key?",  Row_key_p, 1);
+  rb_define_method(cRow, "inspect",   Row_inspect, 0);
+  rb_define_method(cRow, "key?",      Row_key_p, 1);
+  rb_define_method(cRow, "keys",      Row_keys, 0);
+  rb_define_method(cRow, "length",    Row_size_get, 0);
+  rb_define_method(cRow, "size",      Row_size_get, 0);
+  rb_define_method(cRow, "to_a",      Row_values, 0);
+  rb_define_method(cRow, "to_h",      Row_to_h, 0);
+  rb_define_method(cRow, "values",    Row_values, 0);
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "extralite.h"
+
+/*
+ * Document-class: Extralite::Snapshot
+ *
+ * This class represents a point-in-time copy of a database being created in
+ * the background, as returned by `Database#snapshot_to`. The snapshot is
+ * performed on a separate thread, using a separate connection to the database,
+ * with the GVL released. A snapshot object can be used to track the progress
+ * of the snapshot and to wait for it to complete:
+ *
+ *     snapshot = db.snapshot_to('snapshot.db')
+ *     do_some_other_work
+ *     snapshot.value #=> 'snapshot.db'
+ */
+
+VALUE cSnapshot;
+
+#define SNAPSHOT_PROGRESS_PERIOD  10000
+#define SNAPSHOT_BACKUP_PAGES     256
+#define SNAPSHOT_BUSY_SLEEP_MS    10
+#define SNAPSHOT_REPORT_STEP      0.01
+
+typedef struct {
+  VALUE               path;
+  VALUE               thread;
+  VALUE               proc;
+  VALUE               error;
+  char                *src_filename;
+  char                *dst_filename;
+  sqlite3             *conn;
+  int                 compact;
+  int                 created;
+  long long           total_bytes;
+  double              progress;
+  double              reported;
+  int                 rc;
+  volatile int        cancelled;
+  int                 done;
+} Snapshot_t;
+
+static size_t Snapshot_size(const void *ptr) {
+  return sizeof(Snapshot_t);
+}
+
+static void Snapshot_mark(void *ptr) {
+  Snapshot_t *snapshot = ptr;
+  rb_gc_mark_movable(snapshot->path);
+  rb_gc_mark_movable(snapshot->thread);
+  rb_gc_mark_movable(snapshot->proc);
+  rb_gc_mark_movable(snapshot->error);
+}
+
+static void Snapshot_compact(void *ptr) {
+  Snapshot_t *snapshot = ptr;
+  snapshot->path    = rb_gc_location(snapshot->path);
+  snapshot->thread  = rb_gc_location(snapshot->thread);
+  snapshot->proc    = rb_gc_location(snapshot->proc);
+  snapshot->error   = rb_gc_location(snapshot->error);
+}
+
+// A snapshot object is kept alive by its thread while the snapshot is running,
+// so its connection is always closed by the time it is freed.
+static void Snapshot_free(void *ptr) {
+  Snapshot_t *snapshot = ptr;
+  free(snapshot->src_filename);
+  free(snapshot->dst_filename);
+  free(ptr);
+}
+
+static const rb_data_type_t Snapshot_type = {
+    "Snapshot",
+    {Snapshot_mark, Snapshot_free, Snapshot_size, Snapshot_compact},
+    0, 0, RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE Snapshot_allocate(VALUE klass) {
+  Snapshot_t *snapshot = ALLOC(Snapshot_t);
+  memset(snapshot, 0, sizeof(Snapshot_t));
+  snapshot->path = Qnil;
+  snapshot->thread = Qnil;
+  snapshot->proc = Qnil;
+  snapshot->error = Qnil;
+  return TypedData_Wrap_Struct(klass, &Snapshot_type, snapshot);
+}
+
+static inline Snapshot_t *self_to_snapshot(VALUE obj) {
+  Snapshot_t *snapshot;
+  TypedData_Get_Struct((obj), Snapshot_t, &Snapshot_type, (snapshot));
+  return snapshot;
+}
+
+static long long snapshot_pragma_int(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt;
+  long long value = 0;
+
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      value = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  return value;
+}
+
+static VALUE snapshot_call_proc(VALUE self) {
+  Snapshot_t *snapshot = self_to_snapshot(self);
+  return rb_funcall(snapshot->proc, ID_call, 1, DBL2NUM(snapshot->progress));
+}
+
+// Calls the progress proc if the progress has advanced enough since it was
+// last called. An exception raised by the proc cancels the snapshot.
+static void snapshot_report(VALUE self, Snapshot_t *snapshot) {
+  if (NIL_P(snapshot->proc) || !NIL_P(snapshot->error)) return;
+  if (snapshot->progress < 1.0 && snapshot->progress < snapshot->reported + SNAPSHOT_REPORT_STEP) return;
+  if (snapshot->progress <= snapshot->reported) return;
+
+  int state = 0;
+  snapshot->reported = snapshot->progress;
+  rb_protect(snapshot_call_proc, self, &state);
+  if (state) {
+    RB_OBJ_WRITE(self, &snapshot->error, rb_errinfo());
+    rb_set_errinfo(Qnil);
+    snapshot->cancelled = 1;
+  }
+}
+
+struct snapshot_ctx {
+  VALUE       self;
+  Snapshot_t  *snapshot;
+  char        *sql;
+};
+
+static void *snapshot_report_with_gvl(void *ptr) {
+  struct snapshot_ctx *ctx = ptr;
+  snapshot_report(ctx->self, ctx->snapshot);
+  return NULL;
+}
+
+// Estimates the progress of VACUUM INTO from the size of the snapshot file.
+// Called without the GVL.
+static int snapshot_progress_handler(void *ptr) {
+  struct snapshot_ctx *ctx = ptr;
+  Snapshot_t *snapshot = ctx->snapshot;
+  struct stat st;
+
+  if (snapshot->cancelled) return 1;
+
+  if (snapshot->total_bytes > 0 && !stat(snapshot->dst_filename, &st)) {
+    double progress = (double)st.st_size / snapshot->total_bytes;
+    // the snapshot is only complete once VACUUM INTO returns
+    snapshot->progress = progress > 0.99 ? 0.99 : progress;
+  }
+  if (!NIL_P(snapshot->proc) && snapshot->progress >= snapshot->reported + SNAPSHOT_REPORT_STEP)
+    rb_thread_call_with_gvl(snapshot_report_with_gvl, ctx);
+  return snapshot->cancelled;
+}
+
+static void snapshot_ubf(void *ptr) {
+  struct snapshot_ctx *ctx = ptr;
+  ctx->snapshot->cancelled = 1;
+}
+
+static void *snapshot_vacuum_impl(void *ptr) {
+  struct snapshot_ctx *ctx = ptr;
+  ctx->snapshot->rc = sqlite3_exec(ctx->snapshot->conn, ctx->sql, NULL, NULL, NULL);
+  return NULL;
+}
+
+static void snapshot_vacuum(VALUE self, Snapshot_t *snapshot) {
+  struct snapshot_ctx ctx = { self, snapshot, NULL };
+  ctx.sql = sqlite3_mprintf("vacuum into %Q", snapshot->dst_filename);
+
+  sqlite3_progress_handler(snapshot->conn, SNAPSHOT_PROGRESS_PERIOD, snapshot_progress_handler, &ctx);
+  rb_thread_call_without_gvl(snapshot_vacuum_impl, (void *)&ctx, snapshot_ubf, (void *)&ctx);
+  sqlite3_progress_handler(snapshot->conn, 0, NULL, NULL);
+  sqlite3_free(ctx.sql);
+}
+
+struct snapshot_backup_ctx {
+  sqlite3_backup  *backup;
+  int             rc;
+};
+
+static void *snapshot_backup_step_impl(void *ptr) {
+  struct snapshot_backup_ctx *ctx = ptr;
+  ctx->rc = sqlite3_backup_step(ctx->backup, SNAPSHOT_BACKUP_PAGES);
+  return NULL;
+}
+
+static void *snapshot_busy_sleep_impl(void *unused) {
+  sqlite3_sleep(SNAPSHOT_BUSY_SLEEP_MS);
+  return NULL;
+}
+
+static void snapshot_backup(VALUE self, Snapshot_t *snapshot) {
+  sqlite3 *dst;
+  struct snapshot_backup_ctx ctx = { NULL, SQLITE_OK };
+
+  snapshot->rc = connection_open(snapshot->dst_filename, &dst, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+  if (snapshot->rc == SQLITE_OK) {
+    ctx.backup = sqlite3_backup_init(dst, "main", snapshot->conn, "main");
+    if (!ctx.backup) snapshot->rc = sqlite3_errcode(dst);
+  }
+  if (snapshot->rc != SQLITE_OK) {
+    connection_close(dst);
+    return;
+  }
+
+  while (1) {
+    gvl_call(GVL_RELEASE, snapshot_backup_step_impl, (void *)&ctx);
+    if (ctx.rc == SQLITE_OK || ctx.rc == SQLITE_DONE) {
+      int total = sqlite3_backup_pagecount(ctx.backup);
+      if (total > 0 && ctx.rc == SQLITE_OK)
+        snapshot->progress = 1.0 - (double)sqlite3_backup_remaining(ctx.backup) / total;
+    }
+    if (ctx.rc == SQLITE_DONE) break;
+    if (ctx.rc == SQLITE_BUSY || ctx.rc == SQLITE_LOCKED)
+      gvl_call(GVL_RELEASE, snapshot_busy_sleep_impl, NULL);
+    else if (ctx.rc != SQLITE_OK)
+      break;
+
+    snapshot_report(self, snapshot);
+    if (snapshot->cancelled) {
+      ctx.rc = SQLITE_INTERRUPT;
+      break;
+    }
+  }
+
+  sqlite3_backup_finish(ctx.backup);
+  connection_close(dst);
+  snapshot->rc = ctx.rc == SQLITE_DONE ? SQLITE_OK : ctx.rc;
+}
+
+static VALUE snapshot_run(VALUE self) {
+  Snapshot_t *snapshot = self_to_snapshot(self);
+
+  snapshot->rc = connection_open(snapshot->src_filename, &snapshot->conn, SQLITE_OPEN_READONLY);
+  if (snapshot->rc != SQLITE_OK) return Qnil;
+
+  sqlite3_busy_timeout(snapshot->conn, SNAPSHOT_BUSY_SLEEP_MS * 100);
+  snapshot->total_bytes =
+    (snapshot_pragma_int(snapshot->conn, "pragma page_count") -
+     snapshot_pragma_int(snapshot->conn, "pragma freelist_count")) *
+    snapshot_pragma_int(snapshot->conn, "pragma page_size");
+
+  if (snapshot->compact)
+    snapshot_vacuum(self, snapshot);
+  else
+    snapshot_backup(self, snapshot);
+
+  if (snapshot->rc == SQLITE_OK) {
+    snapshot->progress = 1.0;
+    snapshot_report(self, snapshot);
+  }
+  return Qnil;
+}
+
+static VALUE snapshot_cleanup(VALUE self) {
+  Snapshot_t *snapshot = self_to_snapshot(self);
+
+  if (snapshot->rc != SQLITE_OK && NIL_P(snapshot->error)) {
+    VALUE klass = snapshot->rc == SQLITE_INTERRUPT ? cInterruptError : cError;
+    const char *msg = snapshot->conn && sqlite3_errcode(snapshot->conn) == snapshot->rc ?
+      sqlite3_errmsg(snapshot->conn) : sqlite3_errstr(snapshot->rc);
+    RB_OBJ_WRITE(self, &snapshot->error, rb_exc_new_cstr(klass, msg));
+  }
+  if (snapshot->conn) {
+    connection_close(snapshot->conn);
+    snapshot->conn = NULL;
+  }
+  // remove incomplete snapshot file
+  if ((snapshot->rc != SQLITE_OK || !NIL_P(snapshot->error)) && snapshot->created)
+    remove(snapshot->dst_filename);
+
+  snapshot->done = 1;
+  return Qnil;
+}
+
+static VALUE snapshot_thread(RB_BLOCK_CALL_FUNC_ARGLIST(self, unused)) {
+  return rb_ensure(SAFE(snapshot_run), self, SAFE(snapshot_cleanup), self);
+}
+
+/* Creates a point-in-time copy of the database at the given path in the
+ * background, and returns a `Snapshot` object that can be used to track its
+ * progress and wait for its completion. The snapshot is performed on a
+ * separate thread, using a separate connection to the database, with the GVL
+ * released, so it does not stall the calling thread.
+ *
+ * If `compact` is true (the default), the snapshot is created using `VACUUM
+ * INTO`, resulting in a compact, defragmented copy. Otherwise the snapshot is
+ * created using the online backup API, resulting in a page by page copy.
+ *
+ * If a block is given, it is called with the snapshot progress, as a number
+ * between 0 and 1, as the snapshot progresses. The block is called on the
+ * snapshot thread. If the block raises an exception, the snapshot is
+ * cancelled.
+ *
+ *     snapshot = db.snapshot_to('snapshot.db') { |p| puts "#{(p * 100).round}%" }
+ *     snapshot.wait
+ *
+ * @param path [String] snapshot file path
+ * @param compact [bool] whether to create a compact copy using `VACUUM INTO`
+ * @yieldparam progress [Float] snapshot progress
+ * @return [Extralite::Snapshot] snapshot
+ */
+VALUE Database_snapshot_to(int argc, VALUE *argv, VALUE self) {
+  static ID kw_ids[1];
+  VALUE kw_args[1];
+  VALUE path;
+  VALUE opts;
+  int compact = 1;
+  struct stat st;
+
+  rb_scan_args(argc, argv, "1:", &path, &opts);
+  if (!NIL_P(opts)) {
+    if (!kw_ids[0]) CONST_ID(kw_ids[0], "compact");
+    rb_get_kwargs(opts, kw_ids, 0, 1, kw_args);
+    if (kw_args[0] != Qundef) compact = RTEST(kw_args[0]);
+  }
+
+  Database_t *db = self_to_database(self);
+  if (!db->sqlite3_db) rb_raise(cError, "Database is closed");
+
+  const char *filename = sqlite3_db_filename(db->sqlite3_db, "main");
+  if (!filename || !*filename)
+    rb_raise(cError, "Snapshots require a file database");
+
+  path = rb_str_new_frozen(rb_funcall(path, ID_to_s, 0));
+  VALUE obj = rb_obj_alloc(cSnapshot);
+  Snapshot_t *snapshot = self_to_snapshot(obj);
+  snapshot->src_filename = strdup(filename);
+  snapshot->dst_filename = strdup(StringValueCStr(path));
+  snapshot->compact = compact;
+  snapshot->created = stat(snapshot->dst_filename, &st) != 0;
+  RB_OBJ_WRITE(obj, &snapshot->path, path);
+  if (rb_block_given_p())
+    RB_OBJ_WRITE(obj, &snapshot->proc, rb_block_proc());
+
+  // the snapshot object is passed to the thread, which keeps it alive
+  VALUE thread = rb_block_call(rb_cThread, ID_new, 1, &obj, snapshot_thread, Qnil);
+  RB_OBJ_WRITE(obj, &snapshot->thread, thread);
+  return obj;
+}
+
+/* Returns the snapshot file path.
+ *
+ * @return [String] snapshot path
+ */
+VALUE Snapshot_path(VALUE self) {
+  return self_to_snapshot(self)->path;
+}
+
+/* Returns true if the snapshot is done, whether it succeeded or not.
+ *
+ * @return [bool] is snapshot done
+ */
+VALUE Snapshot_done_p(VALUE self) {
+  return self_to_snapshot(self)->done ? Qtrue : Qfalse;
+}
+
+/* Returns the snapshot progress, as a number between 0 and 1. For compact
+ * snapshots, the progress is estimated from the size of the snapshot file.
+ *
+ * @return [Float] snapshot progress
+ */
+VALUE Snapshot_progress(VALUE self) {
+  return DBL2NUM(self_to_snapshot(self)->progress);
+}
+
+/* Cancels the snapshot. The snapshot file is removed, and `#value` raises an
+ * `Extralite::InterruptError`.
+ *
+ * @return [Extralite::Snapshot] snapshot
+ */
+VALUE Snapshot_cancel(VALUE self) {
+  self_to_snapshot(self)->cancelled = 1;
+  return self;
+}
+
+/* Waits for the snapshot to complete, with an optional timeout in seconds.
+ * Returns true if the snapshot is done, or false if the timeout has elapsed.
+ *
+ * @param timeout [Numeric, nil] timeout in seconds
+ * @return [bool] is snapshot done
+ */
+VALUE Snapshot_wait(int argc, VALUE *argv, VALUE self) {
+  Snapshot_t *snapshot = self_to_snapshot(self);
+  VALUE timeout;
+
+  rb_scan_args(argc, argv, "01", &timeout);
+  if (!snapshot->done) rb_funcall(snapshot->thread, ID_join, 1, timeout);
+  return snapshot->done ? Qtrue : Qfalse;
+}
+
+/* Waits for the snapshot to complete and returns the snapshot path. If the
+ * snapshot failed, the corresponding error is raised.
+ *
+ * @return [String] snapshot path
+ */
+VALUE Snapshot_value(VALUE self) {
+  Snapshot_t *snapshot = self_to_snapshot(self);
+
+  if (!snapshot->done) rb_funcall(snapshot->thread, ID_join, 0);
+  if (!NIL_P(snapshot->error)) rb_exc_raise(snapshot->error);
+  return snapshot->path;
+}
+
+void Init_ExtraliteSnapshot(void) {
+  VALUE mExtralite = rb_define_module("Extralite");
+
+  rb_define_method(cDatabase, "snapshot_to", Database_snapshot_to, -1);
+
+  cSnapshot = rb_define_class_under(mExtralite, "Snapshot", rb_cObject);
+  rb_define_alloc_func(cSnapshot, Snapshot_allocate);
+  rb_undef_method(CLASS_OF(cSnapshot), "new");
+
+  rb_define_method(cSnapshot, "cancel", Snapshot_cancel, 0);
+  rb_define_method(cSnapshot, "done?", Snapshot_done_p, 0);
+  rb_define_method(cSnapshot, "path", Snapshot_path, 0);
+  rb_define_method(cSnapshot, "progress", Snapshot_progress, 0);
+  rb_define_method(cSnapshot, "value", Snapshot_value, 0);
+  rb_define_method(cSnapshot, "wait", Snapshot_wait, -1);
+}
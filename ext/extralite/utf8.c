@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <string.h>
+#include "extralite.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Text column values are classified while their bytes are still in cache, and
+ * the resulting code range is stored on the new string. This spares Ruby from
+ * scanning the string again on the first comparison, regexp match or
+ * conversion to a symbol.
+ *
+ * The ASCII prefix of each value is scanned in blocks (using SSE2 or AVX2
+ * where available at compile time, or 8 bytes at a time otherwise). Any
+ * remaining bytes are validated as UTF-8 according to RFC 3629, which matches
+ * Ruby's own UTF-8 validation.
+ */
+
+#define ASCII_WORD_MASK 0x8080808080808080ULL
+
+// Returns the length of the ASCII prefix of the given bytes.
+static inline long ascii_prefix_len(const unsigned char *ptr, long len) {
+  long i = 0;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(ptr + i));
+    int mask = _mm256_movemask_epi8(chunk);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(ptr + i));
+    int mask = _mm_movemask_epi8(chunk);
+    if (mask) return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, ptr + i, 8);
+    if (word & ASCII_WORD_MASK) break;
+  }
+  for (; i < len; i++)
+    if (ptr[i] & 0x80) return i;
+  return len;
+}
+
+// Returns the length of the UTF-8 sequence at the given position, or 0 if the
+// sequence is malformed.
+static inline int utf8_sequence_len(const unsigned char *p, const unsigned char *end) {
+  unsigned char c = p[0];
+  long left = end - p;
+
+  if (c < 0x80) return 1;
+  if (c < 0xC2) return 0;
+  if (c < 0xE0) {
+    if (left < 2 || (p[1] & 0xC0) != 0x80) return 0;
+    return 2;
+  }
+  if (c < 0xF0) {
+    if (left < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80) return 0;
+    if (c == 0xE0 && p[1] < 0xA0) return 0; // overlong
+    if (c == 0xED && p[1] > 0x9F) return 0; // surrogate
+    return 3;
+  }
+  if (c < 0xF5) {
+    if (left < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+      return 0;
+    if (c == 0xF0 && p[1] < 0x90) return 0; // overlong
+    if (c == 0xF4 && p[1] > 0x8F) return 0; // above U+10FFFF
+    return 4;
+  }
+  return 0;
+}
+
+static int utf8_coderange(const char *str, long len) {
+  const unsigned char *ptr = (const unsigned char *)str;
+  long i = ascii_prefix_len(ptr, len);
+  if (i == len) return ENC_CODERANGE_7BIT;
+
+  const unsigned char *p = ptr + i;
+  const unsigned char *end = ptr + len;
+  while (p < end) {
+    if (*p < 0x80) {
+      p += ascii_prefix_len(p, end - p);
+      continue;
+    }
+    int seq_len = utf8_sequence_len(p, end);
+    if (!seq_len) return ENC_CODERANGE_BROKEN;
+    p += seq_len;
+  }
+  return ENC_CODERANGE_VALID;
+}
+
+VALUE utf8_str_new(const char *ptr, long len) {
+  VALUE str = rb_enc_str_new(ptr, len, UTF8_ENCODING);
+  ENC_CODERANGE_SET(str, utf8_coderange(ptr, len));
+  return str;
+}
@@ -113,6 +113,8 @@ module Sequel
       #              static data that you do not want to modify
       # :timeout :: how long to wait for the database to be available if it
       #             is locked, given in milliseconds (default is 5000)
+      # :decode_types :: convert date, datetime, boolean and decimal column
+      #                  values natively according to the declared column type
       def connect(server)
         opts = server_opts(server)
         opts[:database] = ':memory:' if blank_object?(opts[:database])
@@ -120,6 +122,7 @@ module Sequel
         db_opts = {}
         db_opts[:readonly] = typecast_value_boolean(opts[:readonly]) if opts.has_key?(:readonly)
         db = ::Extralite::Database.new(opts[:database].to_s)
+        db.decode_types = true if typecast_value_boolean(opts[:decode_types])
         # db.busy_timeout(typecast_value_integer(opts.fetch(:timeout, 5000)))
 
         connection_pragmas.each{|s| log_connection_yield(s, db){db.query(s)}}
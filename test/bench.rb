@@ -0,0 +1,100 @@
+# frozen_string_literal: true
+
+# Read, write and concurrency benchmarks across all query modes. Run with
+# `rake bench`, see test/bench_helper.rb for configuration options.
+
+require_relative 'bench_helper'
+
+SELECT_SQL = 'select * from foo'
+INSERT_SQL = 'insert into bar (b, c) values (?, ?)'
+GVL_RELEASE_THRESHOLDS = [-1, 0, 1000]
+
+def open_db(path, **opts)
+  Extralite::Database.new(path, wal: true, **opts)
+end
+
+def read_benchmarks(suite, path, count)
+  db = open_db(path)
+  Bench.prepare_table(db, count)
+  params = { rows: count }
+
+  Bench.report(suite, 'read_hash', params) do
+    Bench.measure { db.query(SELECT_SQL).size }
+  end
+
+  Bench.report(suite, 'read_array', params) do
+    Bench.measure { db.query_array(SELECT_SQL).size }
+  end
+
+  Bench.report(suite, 'read_splat', params) do
+    Bench.measure do
+      n = 0
+      db.query_splat(SELECT_SQL) { |_a, _b, _c| n += 1 }
+      n
+    end
+  end
+
+  transform = ->(h) { h[:a] }
+  Bench.report(suite, 'read_transform', params) do
+    Bench.measure { db.query(transform, SELECT_SQL).size }
+  end
+
+  query = db.prepare(SELECT_SQL)
+  Bench.report(suite, 'read_prepared', params) do
+    Bench.measure { query.to_a.size }
+  end
+
+  batch_params = (1..[count, 100].min).to_a
+  Bench.report(suite, 'read_batch', params) do
+    Bench.measure { db.batch_query('select * from foo where a = ?', batch_params).size }
+  end
+
+  concurrency_benchmarks(suite, path, count)
+ensure
+  db&.close
+end
+
+def concurrency_benchmarks(suite, path, count)
+  Bench.config[:threads].each do |threads|
+    GVL_RELEASE_THRESHOLDS.each do |threshold|
+      params = { rows: count, gvl_release_threshold: threshold }
+      Bench.report(suite, 'read_concurrent', params) do
+        setup = ->(_) { open_db(path, gvl_release_threshold: threshold) }
+        Bench.measure(threads: threads, setup: setup) { |db| db.query_array(SELECT_SQL).size }
+      end
+    end
+  end
+end
+
+def write_benchmarks(suite, path)
+  db = open_db(path)
+  db.execute('create table bar (a integer primary key, b text, c float)')
+
+  Bench.report(suite, 'write_insert') do
+    Bench.measure { db.execute(INSERT_SQL, 'hello', 1.5) }
+  end
+
+  Bench.report(suite, 'write_insert_transaction') do
+    Bench.measure do
+      db.transaction { 100.times { db.execute(INSERT_SQL, 'hello', 1.5) } }
+      100
+    end
+  end
+
+  Bench.config[:rows].each do |count|
+    records = (1..count).map { |i| ["hello#{i}", i / 3.0] }
+    Bench.report(suite, 'write_batch', { rows: count }) do
+      Bench.measure { db.transaction { db.batch_execute(INSERT_SQL, records) } }
+    end
+  end
+ensure
+  db&.close
+end
+
+Bench.run('query', __FILE__) do |suite|
+  path = Bench.db_path('query')
+  Bench.config[:rows].each { |count| read_benchmarks(suite, path, count) }
+  write_benchmarks(suite, path)
+ensure
+  FileUtils.rm_f([path, "#{path}-wal", "#{path}-shm"])
+end
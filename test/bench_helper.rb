@@ -0,0 +1,239 @@
+# frozen_string_literal: true
+
+# Shared harness for the benchmark suites (test/bench*.rb). Uses only the Ruby
+# standard library, and loads extralite from the source tree, so the extension
+# must be compiled first (`rake compile`).
+#
+# Benchmarks are configured using environment variables:
+#
+# - `BENCH_ROWS`: comma-separated row counts (default: `10,1000,100000`)
+# - `BENCH_THREADS`: comma-separated thread counts (default: `1,2,4,8`)
+# - `BENCH_DURATION`: measurement duration per case, in seconds (default: `2`)
+# - `BENCH_WARMUP`: warmup duration per case, in seconds (default: `0.5`)
+# - `BENCH_YJIT`: `both`, `on` or `off` (default: `both` if YJIT is available)
+# - `BENCH_FILTER`: only run cases whose name matches the given regexp
+# - `BENCH_OUTPUT`: path of JSON output file (default: stdout)
+#
+# Results are emitted as a single JSON document, progress is reported on
+# stderr.
+
+$LOAD_PATH.unshift(File.expand_path('../lib', __dir__))
+require 'extralite'
+require 'extralite/version'
+require 'json'
+require 'etc'
+require 'fileutils'
+require 'rbconfig'
+require 'time'
+require 'tmpdir'
+
+module Bench
+  Suite = Struct.new(:name, :results)
+
+  class << self
+    def config
+      @config ||= {
+        rows:     list_env('BENCH_ROWS', [10, 1000, 100000]),
+        threads:  list_env('BENCH_THREADS', [1, 2, 4, 8]),
+        duration: Float(ENV['BENCH_DURATION'] || 2),
+        warmup:   Float(ENV['BENCH_WARMUP'] || 0.5),
+        yjit:     ENV['BENCH_YJIT'] || (yjit_available? ? 'both' : 'off'),
+        filter:   ENV['BENCH_FILTER'] && Regexp.new(ENV['BENCH_FILTER']),
+        output:   ENV['BENCH_OUTPUT']
+      }
+    end
+
+    def yjit_available?
+      defined?(RubyVM::YJIT) ? true : false
+    end
+
+    def yjit_enabled?
+      yjit_available? && RubyVM::YJIT.enabled?
+    end
+
+    def now
+      Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    end
+
+    def log(msg)
+      $stderr.puts(msg)
+    end
+
+    def meta
+      {
+        extralite_version: Extralite::VERSION,
+        sqlite3_version: Extralite.sqlite3_version,
+        ruby_version: RUBY_VERSION,
+        ruby_platform: RUBY_PLATFORM,
+        cpu_count: Etc.nprocessors,
+        git_revision: git_revision,
+        time: Time.now.utc.iso8601
+      }
+    end
+
+    # Runs the given suite. Unless running as a child process, the suite is
+    # run in a separate process for each YJIT setting, and the results are
+    # combined into a single JSON document.
+    def run(name, script, &block)
+      if ENV['BENCH_CHILD']
+        suite = Suite.new(name, [])
+        block.(suite)
+        $stdout.puts(JSON.generate(suite.results))
+        return
+      end
+
+      results = yjit_settings.flat_map { |yjit| run_child(script, yjit) }
+      doc = JSON.pretty_generate({ suite: name, meta: meta, config: public_config, results: results })
+      if config[:output]
+        File.write(config[:output], doc)
+        log("Results written to #{config[:output]}")
+      else
+        $stdout.puts(doc)
+      end
+    end
+
+    # Adds a benchmark case to the suite. The block is called with the suite
+    # and should return the measured stats (see #measure).
+    def report(suite, name, params = {})
+      return if config[:filter] && name !~ config[:filter]
+
+      stats = yield
+      result = { name: name, yjit: yjit_enabled?, **params, **stats }
+      log(format_result(result))
+      suite.results << result
+    end
+
+    # Measures the given block, calling it repeatedly for the configured
+    # duration on each of the given number of threads. The setup proc is
+    # called once per thread with the thread index, and its return value is
+    # passed to the block along with a hash of counters that the block may
+    # update. The block should return the number of units (e.g. rows)
+    # processed, or nil for 1.
+    #
+    # `Extralite::BusyError` exceptions raised by the block are counted as
+    # errors and do not interrupt the measurement.
+    def measure(threads: 1, duration: config[:duration], warmup: config[:warmup], setup: nil, &block)
+      contexts = threads.times.map { |i| setup ? setup.(i) : nil }
+      run_threads(contexts, warmup, &block) if warmup > 0
+      latencies, units, errors, counters, elapsed = run_threads(contexts, duration, &block)
+      contexts.each { |ctx| ctx.close if ctx.respond_to?(:close) }
+
+      iterations = latencies.size + errors
+      latencies.sort!
+      {
+        threads: threads,
+        iterations: iterations,
+        elapsed_s: elapsed.round(4),
+        ops_per_sec: (latencies.size / elapsed).round(2),
+        units_per_sec: (units / elapsed).round(2),
+        latency_us: {
+          p50: percentile_us(latencies, 50),
+          p99: percentile_us(latencies, 99),
+          max: percentile_us(latencies, 100)
+        },
+        errors: errors,
+        error_rate: iterations == 0 ? 0.0 : (errors.to_f / iterations).round(6),
+        **counters
+      }
+    end
+
+    def percentile_us(sorted, pct)
+      return nil if sorted.empty?
+
+      idx = ((sorted.size - 1) * pct / 100.0).round
+      (sorted[idx] * 1_000_000).round(2)
+    end
+
+    # Returns a path for a temporary database file, removing any leftover
+    # database files from previous runs.
+    def db_path(name)
+      path = File.join(Dir.tmpdir, "extralite-bench-#{name}-#{Process.pid}.db")
+      FileUtils.rm_f([path, "#{path}-wal", "#{path}-shm"])
+      path
+    end
+
+    def prepare_table(db, count)
+      db.execute('create table if not exists foo (a integer primary key, b text, c float)')
+      db.execute('delete from foo')
+      db.transaction do
+        db.batch_execute('insert into foo (b, c) values (?, ?)', (1..count).map { |i| ["hello#{i}", i / 3.0] })
+      end
+    end
+
+    private
+
+    def list_env(key, default)
+      ENV[key] ? ENV[key].split(',').map { |v| Integer(v) } : default
+    end
+
+    def public_config
+      config.merge(filter: config[:filter]&.source)
+    end
+
+    def yjit_settings
+      case config[:yjit]
+      when 'both' then yjit_available? ? [false, true] : [false]
+      when 'on'   then [true]
+      else [false]
+      end
+    end
+
+    def run_child(script, yjit)
+      env = { 'BENCH_CHILD' => '1', 'RUBY_YJIT_ENABLE' => nil }
+      cmd = [RbConfig.ruby, *(yjit ? ['--yjit'] : []), script]
+      out = IO.popen(env, cmd, &:read)
+      raise "Benchmark process failed (#{cmd.join(' ')})" unless $?.success?
+
+      JSON.parse(out, symbolize_names: true)
+    end
+
+    def run_threads(contexts, duration, &block)
+      t0 = now
+      deadline = t0 + duration
+      threads = contexts.map do |ctx|
+        Thread.new do
+          latencies = []
+          units = 0
+          errors = 0
+          counters = Hash.new(0)
+          while (t = now) < deadline
+            begin
+              units += block.(ctx, counters) || 1
+              latencies << now - t
+            rescue Extralite::BusyError
+              errors += 1
+            end
+          end
+          [latencies, units, errors, counters]
+        end
+      end
+      per_thread = threads.map(&:value)
+      elapsed = now - t0
+
+      counters = per_thread.each_with_object(Hash.new(0)) do |(_, _, _, c), h|
+        c.each { |k, v| h[k] += v }
+      end
+      [
+        per_thread.flat_map(&:first),
+        per_thread.sum { |(_, units)| units },
+        per_thread.sum { |(_, _, errors)| errors },
+        counters.transform_values { |v| v.is_a?(Float) ? v.round(6) : v },
+        elapsed
+      ]
+    end
+
+    def format_result(result)
+      params = result.reject { |k, _| %i[name yjit threads iterations elapsed_s ops_per_sec units_per_sec latency_us errors error_rate].include?(k) }
+      format(
+        '%-28s yjit=%-5s threads=%d%s: %.1f ops/s, %.1f units/s, p50=%sus p99=%sus errors=%d',
+        result[:name], result[:yjit], result[:threads], params.map { |k, v| " #{k}=#{v}" }.join,
+        result[:ops_per_sec], result[:units_per_sec], result[:latency_us][:p50], result[:latency_us][:p99], result[:errors]
+      )
+    end
+
+    def git_revision
+      rev = `git -C #{File.expand_path('..', __dir__)} rev-parse --short HEAD 2>/dev/null`.chomp
+      rev.empty? ? nil : rev
+    end
+  end
+end
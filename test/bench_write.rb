@@ -0,0 +1,153 @@
+# frozen_string_literal: true
+
+# Write throughput and contention benchmarks. Run with `rake bench:write`, see
+# test/bench_helper.rb for configuration options. `BENCH_ROWS` sets the batch
+# sizes, and `BENCH_THREADS` the number of contending writer threads.
+#
+# Contention cases are run with two busy strategies:
+#
+# - `none`: no busy handler, busy errors are counted and the operation is
+#   retried on the next iteration.
+# - `retry`: busy errors are retried after sleeping for a short period, with
+#   the time spent waiting reported as `busy_wait_s`.
+
+require_relative 'bench_helper'
+
+INSERT_SQL = 'insert into items (k, v) values (?, ?)'
+UPSERT_SQL = 'insert into items (k, v) values (?, ?) on conflict (k) do update set v = excluded.v'
+SELECT_SQL = 'select * from items order by k desc limit 10'
+BUSY_SLEEP = 0.0001
+READER_THREADS = 2
+
+def open_db(path)
+  Extralite::Database.new(path, wal: true)
+end
+
+def reset_table(db)
+  db.execute('drop table if exists items')
+  db.execute('create table items (k integer primary key, v text)')
+end
+
+def single_benchmarks(suite, db)
+  reset_table(db)
+  Bench.report(suite, 'insert_single') do
+    Bench.measure { db.execute('insert into items (v) values (?)', 'hello') }
+  end
+
+  reset_table(db)
+  Bench.report(suite, 'upsert') do
+    Bench.measure { db.execute(UPSERT_SQL, rand(10_000), 'hello') }
+  end
+end
+
+def batch_benchmarks(suite, db)
+  Bench.config[:rows].each do |count|
+    params = { rows: count }
+
+    reset_table(db)
+    records = (1..count).map { |i| [nil, "hello#{i}"] }
+    Bench.report(suite, 'batch_array', params) do
+      Bench.measure { db.transaction { db.batch_execute(INSERT_SQL, records) } }
+    end
+
+    reset_table(db)
+    Bench.report(suite, 'batch_enumerable', params) do
+      Bench.measure { db.transaction { db.batch_execute('insert into items (v) values (?)', 1..count) } }
+    end
+
+    reset_table(db)
+    Bench.report(suite, 'batch_proc', params) do
+      Bench.measure do
+        i = 0
+        source = -> { (i += 1) <= count ? [nil, "hello#{i}"] : nil }
+        db.transaction { db.batch_execute(INSERT_SQL, source) }
+      end
+    end
+
+    reset_table(db)
+    upserts = (1..count).map { |i| [i % 1000, "hello#{i}"] }
+    Bench.report(suite, 'batch_upsert', params) do
+      Bench.measure { db.transaction { db.batch_execute(UPSERT_SQL, upserts) } }
+    end
+  end
+end
+
+# Starts an immediate transaction. With the retry busy strategy, sleeps and
+# retries while the database is locked by another writer.
+def begin_transaction(db, busy, counters)
+  db.execute('begin immediate')
+rescue Extralite::BusyError
+  raise if busy == 'none'
+
+  t0 = Bench.now
+  sleep(BUSY_SLEEP)
+  counters[:busy_waits] += 1
+  counters[:busy_wait_s] += Bench.now - t0
+  retry
+end
+
+def write_items(db, busy, counters)
+  begin_transaction(db, busy, counters)
+  begin
+    10.times { db.execute('insert into items (v) values (?)', 'hello') }
+    db.execute('commit')
+  rescue
+    db.execute('rollback')
+    raise
+  end
+  10
+end
+
+# Runs reader threads in the background while the given block is running, and
+# returns the block's result along with the reader throughput.
+def with_readers(path)
+  stop = false
+  readers = READER_THREADS.times.map do
+    Thread.new do
+      db = open_db(path)
+      count = 0
+      until stop
+        db.query(SELECT_SQL)
+        count += 1
+      end
+      db.close
+      count
+    end
+  end
+  t0 = Bench.now
+  stats = yield
+  reads = readers.tap { stop = true }.sum(&:value)
+  stats.merge(reads_per_sec: (reads / (Bench.now - t0)).round(2))
+end
+
+def contention_benchmarks(suite, path)
+  db = open_db(path)
+  reset_table(db)
+  db.close
+
+  Bench.config[:threads].each do |threads|
+    %w[none retry].each do |busy|
+      params = { writers: threads, readers: READER_THREADS, busy: busy }
+      Bench.report(suite, 'mixed_read_write', params) do
+        with_readers(path) do
+          setup = ->(_) { open_db(path) }
+          stats = Bench.measure(threads: threads, setup: setup) do |db, counters|
+            write_items(db, busy, counters)
+          end
+          { busy_waits: 0, busy_wait_s: 0.0 }.merge(stats)
+        end
+      end
+    end
+  end
+end
+
+Bench.run('write', __FILE__) do |suite|
+  path = Bench.db_path('write')
+  db = open_db(path)
+  single_benchmarks(suite, db)
+  batch_benchmarks(suite, db)
+  db.close
+  contention_benchmarks(suite, path)
+ensure
+  FileUtils.rm_f([path, "#{path}-wal", "#{path}-shm"])
+end
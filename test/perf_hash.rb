@@ -28,6 +28,17 @@ def prepare_database(count)
   $extralite_db.query('commit')
 end
 
+WIDE_COLUMNS = (1..30).map { |i| "c#{i}" }
+
+def prepare_wide_database(count)
+  $extralite_db.query('drop table if exists wide')
+  $extralite_db.query("create table wide (#{WIDE_COLUMNS.join(', ')})")
+  $extralite_db.transaction do
+    values = WIDE_COLUMNS.map.with_index { |_, i| i.even? ? i : "hello#{i}" }
+    $extralite_db.batch_execute("insert into wide values (#{(['?'] * 30).join(', ')})", [values] * count)
+  end
+end
+
 def sqlite3_run(count)
   results = $sqlite3_db.execute('select * from foo')
   raise unless results.size == count
@@ -38,6 +49,16 @@ def extralite_run(count)
   raise unless results.size == count
 end
 
+def sqlite3_run_wide(count)
+  results = $sqlite3_db.execute('select * from wide')
+  raise unless results.size == count
+end
+
+def extralite_run_wide(count)
+  results = $extralite_db.query('select * from wide')
+  raise unless results.size == count
+end
+
 [10, 1000, 100000].each do |c|
   puts "Record count: #{c}"
   prepare_database(c)
@@ -54,3 +75,20 @@ end
   bm.entries.each { |e| puts "#{e.label}: #{(e.ips * c).round.to_i} rows/s" }
   puts;
 end
+
+[10, 1000, 100000].each do |c|
+  puts "Record count (30 columns): #{c}"
+  prepare_wide_database(c)
+
+  bm = Benchmark.ips do |x|
+    x.config(:time => 5, :warmup => 2)
+
+    x.report("sqlite3") { sqlite3_run_wide(c) }
+    x.report("extralite") { extralite_run_wide(c) }
+
+    x.compare!
+  end
+  puts;
+  bm.entries.each { |e| puts "#{e.label}: #{(e.ips * c).round.to_i} rows/s" }
+  puts;
+end
@@ -0,0 +1,157 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'stringio'
+require 'tempfile'
+
+class BlobIOTest < Minitest::Test
+  IMAGE_FN = File.join(__dir__, 'fixtures/image.png')
+
+  def setup
+    @db = Extralite::Database.new(':memory:')
+    @db.execute('create table t (id integer primary key, data blob)')
+    @image = File.binread(IMAGE_FN)
+    @db.execute('insert into t (data) values (?)', Extralite::Blob.new(@image))
+    @db.execute('insert into t (data) values (?)', Extralite::Blob.new('foobar'))
+  end
+
+  def teardown
+    @db.close
+  end
+
+  def test_blob_open
+    blob = @db.blob_open('t', 'data', 1)
+    assert_kind_of Extralite::BlobIO, blob
+    assert_equal @db, blob.database
+    assert_equal @image.bytesize, blob.size
+    assert_equal false, blob.closed?
+    blob.close
+    assert_equal true, blob.closed?
+    assert_raises(Extralite::Error) { blob.read }
+
+    assert_raises(Extralite::Error) { @db.blob_open('t', 'data', 3) }
+    assert_raises(Extralite::Error) { @db.blob_open('t', 'foo', 1) }
+    assert_raises(ArgumentError) { @db.blob_open('t', 'data', 1, 'x') }
+  end
+
+  def test_blob_open_with_block
+    blob = nil
+    data = @db.blob_open(:t, :data, 2) { |b| blob = b; b.read }
+    assert_equal 'foobar', data
+    assert_equal Encoding::ASCII_8BIT, data.encoding
+    assert_equal true, blob.closed?
+  end
+
+  def test_blob_read
+    @db.blob_open('t', 'data', 2) do |blob|
+      assert_equal 'foo', blob.read(3)
+      assert_equal 3, blob.pos
+      assert_equal 'ba', blob.read(2)
+      assert_equal 'r', blob.read(10)
+      assert_equal true, blob.eof?
+      assert_nil blob.read(1)
+      assert_equal '', blob.read
+
+      blob.rewind
+      buf = +'xxxxxxxxxx'
+      assert_same buf, blob.read(4, buf)
+      assert_equal 'foob', buf
+      assert_equal 'ar', blob.readpartial(10)
+      assert_raises(EOFError) { blob.readpartial(10) }
+    end
+
+    data = @db.blob_open('t', 'data', 1) { |b| b.read }
+    assert_equal @image, data
+  end
+
+  def test_blob_seek
+    @db.blob_open('t', 'data', 2) do |blob|
+      assert_equal 0, blob.seek(3)
+      assert_equal 'bar', blob.read
+      blob.seek(-2, IO::SEEK_END)
+      assert_equal 'ar', blob.read
+      blob.seek(1, IO::SEEK_SET)
+      blob.seek(1, :CUR)
+      assert_equal 2, blob.tell
+      blob.pos = 5
+      assert_equal 'r', blob.read
+      assert_raises(ArgumentError) { blob.seek(-1) }
+    end
+  end
+
+  def test_blob_write
+    assert_raises(Extralite::Error) { @db.blob_open('t', 'data', 2) { |b| b.write('x') } }
+
+    @db.blob_open('t', 'data', 2, 'w') do |blob|
+      assert_equal 3, blob.write('baz')
+      blob << 'q' << 'u'
+      assert_equal 5, blob.pos
+      assert_raises(Extralite::Error) { blob.write('xy') }
+    end
+    assert_equal 'bazqur', @db.query_single_splat('select data from t where id = 2')
+  end
+
+  def test_blob_reopen
+    @db.blob_open('t', 'data', 1) do |blob|
+      blob.read(10)
+      blob.reopen(2)
+      assert_equal 0, blob.pos
+      assert_equal 6, blob.size
+      assert_equal 'foobar', blob.read
+    end
+  end
+
+  def test_blob_invalidated
+    @db.blob_open('t', 'data', 2) do |blob|
+      @db.execute("update t set data = 'baz' where id = 2")
+      assert_raises(Extralite::Error) { blob.read }
+    end
+  end
+
+  def test_blob_copy_stream
+    out = StringIO.new(''.b)
+    @db.blob_open('t', 'data', 1) { |blob| IO.copy_stream(blob, out) }
+    assert_equal @image, out.string
+
+    @db.execute('insert into t (data) values (zeroblob(?))', @image.bytesize)
+    id = @db.last_insert_rowid
+    File.open(IMAGE_FN, 'rb') do |f|
+      @db.blob_open('t', 'data', id, 'w') { |blob| IO.copy_stream(f, blob) }
+    end
+    assert_equal @image, @db.query_single_splat('select data from t where id = ?', id)
+  end
+
+  def test_blob_large
+    size = 3 * 1024 * 1024 + 17
+    data = Random.new(42).bytes(size)
+    @db.execute('insert into t (data) values (zeroblob(?))', size)
+    id = @db.last_insert_rowid
+
+    @db.blob_open('t', 'data', id, 'w') { |blob| blob.write(data) }
+    assert_equal data, @db.blob_open('t', 'data', id) { |blob| blob.read }
+  end
+
+  def test_blob_close_during_transfer
+    size = 16 * 1024 * 1024
+    data = Random.new(42).bytes(size)
+    @db.execute('insert into t (data) values (?)', Extralite::Blob.new(data))
+    blob = @db.blob_open('t', 'data', @db.last_insert_rowid)
+
+    reader = Thread.new { blob.read }
+    Thread.pass
+    begin
+      blob.close
+    rescue Extralite::Error
+      Thread.pass
+      retry
+    end
+    result = begin
+      reader.value
+    rescue Extralite::Error
+      nil
+    end
+    # the read either completes before the blob is closed, or does not start
+    assert_includes [data, nil], result
+    assert_equal true, blob.closed?
+  end
+end
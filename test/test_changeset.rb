@@ -3,6 +3,7 @@
 require_relative 'helper'
 
 require 'date'
+require 'stringio'
 require 'tempfile'
 
 class ChangesetTest < Minitest::Test
@@ -158,4 +159,405 @@ class ChangesetTest < Minitest::Test
 
     assert_raises(Extralite::Error) { changeset.to_a }
   end
+
+  def test_write_to
+    changeset = @db.track_changes(:t) do
+      @db.execute('insert into t values (1, 2, 3)')
+      @db.execute('insert into t values (4, 5, 6)')
+    end
+
+    io = StringIO.new(+'')
+    assert_equal changeset, changeset.write_to(io)
+    assert_equal changeset.to_blob, io.string
+  end
+
+  def test_stream_track
+    io = StringIO.new(+'')
+    ret = Extralite::Changeset.stream_track(@db, io, :t) do
+      (1..1000).each { |i| @db.execute('insert into t values (?, ?, ?)', i, i * 2, 'x' * 100) }
+    end
+    assert_equal io.string.bytesize, ret
+
+    changeset = Extralite::Changeset.new.load(io.string)
+    assert_equal 1000, changeset.to_a.size
+    assert_includes changeset.to_a, [:insert, 't', nil, [1000, 2000, 'x' * 100]]
+
+    io = StringIO.new(+'')
+    Extralite::Changeset.stream_track(@db, io) do
+      @db.execute('delete from t where x = 1')
+    end
+    assert_equal [[:delete, 't', [1, 2, 'x' * 100], nil]], Extralite::Changeset.new.load(io.string).to_a
+  end
+
+  def test_stream_track_write_error
+    io = Object.new
+    def io.write(_) = raise(IOError, 'foo')
+
+    assert_raises(IOError) do
+      Extralite::Changeset.stream_track(@db, io, :t) do
+        @db.execute('insert into t values (1, 2, 3)')
+      end
+    end
+  end
+
+  def test_apply_from
+    io = Tempfile.new
+    Extralite::Changeset.stream_track(@db, io, :t) do
+      (1..1000).each { |i| @db.execute('insert into t values (?, ?, ?)', i, i * 2, 'x' * 100) }
+    end
+    io.rewind
+
+    db2 = Extralite::Database.new(':memory:')
+    db2.execute('create table if not exists t (x integer primary key, y, z)')
+    stats = Extralite::Changeset.apply_from(db2, io)
+    assert_equal 1000, stats[:applied]
+
+    assert_equal 1000, db2.query_single_splat('select count(*) from t')
+    assert_equal @db.query('select * from t'), db2.query('select * from t')
+  ensure
+    io&.close!
+  end
+
+  def test_apply_from_read_error
+    io = Object.new
+    def io.read(_) = raise(IOError, 'foo')
+
+    assert_raises(IOError) { Extralite::Changeset.apply_from(@db, io) }
+  end
+
+  def test_concat
+    c1 = @db.track_changes(:t) { @db.execute('insert into t values (1, 2, 3)') }
+    c2 = @db.track_changes(:t) { @db.execute('update t set y = 22 where x = 1') }
+    c3 = @db.track_changes(:t) { @db.execute('insert into t values (4, 5, 6)') }
+    c4 = @db.track_changes(:t) { @db.execute('delete from t where x = 4') }
+
+    combined = Extralite::Changeset.concat(c1, c2.to_blob, c3, c4)
+    assert_kind_of Extralite::Changeset, combined
+    assert_equal [
+      [:insert, 't', nil, [1, 22, 3]]
+    ], combined.to_a
+
+    db2 = Extralite::Database.new(':memory:')
+    db2.execute('create table if not exists t (x integer primary key, y, z)')
+    combined.apply(db2)
+    assert_equal [{ x: 1, y: 22, z: 3 }], db2.query('select * from t')
+
+    assert_raises(Extralite::Error) { Extralite::Changeset.concat(Extralite::Changeset.new) }
+  end
+
+  def test_change_group
+    group = Extralite::ChangeGroup.new
+    100.times do |i|
+      group << @db.track_changes(:t) do
+        @db.execute('insert or replace into t values (1, ?, ?)', i, i * 2)
+      end
+    end
+
+    assert_equal [
+      [:insert, 't', nil, [1, 99, 198]]
+    ], group.to_changeset.to_a
+  end
+
+  def test_change_group_streaming
+    ios = 2.times.map do |i|
+      io = StringIO.new(+'')
+      Extralite::Changeset.stream_track(@db, io, :t) do
+        @db.execute('insert into t values (?, ?, ?)', i, i, i)
+      end
+      io.rewind
+      io
+    end
+
+    group = Extralite::ChangeGroup.new
+    ios.each { |io| assert_equal group, group.add_from(io) }
+
+    out = StringIO.new(+'')
+    bytes = group.write_to(out)
+    assert_equal out.string.bytesize, bytes
+    assert_equal group.to_changeset.to_blob, out.string
+    assert_equal [
+      [:insert, 't', nil, [0, 0, 0]],
+      [:insert, 't', nil, [1, 1, 1]]
+    ], Extralite::Changeset.new.load(out.string).to_a.sort_by { |c| c[3][0] }
+  end
+
+  def conflicting_changeset
+    changeset = @db.track_changes(:t) do
+      @db.execute('insert into t values (1, 2, 3)')
+      @db.execute('insert into t values (4, 5, 6)')
+      @db.execute('insert into t values (7, 8, 9)')
+    end
+
+    db2 = Extralite::Database.new(':memory:')
+    db2.execute('create table if not exists t (x integer primary key, y, z)')
+    db2.execute('insert into t values (4, 50, 60)')
+    [changeset, db2]
+  end
+
+  def test_apply_on_conflict_replace
+    changeset, db2 = conflicting_changeset
+
+    assert_equal changeset, changeset.apply(db2, on_conflict: :replace)
+    assert_equal [[1, 2, 3], [4, 5, 6], [7, 8, 9]], db2.query_array('select * from t order by x')
+    assert_equal({ applied: 3, conflicts: 1, replaced: 1, omitted: 0 }, changeset.apply_stats)
+  end
+
+  def test_apply_on_conflict_omit
+    changeset, db2 = conflicting_changeset
+
+    changeset.apply(db2, on_conflict: :omit)
+    assert_equal [[1, 2, 3], [4, 50, 60], [7, 8, 9]], db2.query_array('select * from t order by x')
+    assert_equal({ applied: 2, conflicts: 1, replaced: 0, omitted: 1 }, changeset.apply_stats)
+  end
+
+  def test_apply_on_conflict_abort
+    changeset, db2 = conflicting_changeset
+
+    assert_raises(Extralite::Error) { changeset.apply(db2, on_conflict: :abort) }
+    assert_equal [[4, 50, 60]], db2.query_array('select * from t order by x')
+  end
+
+  def test_apply_on_conflict_proc
+    changeset, db2 = conflicting_changeset
+
+    conflicts = []
+    changeset.apply(db2, on_conflict: ->(type, change) { conflicts << [type, change]; :omit })
+    assert_equal [[:conflict, [:insert, 't', nil, [4, 5, 6]]]], conflicts
+    assert_equal [[1, 2, 3], [4, 50, 60], [7, 8, 9]], db2.query_array('select * from t order by x')
+
+    db2.execute('delete from t')
+    db2.execute('insert into t values (4, 50, 60)')
+    assert_raises(RuntimeError) { changeset.apply(db2, on_conflict: ->(*) { raise 'foo' }) }
+    assert_equal [[4, 50, 60]], db2.query_array('select * from t order by x')
+
+    assert_raises(ArgumentError) { changeset.apply(db2, on_conflict: ->(*) { :foo }) }
+    assert_raises(ArgumentError) { changeset.apply(db2, on_conflict: :foo) }
+  end
+
+  def test_modify_while_in_use
+    changeset, db2 = conflicting_changeset
+    blob = changeset.to_blob
+
+    errors = []
+    changeset.apply(db2, on_conflict: ->(*) {
+      errors << assert_raises(Extralite::Error) { changeset.load(blob) }
+      errors << assert_raises(Extralite::Error) { changeset.track(@db, [:t]) {} }
+      :omit
+    })
+    assert_equal 2, errors.size
+    assert_match(/in use/, errors.first.message)
+
+    changeset.each { assert_raises(Extralite::Error) { changeset.load(blob) } }
+
+    io = Object.new
+    io.define_singleton_method(:write) { |_| changeset.load(blob) }
+    assert_raises(Extralite::Error) { changeset.write_to(io) }
+
+    # the changeset can be modified again once no longer in use
+    changeset.load(blob)
+    assert_equal blob, changeset.to_blob
+  end
+
+  def test_apply_replace_not_found
+    changeset = @db.track_changes(:t) do
+      @db.execute('insert into t values (1, 2, 3)')
+    end
+    changeset = @db.track_changes(:t) do
+      @db.execute('update t set y = 22 where x = 1')
+    end
+
+    db2 = Extralite::Database.new(':memory:')
+    db2.execute('create table if not exists t (x integer primary key, y, z)')
+
+    changeset.apply(db2)
+    assert_equal [], db2.query('select * from t')
+    assert_equal({ applied: 0, conflicts: 1, replaced: 0, omitted: 1 }, changeset.apply_stats)
+  end
+
+  def test_apply_from_on_conflict
+    changeset, db2 = conflicting_changeset
+
+    io = StringIO.new(changeset.to_blob)
+    stats = Extralite::Changeset.apply_from(db2, io, on_conflict: :omit)
+    assert_equal({ applied: 2, conflicts: 1, replaced: 0, omitted: 1 }, stats)
+    assert_equal [[1, 2, 3], [4, 50, 60], [7, 8, 9]], db2.query_array('select * from t order by x')
+  end
+
+  def test_track_patches
+    @db.execute('insert into t values (1, 2, 3)')
+    @db.execute('insert into t values (4, 5, 6)')
+
+    db2 = Extralite::Database.new(':memory:')
+    db2.execute('create table if not exists t (x integer primary key, y, z)')
+    db2.execute('insert into t values (1, 2, 3)')
+    db2.execute('insert into t values (4, 5, 6)')
+
+    changeset = @db.track_changes(:t) do
+      @db.execute('update t set y = 22 where x = 1')
+      @db.execute('delete from t where x = 4')
+    end
+    patchset = @db.track_patches(:t) do
+      @db.execute('update t set z = 33 where x = 1')
+      @db.execute('insert into t values (7, 8, 9)')
+    end
+
+    assert_equal false, changeset.patchset?
+    assert_equal true, patchset.patchset?
+    assert_equal [
+      [:update, 't', [1, nil, nil], [nil, nil, 33]],
+      [:insert, 't', nil, [7, 8, 9]]
+    ], patchset.to_a
+
+    changeset.apply(db2)
+    patchset.apply(db2)
+    assert_equal [[1, 22, 33], [7, 8, 9]], db2.query_array('select * from t order by x')
+
+    assert_raises(Extralite::Error) { patchset.invert }
+  end
+
+  def test_patchset_size
+    (1..100).each { |i| @db.execute('insert into t values (?, ?, ?)', i, 'x' * 100, 'y' * 100) }
+
+    changeset = @db.track_changes(:t) { @db.execute('update t set y = ?', 'z') }
+    @db.execute("update t set y = 'x'")
+    patchset = @db.track_patches(:t) { @db.execute('update t set y = ?', 'z') }
+
+    assert_operator patchset.to_blob.bytesize, :<, changeset.to_blob.bytesize / 2
+  end
+
+  def test_patchset_load_and_stream
+    io = StringIO.new(+'')
+    Extralite::Changeset.stream_track(@db, io, patchset: true) do
+      @db.execute('insert into t values (1, 2, 3)')
+    end
+
+    patchset = Extralite::Changeset.new.load(io.string)
+    assert_equal true, patchset.patchset?
+    assert_equal [[:insert, 't', nil, [1, 2, 3]]], patchset.to_a
+
+    changeset = Extralite::Changeset.new.load(@db.track_changes(:t) { @db.execute('delete from t') }.to_blob)
+    assert_equal false, changeset.patchset?
+
+    p2 = @db.track_patches(:t) { @db.execute('insert into t values (4, 5, 6)') }
+    assert_equal true, Extralite::Changeset.concat(patchset, p2).patchset?
+  end
+
+  def test_cdc_stream_queue
+    queue = Queue.new
+    assert_equal @db, @db.cdc_stream(to: queue, tables: [:t])
+
+    @db.execute('insert into t values (1, 2, 3)')
+    assert_equal 1, queue.size
+    assert_equal [[:insert, 't', nil, [1, 2, 3]]], queue.shift.to_a
+
+    @db.transaction do
+      @db.execute('insert into t values (4, 5, 6)')
+      @db.execute('update t set y = 22 where x = 1')
+      assert_equal 0, queue.size
+    end
+    assert_equal 1, queue.size
+    assert_equal [
+      [:insert, 't', nil, [4, 5, 6]],
+      [:update, 't', [1, 2, nil], [nil, 22, nil]]
+    ], queue.shift.to_a.sort_by { |c| c[0] }
+
+    # rolled back changes are not captured
+    @db.transaction do
+      @db.execute('insert into t values (7, 8, 9)')
+      @db.rollback!
+    end
+    @db.execute('select 1')
+    assert_equal 0, queue.size
+
+    assert_raises(Extralite::Error) { @db.cdc_stream(to: queue) }
+    @db.cdc_stop
+    @db.execute('delete from t')
+    assert_equal 0, queue.size
+  end
+
+  def test_cdc_stream_uncommitted_changes
+    queue = Queue.new
+    @db.cdc_stream(to: queue, tables: [:t])
+
+    # statements that commit without reaching the end of their results
+    @db.query_single('insert into t values (1, 2, 3) returning *')
+    assert_equal 1, queue.size
+    q = @db.prepare('insert into t values (?, ?, ?) returning x')
+    q.bind(4, 5, 6).next
+    q.reset
+    assert_equal 2, queue.size
+    # committed changes are held back while a transaction is open
+    @db.execute('insert into t values (7, 8, 9); begin; insert into t values (10, 11, 12)')
+    assert_equal 2, queue.size
+    @db.execute('rollback')
+    assert_equal 3, queue.size
+
+    replica = Extralite::Database.new(':memory:')
+    replica.execute('create table t (x integer primary key, y, z)')
+    queue.size.times { queue.shift.apply(replica) }
+    assert_equal @db.query_splat('select x from t order by x'), replica.query_splat('select x from t order by x')
+    assert_equal [1, 4, 7], replica.query_splat('select x from t order by x')
+  ensure
+    replica&.close
+  end
+
+  def test_cdc_stream_applied_changeset
+    queue = Queue.new
+    @db.cdc_stream(to: queue, tables: [:t])
+
+    source = Extralite::Database.new(':memory:')
+    source.execute('create table t (x integer primary key, y, z)')
+    changeset = source.track_changes(:t) { source.execute('insert into t values (1, 2, 3)') }
+    changeset.apply(@db)
+    assert_equal 1, queue.size
+    assert_equal [[:insert, 't', nil, [1, 2, 3]]], queue.shift.to_a
+  ensure
+    source&.close
+  end
+
+  def test_cdc_stream_flush_every
+    queue = []
+    @db.cdc_stream(to: queue, flush_every: 3, patchset: true)
+
+    5.times { |i| @db.execute('insert into t values (?, ?, ?)', i, i, i) }
+    assert_equal 1, queue.size
+    assert_equal true, queue.first.patchset?
+    assert_equal 3, queue.first.to_a.size
+
+    @db.cdc_flush
+    assert_equal 2, queue.size
+    assert_equal 2, queue.last.to_a.size
+
+    @db.execute('delete from t where x = 0')
+    @db.cdc_stop
+    assert_equal 3, queue.size
+    assert_equal [[:delete, 't', [0, nil, nil], nil]], queue.last.to_a
+  end
+
+  def test_cdc_stream_io
+    io = StringIO.new(+'')
+    @db.cdc_stream(to: io, tables: :t)
+    @db.execute('insert into t values (1, 2, 3)')
+    @db.execute('insert into t values (4, 5, 6)')
+    @db.cdc_stop
+
+    # consecutive changesets written to the IO can be combined
+    group = Extralite::ChangeGroup.new
+    group.add_from(StringIO.new(io.string))
+    assert_equal [
+      [:insert, 't', nil, [1, 2, 3]],
+      [:insert, 't', nil, [4, 5, 6]]
+    ], group.to_changeset.to_a.sort_by { |c| c[3][0] }
+  end
+
+  def test_cdc_stream_close
+    queue = []
+    @db.cdc_stream(to: queue, flush_every: 10)
+    @db.execute('insert into t values (1, 2, 3)')
+    assert_equal 0, queue.size
+
+    @db.close
+    assert_equal 1, queue.size
+    assert_equal [[:insert, 't', nil, [1, 2, 3]]], queue.first.to_a
+  end
 end
@@ -0,0 +1,115 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'tempfile'
+
+class AutoCheckpointTest < Minitest::Test
+  def setup
+    @tmp = Tempfile.new('extralite_test_auto_checkpoint')
+    @fn = @tmp.path
+    @db = Extralite::Database.new(@fn, wal: true)
+    @db.execute('create table t (x)')
+  end
+
+  def teardown
+    @db.close
+    @tmp.close!
+  end
+
+  def write_rows(count)
+    count.times { @db.execute('insert into t values (randomblob(1000))') }
+  end
+
+  def wait_for_checkpoints(count)
+    100.times do
+      stats = @db.checkpoint_stats
+      return stats if stats[:checkpoints] >= count
+
+      sleep 0.01
+    end
+    flunk 'Timed out waiting for checkpoints'
+  end
+
+  def test_auto_checkpoint
+    assert_nil @db.checkpoint_stats
+    assert_nil @db.stop_auto_checkpoint
+
+    assert_equal @db, @db.auto_checkpoint(interval: 0.01)
+    write_rows(20)
+    stats = wait_for_checkpoints(2)
+    assert_kind_of Float, stats[:last_duration]
+    assert stats[:total_duration] >= stats[:last_duration]
+    assert_equal :passive, stats[:last_mode]
+    assert_equal 0, stats[:errors]
+
+    stats = @db.stop_auto_checkpoint
+    assert stats[:frames_checkpointed] > 0
+    assert_nil @db.checkpoint_stats
+  end
+
+  def test_auto_checkpoint_disables_checkpoint_on_commit
+    @db.auto_checkpoint(interval: 60)
+    @db.transaction { 1200.times { @db.execute('insert into t values (?)', 'x' * 4000) } }
+    frames, _ = @db.wal_checkpoint(:passive)
+    @db.transaction { 1200.times { @db.execute('insert into t values (?)', 'x' * 4000) } }
+    assert_equal 0, @db.checkpoint_stats[:checkpoints]
+    assert File.size("#{@fn}-wal") > 4000 * 1200
+
+    @db.stop_auto_checkpoint
+    assert frames > 0
+  end
+
+  def test_auto_checkpoint_restores_setting
+    @db.pragma(wal_autocheckpoint: 250)
+    @db.auto_checkpoint(interval: 60)
+    assert_equal 0, @db.pragma(:wal_autocheckpoint)
+
+    # restarting keeps the original setting
+    @db.auto_checkpoint(interval: 30)
+    @db.stop_auto_checkpoint
+    assert_equal 250, @db.pragma(:wal_autocheckpoint)
+  end
+
+  def test_auto_checkpoint_truncate_escalation
+    @db.auto_checkpoint(interval: 0.01, truncate_above_mb: 0.01)
+    write_rows(50)
+    stats = wait_for_checkpoints(2)
+    assert stats[:escalations] > 0
+
+    write_rows(50)
+    @db.stop_auto_checkpoint
+    @db.auto_checkpoint(interval: 0.01, truncate_above_mb: 0.01)
+    stats = wait_for_checkpoints(1)
+    assert_equal :truncate, stats[:last_mode]
+    assert_equal 0, stats[:wal_size]
+  end
+
+  def test_auto_checkpoint_restart
+    @db.auto_checkpoint(interval: 0.01)
+    wait_for_checkpoints(1)
+    @db.auto_checkpoint(interval: 0.01, mode: :full)
+    assert_equal 0, @db.checkpoint_stats[:checkpoints]
+    stats = wait_for_checkpoints(1)
+    assert_equal :full, stats[:last_mode]
+  end
+
+  def test_auto_checkpoint_stopped_on_close
+    @db.auto_checkpoint(interval: 0.01)
+    threads = Thread.list.size
+    @db.close
+    assert_equal threads - 1, Thread.list.size
+  ensure
+    @db = Extralite::Database.new(@fn)
+  end
+
+  def test_auto_checkpoint_invalid_args
+    assert_raises(ArgumentError) { @db.auto_checkpoint(interval: 0) }
+    assert_raises(ArgumentError) { @db.auto_checkpoint(mode: :foo) }
+    assert_raises(ArgumentError) { @db.auto_checkpoint(truncate_above_mb: -1) }
+
+    db = Extralite::Database.new(':memory:')
+    assert_raises(Extralite::Error) { db.auto_checkpoint }
+  ensure
+    db&.close
+  end
+end
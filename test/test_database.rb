@@ -41,8 +41,8 @@ class DatabaseTest < Minitest::Test
   end
 
   def test_query_hash_with_many_columns
-    # this tests correct processing cof column names when column count is more than
-    # MAX_EMBEDDED_COLUMN_NAMES
+    # this tests correct processing of column names when column count is more than
+    # MAX_EMBEDDED_HASH_COLUMNS
     r = @db.query_hash("
       select 1 as a, 2 as b, 3 as c, 4 as d, 5 as e, 6 as f, 7 as g, 8 as h, 9 as i, 10 as j,
       11 as k, 12 as l, 13 as m, 14 as n, 15 as o, 16 as p, 17 as q, 18 as r, 19 as s, 20 as t
@@ -53,6 +53,11 @@ class DatabaseTest < Minitest::Test
     }], r
   end
 
+  def test_query_hash_with_duplicate_column_names
+    assert_equal [{ a: 3, b: 2 }], @db.query('select 1 as a, 2 as b, 3 as a')
+    assert_equal({ x: 3, y: 2 }, @db.query_single('select x, y, z as x from t where x = 1'))
+  end
+
   def test_query_array
     r = @db.query_array('select * from t')
     assert_equal [[1, 2, 3], [4, 5, 6]], r
@@ -74,10 +79,25 @@ class DatabaseTest < Minitest::Test
     assert_equal [[1, 2, 3], [4, 5, 6]], r
   end
 
-  def test_query_splat_with_too_many_columns
-    assert_raises(Extralite::Error) {
-      @db.query_splat('select 1, 2, 3, 4, 5, 6, 7, 8, 9');
-    }
+  def test_query_splat_with_many_columns
+    assert_equal [(1..9).to_a], @db.query_splat('select 1, 2, 3, 4, 5, 6, 7, 8, 9')
+
+    sql = "select #{(1..40).to_a.join(', ')}"
+    assert_equal [(1..40).to_a], @db.query_splat(sql)
+    assert_equal (1..40).to_a, @db.query_single_splat(sql)
+    assert_equal 40, @db.query_splat(->(*a) { a.size }, sql).first
+
+    buf = []
+    @db.query_splat(sql) { |*a| buf << a }
+    assert_equal [(1..40).to_a], buf
+
+    @db.execute('create table wide (a, b, c, d, e)')
+    @db.batch_execute('insert into wide values (?, ?, ?, ?, ?)', (1..100).map { |i| [i, i + 1, i + 2, i + 3, "#{i}"] })
+    rows = @db.query_splat('select * from wide order by a')
+    assert_equal (1..100).map { |i| [i, i + 1, i + 2, i + 3, "#{i}"] }, rows
+    assert_equal [[1, 2, 3, 4]], @db.query_splat('select a, b, c, d from wide where a = 1')
+    assert_equal [[1, 2, 3]], @db.query_splat('select a, b, c from wide where a = 1')
+    assert_equal [[1, 2]], @db.query_splat('select a, b from wide where a = 1')
   end
 
   def test_query_single
@@ -756,6 +776,102 @@ class DatabaseTest < Minitest::Test
     assert_operator 0, :<, @db.status(Extralite::SQLITE_DBSTATUS_SCHEMA_USED).first
   end
 
+  def test_database_cache_used
+    assert_kind_of Integer, @db.cache_used
+    assert_equal @db.status(Extralite::SQLITE_DBSTATUS_CACHE_USED).first, @db.cache_used
+  end
+
+  def test_database_release_memory
+    fn = (tmp = Tempfile.new('extralite_test_database_release_memory')).path
+    db = Extralite::Database.new(fn)
+    db.execute('create table t (x, y, z)')
+    db.batch_execute('insert into t values (?, ?, ?)', (1..1000).map { [rand, rand, rand] })
+    db.query('select * from t')
+    used = db.cache_used
+    assert_operator 0, :<, used
+
+    assert_equal db, db.cache_flush
+    assert_equal db, db.release_memory
+    assert_operator db.cache_used, :<, used
+  ensure
+    db&.close
+    tmp&.close!
+  end
+
+  def test_database_metrics
+    db = Extralite::Database.new(':memory:')
+    db.execute('create table t (x, y)')
+    db.batch_execute('insert into t values (?, ?)', [[1, 2], [3, 4]])
+    db.query('select * from t')
+    db.query_array('select * from t')
+    db.prepare_splat('select x from t').to_a
+
+    metrics = db.metrics
+    label = metrics[/db="(:memory:[^"]+)"/, 1]
+    assert_match(/^:memory:\d+$/, label)
+    metrics = metrics.gsub(label, ':memory:')
+    assert_match(/^# TYPE extralite_queries counter$/, metrics)
+    assert_match(/^extralite_queries_total\{db=":memory:",mode="hash"\} 1$/, metrics)
+    assert_match(/^extralite_queries_total\{db=":memory:",mode="splat"\} 1$/, metrics)
+    assert_match(/^extralite_queries_total\{db=":memory:",mode="array"\} 1$/, metrics)
+    assert_match(/^extralite_queries_total\{db=":memory:",mode="execute"\} 3$/, metrics)
+    assert_match(/^extralite_rows_total\{db=":memory:"\} 6$/, metrics)
+    assert_match(/^extralite_cache_used_bytes\{db=":memory:"\} \d+$/, metrics)
+    assert_match(/^extralite_wal_size_bytes\{db=":memory:"\} 0$/, metrics)
+    assert_match(/^# EOF\n\z/, metrics)
+  ensure
+    db&.close
+  end
+
+  def test_metrics_text_aggregation
+    fn = (tmp = Tempfile.new('extralite_test_metrics_text_aggregation')).path
+    db1 = Extralite::Database.new(fn, wal: true)
+    db2 = Extralite::Database.new(fn)
+    db1.execute('create table t (x)')
+    db2.execute('insert into t values (1)')
+
+    metrics = Extralite.metrics_text
+    label = Regexp.escape(fn)
+    assert_match(/^extralite_queries_total\{db="#{label}",mode="execute"\} 2$/, metrics)
+    assert_equal 1, metrics.scan(/^extralite_rows_total\{db="#{label}"\}/).size
+    assert_match(/^extralite_wal_size_bytes\{db="#{label}"\} [1-9]\d*$/, metrics)
+  ensure
+    db1&.close
+    db2&.close
+    tmp&.close!
+  end
+
+  def test_metrics_text_in_memory_databases
+    db1 = Extralite::Database.new(':memory:')
+    db2 = Extralite::Database.new(':memory:')
+    db1.execute('select 1')
+    2.times { db2.execute('select 1') }
+
+    metrics = Extralite.metrics_text
+    labels = [db1, db2].map { |db| db.metrics[/db="(:memory:[^"]+)"/, 1] }
+    assert_equal 2, labels.uniq.size
+    assert_operator labels[0][/\d+$/].to_i, :<, labels[1][/\d+$/].to_i
+    assert_match(/^extralite_queries_total\{db="#{labels[0]}",mode="execute"\} 1$/, metrics)
+    assert_match(/^extralite_queries_total\{db="#{labels[1]}",mode="execute"\} 2$/, metrics)
+  ensure
+    db1&.close
+    db2&.close
+  end
+
+  def test_metrics_lookaside
+    db = Extralite::Database.new(':memory:', lookaside: [256, 64])
+    skip 'lookaside is omitted' if db.query_splat('pragma compile_options').include?('OMIT_LOOKASIDE')
+
+    db.execute('create table t (x, y)')
+    db.batch_execute('insert into t values (?, ?)', (1..100).map { |i| [i, "foo#{i}"] })
+    db.query('select * from t order by y')
+
+    hits = db.metrics[/^extralite_lookaside_hits_total\{[^}]+\} (\d+)$/, 1]
+    assert_operator hits.to_i, :>, 0
+  ensure
+    db&.close
+  end
+
   def test_database_limit
     result = @db.limit(Extralite::SQLITE_LIMIT_ATTACHED)
     assert_equal 10, result
@@ -876,6 +992,21 @@ class DatabaseTest < Minitest::Test
     assert_equal 42, db.pragma(:application_id)
   end
 
+  def test_database_initialize_lookaside
+    assert_raises(ArgumentError) { Extralite::Database.new(':memory:', lookaside: 42) }
+    skip if @db.query_splat('pragma compile_options').include?('OMIT_LOOKASIDE')
+
+    db = Extralite::Database.new(':memory:', lookaside: [0, 0])
+    db.execute('create table t (x, y, z)')
+    db.query('select * from t')
+    assert_equal 0, db.status(Extralite::SQLITE_DBSTATUS_LOOKASIDE_USED)[1]
+
+    db = Extralite::Database.new(':memory:', lookaside: [256, 64])
+    db.execute('create table t (x, y, z)')
+    db.query('select * from t')
+    assert_operator 0, :<, db.status(Extralite::SQLITE_DBSTATUS_LOOKASIDE_USED)[1]
+  end
+
   def test_database_inspect
     db = Extralite::Database.new(':memory:')
     assert_match(/^\#\<Extralite::Database:0x[0-9a-f]+ :memory:\>$/, db.inspect)
@@ -895,6 +1026,23 @@ class DatabaseTest < Minitest::Test
     assert_equal 'UTF-8', v.encoding.name
   end
 
+  def test_string_code_range
+    db = Extralite::Database.new(':memory:')
+    samples = [
+      '', 'foo', 'x' * 100, 'é', 'x' * 40 + 'é' + 'x' * 40, '世界😀', 'x' * 31 + '😀',
+      "\xff".b, "a\xc3".b, "\xc0\xaf".b, "\xed\xa0\x80".b, "\xf4\x90\x80\x80".b,
+      "\xe0\x9f\xbf".b, 'x' * 20 + "\x80".b + 'x' * 20, "\xf0\x9f\x98".b
+    ]
+    samples.each do |sample|
+      v = db.query_single_splat('select cast(? as text)', sample)
+      assert_equal Encoding::UTF_8, v.encoding
+      expected = sample.dup.force_encoding(Encoding::UTF_8)
+      assert_equal expected.ascii_only?, v.ascii_only?, sample.inspect
+      assert_equal expected.valid_encoding?, v.valid_encoding?, sample.inspect
+      assert_equal expected, v
+    end
+  end
+
   def test_database_transaction_commit
     path = Tempfile.new('extralite_test_database_transaction_commit').path
     db1 = Extralite::Database.new(path)
@@ -1049,6 +1197,67 @@ class DatabaseTest < Minitest::Test
     ], q.to_a
   end
 
+  Row = Struct.new(:x, :y, :z)
+  KeywordRow = Struct.new(:x, :y, :z, keyword_init: true)
+  if defined?(Data.define)
+    DataRow = Data.define(:x, :y, :z)
+    DefaultsRow = Data.define(:x, :y, :z) do
+      def initialize(x:, y:, z: 0)
+        super
+      end
+    end
+  end
+
+  def test_query_as
+    assert_equal [Row.new(1, 2, 3), Row.new(4, 5, 6)], @db.query_as(Row, 'select * from t order by x')
+    assert_equal [Row.new(3, nil, 1)], @db.query_as(Row, 'select z as x, x as z from t where x = ?', 1)
+    assert_equal [KeywordRow.new(x: 1, y: 2, z: 3)], @db.query_as(KeywordRow, 'select * from t where x = 1')
+
+    buf = []
+    @db.query_as(Row, 'select * from t order by x') { |r| buf << r }
+    assert_equal [Row.new(1, 2, 3), Row.new(4, 5, 6)], buf
+  end
+
+  def test_query_as_data
+    skip 'Data requires Ruby 3.2+' unless defined?(DataRow)
+
+    rows = @db.query_as(DataRow, 'select * from t order by x')
+    assert_equal [DataRow.new(1, 2, 3), DataRow.new(4, 5, 6)], rows
+    assert rows.first.frozen?
+
+    assert_equal [DefaultsRow.new(x: 4, y: 5, z: 0)], @db.query_as(DefaultsRow, 'select x, y from t where x = 4')
+    assert_raises(ArgumentError) { @db.query_as(DataRow, 'select x, y from t') }
+
+    transform = ->(r) { r.x * 10 }
+    assert_equal [10, 40], @db.query_as(DataRow, transform, 'select * from t order by x')
+  end
+
+  def test_query_single_as
+    assert_equal Row.new(4, 5, 6), @db.query_single_as(Row, 'select * from t where x = ?', 4)
+    skip 'Data requires Ruby 3.2+' unless defined?(DataRow)
+    assert_equal DataRow.new(1, 2, 3), @db.query_single_as(DataRow, 'select * from t order by x')
+    assert_nil @db.query_single_as(DataRow, 'select * from t where x = 2')
+  end
+
+  def test_query_as_invalid_class
+    assert_raises(ArgumentError) { @db.query_as(Hash, 'select * from t') }
+    assert_raises(ArgumentError) { @db.query_as(Struct, 'select * from t') }
+    assert_raises(ArgumentError) { @db.query_as(Row.new(1, 2, 3), 'select * from t') }
+    assert_raises(ArgumentError) { @db.query_as(Row) }
+    assert_raises(Extralite::Error) { @db.query_as(Row, 'select x, y as foo from t') }
+  end
+
+  def test_prepare_as
+    q = @db.prepare_as(Row, 'select * from t where x > ? order by x', 0)
+    assert_kind_of Extralite::Query, q
+    assert_equal :object, q.mode
+    assert_equal Row, q.row_class
+    assert_equal [Row.new(1, 2, 3), Row.new(4, 5, 6)], q.to_a
+
+    q = @db.prepare_as(Row, 'select * from t order by x') { |r| r.to_a.sum }
+    assert_equal [6, 15], q.to_a
+  end
+
   def test_wal_checkpoint
     fn = Tempfile.new('extralite_test_wal_checkpoint').path
 
@@ -1281,6 +1490,163 @@ class BackupTest < Minitest::Test
     db = Extralite::Database.new(tmp_fn)
     assert_equal [[1, 2, 3], [4, 5, 6]], db.query_array('select * from t')
   end
+
+  def fill_src(count)
+    @src.execute('create table big (x)')
+    @src.batch_execute('insert into big values (?)', (1..count).map { 'x' * 4000 })
+  end
+
+  def test_backup_pages_per_step
+    fill_src(100)
+    progress = []
+    @src.backup(@dst, pages_per_step: 10) { |r, t| progress << [r, t] }
+    assert_equal 100, @dst.query_single_splat('select count(*) from big')
+    assert progress.size > 10
+    assert_equal progress.last[1], progress.last[0]
+
+    assert_raises(ArgumentError) { @src.backup(@dst, pages_per_step: 0) }
+  end
+
+  def test_backup_with_progress_info
+    fill_src(100)
+    infos = []
+    @src.backup(@dst, pages_per_step: 10) { |_r, _t, info| infos << info }
+    assert_equal 100, @dst.query_single_splat('select count(*) from big')
+
+    page_size = @src.pragma(:page_size)
+    first = infos.first
+    assert_equal 10 * page_size, first[:bytes_copied]
+    assert_equal @src.pragma(:page_count) * page_size, first[:bytes_total]
+    assert_kind_of Float, first[:bytes_per_sec]
+    assert_equal 10, first[:pages_per_step]
+
+    last = infos.last
+    assert_equal last[:bytes_total], last[:bytes_copied]
+    assert_equal 0.0, last[:eta]
+  end
+
+  def test_backup_block_arity
+    args = []
+    @src.backup(@dst) { |*a| args << a }
+    assert_equal [[2, 2]], args
+
+    args = []
+    @src.backup(@dst) { |r, t, info = nil| args << [r, t, info] }
+    assert_equal [[2, 2, nil]], args
+
+    args = []
+    @src.backup(@dst) { |r, t, info, *rest| args << [info.class, rest] }
+    assert_equal [[Hash, []]], args
+  end
+
+  def test_backup_target_mb_per_sec
+    fill_src(100)
+    t0 = Time.now
+    @src.backup(@dst, target_mb_per_sec: 2)
+    elapsed = Time.now - t0
+    assert_equal 100, @dst.query_single_splat('select count(*) from big')
+
+    bytes = @src.pragma(:page_count) * @src.pragma(:page_size)
+    assert_in_range (bytes / (2.0 * 1024 * 1024) * 0.5)..2, elapsed
+
+    assert_raises(ArgumentError) { @src.backup(@dst, target_mb_per_sec: 0) }
+  end
+
+  def test_backup_max_lock_ms
+    fill_src(100)
+    steps = []
+    @src.backup(@dst, pages_per_step: 1, max_lock_ms: 1000) { |_r, _t, info| steps << info[:pages_per_step] }
+    assert_equal 100, @dst.query_single_splat('select count(*) from big')
+    # step size grows while steps take less than the lock limit
+    assert_equal [2, 4, 8, 16], steps[0..3]
+
+    assert_raises(ArgumentError) { @src.backup(@dst, max_lock_ms: -1) }
+  end
+end
+
+class SerializeTest < Minitest::Test
+  def setup
+    skip 'serialize not supported' unless Extralite::Database.method_defined?(:serialize)
+
+    @db = Extralite::Database.new(':memory:')
+    @db.execute('create table t (x, y, z)')
+    @db.execute('insert into t values (1, 2, 3), (4, 5, 6)')
+  end
+
+  def teardown
+    @db&.close
+  end
+
+  def test_serialize
+    image = @db.serialize
+    assert_kind_of String, image
+    assert_equal Encoding::ASCII_8BIT, image.encoding
+    assert_equal @db.pragma(:page_count) * @db.pragma(:page_size), image.bytesize
+    assert image.start_with?("SQLite format 3\0")
+  end
+
+  def test_serialize_file_database
+    tmp = Tempfile.new('extralite_test_serialize')
+    db = Extralite::Database.new(tmp.path)
+    db.execute('create table t (x)')
+    db.execute('insert into t values (42)')
+
+    copy = Extralite::Database.deserialize(db.serialize)
+    assert_equal [42], copy.query_splat('select x from t')
+  ensure
+    db&.close
+    copy&.close
+  end
+
+  def test_serialize_schema
+    @db.execute("attach ':memory:' as foo")
+    @db.execute('create table foo.bar (a)')
+    copy = Extralite::Database.deserialize(@db.serialize('foo'))
+    assert_equal ['bar'], copy.tables
+
+    assert_raises(Extralite::Error) { @db.serialize('baz') }
+  end
+
+  def test_deserialize
+    copy = Extralite::Database.deserialize(@db.serialize)
+    assert_equal [[1, 2, 3], [4, 5, 6]], copy.query_array('select * from t')
+
+    # writable and resizable by default
+    copy.execute('insert into t select * from t')
+    copy.execute('create table u as select randomblob(100000) as b')
+    assert_equal 4, copy.query_single_splat('select count(*) from t')
+    assert_equal 2, @db.query_single_splat('select count(*) from t')
+  end
+
+  def test_deserialize_not_resizable
+    copy = Extralite::Database.deserialize(@db.serialize, resizable: false)
+    copy.execute('insert into t values (7, 8, 9)')
+    assert_raises(Extralite::Error) { copy.execute('create table u as select randomblob(100000) as b') }
+  end
+
+  def test_deserialize_read_only
+    image = @db.serialize.freeze
+    copy = Extralite::Database.deserialize(image, read_only: true)
+    assert_equal [[1, 2, 3], [4, 5, 6]], copy.query_array('select * from t')
+    assert_raises(Extralite::Error) { copy.execute('insert into t values (7, 8, 9)') }
+
+    # the image is used in place and kept alive along with the database
+    image = nil
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal [[1, 2, 3], [4, 5, 6]], copy.query_array('select * from t')
+  end
+
+  def test_deserialize_with_options
+    copy = Extralite::Database.deserialize(@db.serialize, gvl_release_threshold: -1)
+    assert_equal(-1, copy.gvl_release_threshold)
+    assert_equal [[1, 2, 3], [4, 5, 6]], copy.query_array('select * from t')
+  end
+
+  def test_deserialize_invalid_image
+    copy = Extralite::Database.deserialize('foobar' * 100)
+    assert_raises(Extralite::Error) { copy.query('select * from t') }
+  end
 end
 
 class ConcurrencyTest < Minitest::Test
@@ -0,0 +1,379 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'date'
+require 'bigdecimal'
+
+class DecodeTypesTest < Minitest::Test
+  def setup
+    @db = Extralite::Database.new(':memory:', decode_types: true)
+    @db.execute('create table t (d date, ts datetime, b boolean, n decimal(10, 2), x text, i)')
+  end
+
+  def teardown
+    @db.close
+  end
+
+  def test_decode_types_setting
+    assert_equal true, @db.decode_types
+    @db.decode_types = false
+    assert_equal false, @db.decode_types
+
+    db = Extralite::Database.new(':memory:')
+    assert_equal false, db.decode_types
+  ensure
+    db&.close
+  end
+
+  def test_decode_types_disabled
+    @db.decode_types = false
+    @db.execute('insert into t values (?, ?, ?, ?, ?, ?)', '2024-05-01', '2024-05-01 10:20:30', 1, '1.25', 'foo', 42)
+    assert_equal(
+      { d: '2024-05-01', ts: '2024-05-01 10:20:30', b: 1, n: 1.25, x: 'foo', i: 42 },
+      @db.query_single('select * from t')
+    )
+  end
+
+  def test_decode_types
+    @db.execute('insert into t values (?, ?, ?, ?, ?, ?)', '2024-05-01', '2024-05-01 10:20:30', 1, '1.25', 'foo', 42)
+    assert_equal(
+      {
+        d: Date.new(2024, 5, 1),
+        ts: Time.utc(2024, 5, 1, 10, 20, 30),
+        b: true,
+        n: BigDecimal('1.25'),
+        x: 'foo',
+        i: 42
+      },
+      @db.query_single('select * from t')
+    )
+
+    row = @db.query_single_array('select * from t')
+    assert_equal [Date, Time, TrueClass, BigDecimal, String, Integer], row.map(&:class)
+    assert_equal [Date.new(2024, 5, 1), true], @db.query_single_splat('select d, b from t')
+    assert_equal [[true]], @db.prepare_array('select b from t').to_a
+
+    # expressions have no declared type
+    assert_equal '2024-05-01', @db.query_single_splat('select d || \'\' from t')
+  end
+
+  def test_decode_dates
+    julian_day = @db.query_single_splat("select julianday('2024-01-01')")
+    @db.batch_execute('insert into t (d) values (?)', ['2024-02-29', '2023-02-29', 'foo', 2460311, julian_day, nil])
+    assert_equal [
+      Date.new(2024, 2, 29), '2023-02-29', 'foo', Date.new(2024, 1, 1), Date.new(2024, 1, 1), nil
+    ], @db.query_splat('select d from t')
+  end
+
+  def test_decode_timestamps
+    @db.batch_execute('insert into t (ts) values (?)', [
+      '2024-05-01T10:20:30.125Z',
+      '2024-05-01 10:20',
+      '2024-05-01',
+      '2024-05-01 10:20:30 +02:00',
+      '2024-05-01T10:20:30-0530',
+      '2024-05-01 25:00:00',
+      1714558830,
+      2460431.5
+    ])
+    values = @db.query_splat('select ts from t')
+    assert_equal Time.utc(2024, 5, 1, 10, 20, 30.125r), values[0]
+    assert_equal Time.utc(2024, 5, 1, 10, 20), values[1]
+    assert_equal Time.utc(2024, 5, 1), values[2]
+    assert_equal Time.new(2024, 5, 1, 10, 20, 30, '+02:00'), values[3]
+    assert_equal 7200, values[3].utc_offset
+    assert_equal Time.new(2024, 5, 1, 10, 20, 30, '-05:30'), values[4]
+    assert_equal '2024-05-01 25:00:00', values[5]
+    assert_equal Time.at(1714558830), values[6]
+    assert_equal Time.utc(2024, 5, 1), values[7]
+    assert_equal [true, true, true], values.values_at(0, 6, 7).map(&:utc?)
+  end
+
+  def test_decode_numeric_timestamps_in_utc
+    @db.batch_execute('insert into t (ts) values (?)', [0, 2440588.25])
+    values = @db.query_splat('select ts from t')
+    assert_equal [Time.utc(1970, 1, 1), Time.utc(1970, 1, 1, 18)], values
+    assert_equal [0, 0], values.map(&:utc_offset)
+    assert_equal '1970-01-01 00:00:00 UTC', values[0].to_s
+  end
+
+  def test_decode_booleans
+    @db.batch_execute('insert into t (b) values (?)', [1, 0, 't', 'f', 'false', 'No', '1', 2.5, nil])
+    assert_equal [true, false, true, false, false, false, true, true, nil], @db.query_splat('select b from t')
+  end
+
+  def test_decode_unrecognized_booleans
+    @db.batch_execute('insert into t (b) values (?)', ['YES', 'off', '', 'maybe', 'nope'])
+    @db.execute('insert into t (b) values (?)', Extralite::Blob.new('t'))
+    assert_equal [true, false, '', 'maybe', 'nope', 't'], @db.query_splat('select b from t')
+  end
+
+  def test_decode_decimals
+    @db.batch_execute('insert into t (n) values (?)', ['1.10', 3, 2.5, 'foo'])
+    values = @db.query_splat('select n from t')
+    assert_equal [BigDecimal('1.1'), BigDecimal('3'), BigDecimal('2.5'), 'foo'], values
+    assert_equal [BigDecimal, BigDecimal, BigDecimal, String], values.map(&:class)
+  end
+
+  def test_decode_types_many_columns
+    columns = (1..40).map { |i| "c#{i} #{i.even? ? 'boolean' : 'integer'}" }
+    @db.execute("create table wide (#{columns.join(', ')})")
+    @db.execute("insert into wide values (#{(['1'] * 40).join(', ')})")
+    row = @db.query_single_array('select * from wide')
+    assert_equal (1..40).map { |i| i.even? ? true : 1 }, row
+  end
+end
+
+class DecodeJSONTest < Minitest::Test
+  def setup
+    @db = Extralite::Database.new(':memory:')
+    @db.execute('create table t (id integer, doc json, meta text, bin jsonb)')
+  end
+
+  def teardown
+    @db.close
+  end
+
+  DOC = '{"a": 1, "b": [true, false, null, 2.5, "x\\ny"], "c": {"d": "\\u00e9\\ud83d\\ude00"}, "e": 123456789012345678901}'
+
+  def test_decode_json_disabled
+    @db.execute('insert into t (id, doc) values (1, ?)', DOC)
+    assert_equal DOC, @db.query_single_splat('select doc from t')
+  end
+
+  def test_decode_json
+    assert_equal @db, @db.decode_json
+    @db.execute('insert into t (id, doc, meta) values (1, ?, ?)', DOC, '[1, 2]')
+    expected = {
+      'a' => 1,
+      'b' => [true, false, nil, 2.5, "x\ny"],
+      'c' => { 'd' => "é😀" },
+      'e' => 123456789012345678901
+    }
+    assert_equal expected, @db.query_single_splat('select doc from t')
+    assert_equal [1, expected, '[1, 2]'], @db.query_single_array('select id, doc, meta from t')
+
+    @db.decode_json([:meta])
+    assert_equal({ doc: expected, meta: [1, 2] }, @db.query_single('select doc, meta from t'))
+    assert_equal [[1, 2]], @db.query_splat("select json_array(1, 2) as meta")
+
+    @db.decode_json(false)
+    assert_equal DOC, @db.query_single_splat('select doc from t')
+  end
+
+  def test_decode_json_options
+    @db.decode_json(symbolize_names: true)
+    @db.execute('insert into t (id, doc) values (1, ?)', DOC)
+    doc = @db.query_single_splat('select doc from t')
+    assert_equal [:a, :b, :c, :e], doc.keys
+    assert_equal({ d: "é😀" }, doc[:c])
+    assert !doc.frozen?
+
+    @db.decode_json(freeze: true)
+    doc = @db.query_single_splat('select doc from t')
+    assert_equal %w[a b c e], doc.keys
+    assert doc.frozen?
+    assert doc['b'].frozen?
+    assert doc['b'][4].frozen?
+    assert_equal Encoding::UTF_8, doc['b'][4].encoding
+    assert_same doc['b'][4], @db.query_single_splat('select doc from t')['b'][4]
+  end
+
+  def test_decode_json_invalid
+    @db.decode_json
+    bad = ['{"a": 1', '[1, 2,]', '{a: 1}', '"\\q"', '[01]', '[1] 2', 'tru']
+    @db.batch_execute('insert into t (doc) values (?)', bad)
+    @db.execute('insert into t (doc) values (?)', 42)
+    assert_equal bad + [42], @db.query_splat('select doc from t')
+  end
+
+  def test_decode_json_scalars
+    @db.decode_json
+    values = ['"foo"', '-12', '1e3', ' true ', 'null', '[]', '{}', '"\\"\\\\\\/\\b\\f\\r\\t"']
+    @db.batch_execute('insert into t (doc) values (?)', values)
+    assert_equal ['foo', -12, 1000.0, true, nil, [], {}, "\"\\/\b\f\r\t"], @db.query_splat('select doc from t')
+  end
+
+  def jsonb(type, payload)
+    size = payload.bytesize
+    header = size < 12 ? [(size << 4) | type].pack('C') : [0xC0 | type, size].pack('CC')
+    (header + payload).b
+  end
+
+  def test_decode_jsonb
+    @db.decode_json
+    blob = jsonb(12,
+      jsonb(7, 'a') + jsonb(3, '1') +
+      jsonb(7, 'b') + jsonb(11, jsonb(1, '') + jsonb(2, '') + jsonb(0, '') + jsonb(5, '1.5')) +
+      jsonb(7, 'long') + jsonb(7, 'x' * 20) +
+      jsonb(8, 'j') + jsonb(8, 'a\\nb\\u00e9') +
+      jsonb(7, 'h') + jsonb(4, '-0x1F') +
+      jsonb(7, 'i') + jsonb(6, '.5') +
+      jsonb(7, 'raw') + jsonb(10, 'a"b') +
+      jsonb(7, 'j5') + jsonb(9, "\\x41\\'")
+    )
+    @db.execute('insert into t (bin) values (?)', blob)
+    expected = {
+      'a' => 1,
+      'b' => [true, false, nil, 1.5],
+      'long' => 'x' * 20,
+      'j' => "a\nbé",
+      'h' => -31,
+      'i' => 0.5,
+      'raw' => 'a"b',
+      'j5' => "A'"
+    }
+    assert_equal expected, @db.query_single_splat('select bin from t')
+
+    # malformed JSONB is returned as is
+    @db.execute('insert into t (bin) values (?)', blob[0..-2])
+    assert_equal blob[0..-2], @db.query_splat('select bin from t').last
+
+    if @db.query_single_splat("select sqlite_version() >= '3.45'") == 1
+      assert_equal({ 'a' => [1, 2] }, @db.query_single_splat(%q{select jsonb('{"a":[1,2]}') as bin}))
+    end
+  end
+
+  def test_decode_json_option_on_open
+    db = Extralite::Database.new(':memory:', decode_json: [:doc])
+    assert_equal({ 'a' => 1 }, db.query_single_splat(%q{select '{"a": 1}' as doc}))
+  ensure
+    db&.close
+  end
+
+  def test_decode_json_invalid_args
+    assert_raises(ArgumentError) { @db.decode_json(:doc) }
+    assert_raises(ArgumentError) { @db.decode_json(foo: true) }
+  end
+end
+
+class InternTest < Minitest::Test
+  def setup
+    @db = Extralite::Database.new(':memory:')
+    @db.execute('create table t (id integer, status text, name text, day date)')
+    @db.batch_execute('insert into t values (?, ?, ?, ?)', [
+      [1, 'open', 'foo', '2024-05-01'],
+      [2, 'closed', 'bar', '2024-05-01'],
+      [3, 'open', 'baz', '2024-05-02'],
+      [4, nil, 'foo', nil]
+    ])
+  end
+
+  def teardown
+    @db.close
+  end
+
+  def test_intern_setting
+    assert_equal false, @db.intern
+    @db.intern = [:status, 'name']
+    assert_equal [:status, :name], @db.intern
+    @db.intern = :auto
+    assert_equal :auto, @db.intern
+    @db.intern = nil
+    assert_equal false, @db.intern
+
+    assert_raises(ArgumentError) { @db.intern = :foo }
+    assert_raises(TypeError) { @db.intern = [1] }
+  end
+
+  def test_intern_columns
+    @db.intern = [:status]
+    rows = @db.query('select * from t order by id')
+    assert_equal %w[open closed open] + [nil], rows.map { _1[:status] }
+    assert rows[0][:status].frozen?
+    assert_same rows[0][:status], rows[2][:status]
+    assert_equal Encoding::UTF_8, rows[0][:status].encoding
+    assert_same(-'open', rows[0][:status])
+
+    assert !rows[0][:name].frozen?
+    refute_same rows[0][:name], rows[3][:name]
+
+    values = @db.query_splat('select status from t order by id')
+    assert_same values[0], values[2]
+    values = @db.query_array('select name, status from t order by id')
+    assert_same values[0][1], values[2][1]
+
+    # interned columns are matched by name
+    assert_equal [1, 2], @db.query_splat('select id as status from t where id < 3')
+  end
+
+  def test_intern_auto
+    @db.intern = :auto
+    values = @db.query_array('select status, name, id from t order by id')
+    assert_same values[0][0], values[2][0]
+    assert_same values[0][1], values[3][1]
+    assert values.all? { |(s, n, _)| (s.nil? || s.frozen?) && n.frozen? }
+
+    long = 'x' * 65
+    @db.execute('insert into t (id, name) values (5, ?)', long)
+    value = @db.query_single_splat('select name from t where id = 5')
+    assert_equal long, value
+    assert !value.frozen?
+  end
+
+  def test_intern_auto_high_cardinality
+    @db.intern = :auto
+    @db.batch_execute('insert into t (id, name) values (?, ?)', (10..1009).map { [_1, "name#{_1}"] })
+    names = @db.query_splat('select name from t where id >= 10 order by id')
+    assert_equal (10..1009).map { "name#{_1}" }, names
+    assert names.first.frozen?
+    assert !names.last.frozen?
+  end
+
+  def test_intern_auto_high_cardinality_across_executions
+    @db.intern = :auto
+    @db.batch_execute('insert into t (id, name) values (?, ?)', (10..1009).map { [_1, "name#{_1}"] })
+    q = @db.prepare_splat('select name from t where id >= 10 order by id')
+    names = []
+    while (name = q.next)
+      names << name
+    end
+    assert_equal (10..1009).map { "name#{_1}" }, names
+    assert names.first.frozen?
+    assert !names.last.frozen?
+
+    # interning stays off for the column on later executions
+    assert !q.reset.next.frozen?
+    assert !q.to_a.first.frozen?
+  end
+
+  def test_intern_auto_high_cardinality_lazy
+    @db.intern = :auto
+    @db.batch_execute('insert into t (id, name) values (?, ?)', (10..1009).map { [_1, "name#{_1}"] })
+    names = @db.query_lazy('select name from t where id >= 10 order by id').map { _1[:name] }
+    assert_equal (10..1009).map { "name#{_1}" }, names
+    assert names.first.frozen?
+    assert !names.last.frozen?
+  end
+
+  def test_intern_across_executions
+    @db.intern = [:status]
+    q = @db.prepare_splat('select status from t where id = ?')
+    a = q.bind(1).next
+    b = q.bind(3).next
+    assert_same a, b
+    assert a.frozen?
+  end
+
+  def test_intern_with_decoders
+    @db.decode_types = true
+    @db.intern = :auto
+    row = @db.query_single('select * from t where id = 1')
+    assert_equal Date.new(2024, 5, 1), row[:day]
+    assert row[:status].frozen?
+  end
+
+  def test_intern_lazy
+    @db.intern = [:status]
+    rows = @db.query_lazy('select status from t order by id')
+    assert_same rows[0][:status], rows[2][:status]
+  end
+
+  def test_intern_option_on_open
+    db = Extralite::Database.new(':memory:', intern: :auto)
+    assert_equal :auto, db.intern
+    assert db.query_single_splat("select 'foo'").frozen?
+  ensure
+    db&.close
+  end
+end
@@ -2,6 +2,8 @@
 
 require_relative 'helper'
 
+require 'tempfile'
+
 class ExtraliteTest < Minitest::Test
   def test_sqlite3_version
     assert_match(/^3\.\d+\.\d+$/, Extralite.sqlite3_version)
@@ -30,4 +32,79 @@ class ExtraliteTest < Minitest::Test
       db.close
     end
   end
+
+  def test_memory_policy
+    policy = Extralite.memory_policy
+    assert_equal false, policy[:release_on_gc]
+
+    policy = Extralite.memory_policy(soft_heap_limit: 1 << 24, release_on_gc: true)
+    assert_equal 1 << 24, policy[:soft_heap_limit]
+    assert_equal true, policy[:release_on_gc]
+
+    fn = (tmp = Tempfile.new('extralite_test_memory_policy')).path
+    db = Extralite::Database.new(fn)
+    db.execute('create table t (x)')
+    db.batch_execute('insert into t values (?)', (1..1000).map { |i| "foo#{i}" * 10 })
+    used = db.cache_used
+    assert_operator 0, :<, used
+
+    GC.start(full_mark: true)
+    assert_operator db.cache_used, :<, used
+  ensure
+    db&.close
+    tmp&.close!
+    Extralite.memory_policy(soft_heap_limit: 0, release_on_gc: false)
+  end
+
+  def test_configure_with_open_database
+    db = Extralite::Database.new(':memory:')
+    assert_raises(Extralite::Error) { Extralite.configure(memstatus: false) }
+  ensure
+    db&.close
+  end
+
+  def test_configure
+    lib = File.expand_path('../lib', __dir__)
+    script = <<~RUBY
+      require 'extralite'
+      Extralite.configure(lookaside: [512, 32], pagecache: 1 << 20, memstatus: false, mmap_size: 0)
+      db = Extralite::Database.new(':memory:')
+      db.execute('create table t (x)')
+      print Extralite.runtime_status(Extralite::SQLITE_STATUS_MEMORY_USED)[0]
+    RUBY
+    output = IO.popen([RbConfig.ruby, '-I', lib, '-e', script], &:read)
+    assert_equal '0', output
+  end
+
+  def test_configure_with_live_connections
+    lib = File.expand_path('../lib', __dir__)
+    script = <<~RUBY
+      require 'extralite'
+      def try_configure
+        Extralite.configure(memstatus: true)
+        print 'ok '
+      rescue Extralite::Error
+        print 'error '
+      end
+
+      db = Extralite::Database.new(':memory:')
+      q = db.prepare('select 1')
+      q.next
+      db.close
+      try_configure
+      q.close
+      try_configure
+
+      db = Extralite::Database.new(':memory:')
+      db.execute('create table t (x)')
+      db.execute('insert into t values (zeroblob(4))')
+      blob = db.blob_open('t', 'x', 1)
+      db.close
+      try_configure
+      blob.close
+      try_configure
+    RUBY
+    output = IO.popen([RbConfig.ruby, '-I', lib, '-e', script], &:read)
+    assert_equal 'error ok error ok ', output
+  end
 end
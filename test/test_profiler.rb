@@ -0,0 +1,80 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+
+class ProfilerTest < Minitest::Test
+  SLOW_SQL = <<~SQL
+    with recursive c(x) as (select 1 union all select x + 1 from c where x < 200000)
+    select sum(x) from c
+  SQL
+
+  def setup
+    @db = Extralite::Database.new(':memory:')
+  end
+
+  def teardown
+    Extralite::Profiler.stop
+    @db.close
+  end
+
+  def test_profiler_start_stop
+    assert_equal false, Extralite::Profiler.running?
+    assert_nil Extralite::Profiler.stop
+
+    assert_equal true, Extralite::Profiler.start
+    assert_equal true, Extralite::Profiler.running?
+    assert_raises(Extralite::Error) { Extralite::Profiler.start }
+
+    assert_kind_of String, Extralite::Profiler.stop
+    assert_equal false, Extralite::Profiler.running?
+  end
+
+  def test_profiler_bad_interval
+    assert_raises(ArgumentError) { Extralite::Profiler.start(interval_us: 0) }
+    assert_equal false, Extralite::Profiler.running?
+  end
+
+  def test_profiler_samples
+    Extralite::Profiler.start(interval_us: 100)
+    @db.query_single_splat(SLOW_SQL)
+    stacks = Extralite::Profiler.stop
+
+    lines = stacks.lines
+    assert lines.size > 0
+
+    stack, count = lines.first.chomp.split(/ (?=\d+$)/)
+    assert count.to_i > 0
+    caller, sql = stack.split(';')
+    assert_match /test_profiler_samples \(.+test_profiler\.rb:\d+\)/, caller
+    assert_equal SLOW_SQL.gsub(/\s+/, ' ').strip, sql
+
+    # samples are no longer collected after stopping
+    @db.query_single_splat(SLOW_SQL)
+    assert_equal '', (Extralite::Profiler.start && Extralite::Profiler.stop)
+  end
+
+  def test_profiler_with_database_opened_during_profiling
+    Extralite::Profiler.start(interval_us: 100)
+    db = Extralite::Database.new(':memory:')
+    db.query_single_splat(SLOW_SQL)
+    stacks = Extralite::Profiler.stop
+    assert_match /with recursive c\(x\)/, stacks
+  ensure
+    db&.close
+  end
+
+  def test_profiler_with_progress_handler
+    calls = 0
+    @db.on_progress(period: 100) { calls += 1 }
+    Extralite::Profiler.start(interval_us: 100)
+    @db.query_single_splat(SLOW_SQL)
+    stacks = Extralite::Profiler.stop
+    assert_match /with recursive c\(x\)/, stacks
+    assert calls > 0
+
+    # the database progress handler is kept after stopping the profiler
+    calls = 0
+    @db.query_single_splat(SLOW_SQL)
+    assert calls > 0
+  end
+end
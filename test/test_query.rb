@@ -48,10 +48,15 @@ class QueryTest < Minitest::Test
     assert_equal 1, query.next
   end
 
-  def test_prepare_splat_with_too_many_columns
+  def test_prepare_splat_with_many_columns
     q = @db.prepare_splat('select 1, 2, 3, 4, 5, 6, 7, 8, 9')
+    assert_equal (1..9).to_a, q.next
 
-    assert_raises(Extralite::Error) { q.next }
+    sql = "select #{(1..40).map { |i| "#{i} + ?" }.join(', ')}"
+    q = @db.prepare_splat(sql)
+    q.bind(*([0] * 40))
+    assert_equal (1..40).to_a, q.next
+    assert_equal [[(1..40).to_a], [(2..41).to_a]], q.batch_query([[0] * 40, [1] * 40])
   end
 
   def test_prepare_array
@@ -513,6 +518,46 @@ class QueryTest < Minitest::Test
     assert_nil @db.prepare_splat('select :baz').bind(value).next
   end
 
+  def test_parameter_binding_large_frozen_strings
+    text = ('abc' * 10000).freeze
+    blob = ('xyz' * 10000).b.freeze
+    @db.execute('create table big (t, b)')
+    @db.execute('insert into big values (?, ?)', text, blob)
+    @db.batch_execute('insert into big values (?, ?)', [[text, blob], [blob, text]])
+    assert_equal [
+      [text, blob], [text, blob], [blob.dup.force_encoding('UTF-8'), text.b]
+    ], @db.query_array('select t, b from big')
+
+    q = @db.prepare_splat('select length(?)')
+    assert_equal 30000, q.bind(('x' * 30000).freeze).next
+    q.reset
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+    assert_equal 30000, q.next
+    assert_equal 3, q.bind('foo').next
+
+    q = @db.prepare_splat('select ?')
+    q.batch_query([[text], [blob]])
+    q.reset
+    GC.start
+    assert_equal blob, q.next
+  end
+
+  def test_parameter_binding_large_frozen_strings_with_empty_batch
+    q = @db.prepare_splat('select ?')
+    [
+      -> { q.batch_execute([]) },
+      -> { q.batch_query([]) },
+      -> { q.batch_execute(-> { nil }) }
+    ].each do |batch|
+      q.bind(('a' * 30000).freeze)
+      batch.()
+      GC.start
+      10.times { ('b' * 30000).freeze }
+      assert_equal [nil], q.to_a
+    end
+  end
+
   def test_query_columns
     r = @db.prepare("select 'abc' as a, 'def' as b").columns
     assert_equal [:a, :b], r
@@ -966,6 +1011,29 @@ class QueryTest < Minitest::Test
     assert_match(/^\#\<Extralite::Query:0x[0-9a-f]+ #{q.sql.inspect}\>$/, q.inspect)
   end
 
+  Point = Struct.new(:x, :y)
+
+  def test_query_object_mode
+    query = @db.prepare_as(Point, 'select x, y from t where x = ?')
+    assert_equal Point.new(4, 5), query.bind(4).next
+    assert_nil query.next
+
+    assert_equal [[Point.new(1, 2)], [Point.new(7, 8)]], query.batch_query([1, 7])
+
+    clone = query.clone
+    assert_equal :object, clone.mode
+    assert_equal Point, clone.row_class
+
+    query.mode = :array
+    assert_equal [[1, 2]], query.bind(1).to_a
+    query.mode = :object
+    assert_equal [Point.new(1, 2)], query.bind(1).to_a
+
+    assert_nil @query.row_class
+    assert_raises(Extralite::Error) { @query.mode = :object }
+    assert_raises(Extralite::Error) { Extralite::Query.new(@db, 'select 1', :object) }
+  end
+
   def test_query_clone
     q1 = @db.prepare('select x from t')
     q2 = q1.clone
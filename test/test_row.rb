@@ -0,0 +1,105 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'date'
+
+class RowTest < Minitest::Test
+  def setup
+    @db = Extralite::Database.new(':memory:')
+    @db.execute('create table t (a, b, c, d)')
+    @db.execute('insert into t values (1, 2.5, ?, ?)', 'foo', "\x00\xff".b)
+    @db.execute('insert into t values (2, null, ?, ?)', 'é', '')
+  end
+
+  def teardown
+    @db.close
+  end
+
+  def test_query_lazy
+    rows = @db.query_lazy('select * from t order by a')
+    assert_equal 2, rows.size
+    assert_kind_of Extralite::Row, rows.first
+    assert_equal [
+      { a: 1, b: 2.5, c: 'foo', d: "\x00\xff".b },
+      { a: 2, b: nil, c: 'é', d: '' }
+    ], rows.map(&:to_h)
+
+    assert_equal Encoding::UTF_8, rows.last[:c].encoding
+    assert_equal Encoding::ASCII_8BIT, rows.first[:d].encoding
+
+    buf = []
+    @db.query_lazy('select a from t order by a') { |r| buf << r[:a] }
+    assert_equal [1, 2], buf
+
+    assert_equal [2, 4], @db.query_lazy(->(r) { r[:a] * 2 }, 'select a from t order by a')
+  end
+
+  def test_row_access
+    row = @db.query_single_lazy('select * from t where a = ?', 1)
+    assert_equal 2.5, row[:b]
+    assert_equal 2.5, row['b']
+    assert_equal 'foo', row[2]
+    assert_equal 'foo', row[-2]
+    assert_nil row[:foo]
+    assert_nil row['foo_bar_baz_nonexistent']
+    assert_nil row[4]
+
+    assert_same row[:c], row[:c]
+
+    assert_equal 1, row.fetch(:a)
+    assert_raises(KeyError) { row.fetch(:foo) }
+    assert_equal 42, row.fetch(:foo, 42)
+    assert_equal :foo, row.fetch(:foo) { |k| k }
+
+    assert row.key?(:a)
+    assert !row.key?(:foo)
+    assert_equal [:a, :b, :c, :d], row.keys
+    assert_equal [1, 2.5, 'foo', "\x00\xff".b], row.values
+    assert_equal 4, row.size
+
+    assert_equal true, row == { a: 1, b: 2.5, c: 'foo', d: "\x00\xff".b }
+    assert_equal false, row == { a: 1 }
+    assert_equal @db.query_single_lazy('select * from t where a = 1'), row
+    refute_equal @db.query_single_lazy('select * from t where a = 2'), row
+    assert_match(/^#<Extralite::Row \{/, row.inspect)
+  end
+
+  def test_row_outlives_statement
+    q = @db.prepare_lazy('select * from t order by a')
+    rows = q.to_a
+    q.close
+    GC.start
+    assert_equal 'é', rows.last[:c]
+    assert_nil @db.query_single_lazy('select * from t where a = 3')
+  end
+
+  def test_duplicate_column_names
+    row = @db.query_single_lazy('select 1 as x, 2 as x')
+    assert_equal 2, row[:x]
+    assert_equal({ x: 2 }, row.to_h)
+    assert_equal [1, 2], row.values
+  end
+
+  def test_prepare_lazy
+    q = @db.prepare_lazy('select a, c from t where a = ?', 2)
+    assert_equal :lazy, q.mode
+    assert_equal({ a: 2, c: 'é' }, q.next.to_h)
+    assert_nil q.next
+
+    assert_equal [[{ a: 1, c: 'foo' }], [{ a: 2, c: 'é' }]], q.batch_query([1, 2]).map { |rows| rows.map(&:to_h) }
+
+    q = @db.prepare('select a from t order by a')
+    q.mode = :lazy
+    assert_equal [Extralite::Row], q.to_a.map(&:class).uniq
+  end
+
+  def test_lazy_decoding
+    @db.execute('create table d (day date, doc json)')
+    @db.execute('insert into d values (?, ?)', '2024-05-01', '{"x": 1}')
+    @db.decode_types = true
+    @db.decode_json
+    row = @db.query_single_lazy('select * from d')
+    assert_equal Date.new(2024, 5, 1), row[:day]
+    assert_equal({ 'x' => 1 }, row[:doc])
+  end
+end
@@ -0,0 +1,101 @@
+# frozen_string_literal: true
+
+require_relative 'helper'
+require 'tempfile'
+
+class SnapshotTest < Minitest::Test
+  def setup
+    @tmp = Tempfile.new('extralite_test_snapshot')
+    @db = Extralite::Database.new(@tmp.path, wal: true)
+    @db.execute('create table t (x, y)')
+    @db.transaction do
+      @db.batch_execute('insert into t values (?, randomblob(1000))', 1..2000)
+    end
+    @db.execute('delete from t where x > 1000')
+
+    @dir = Dir.mktmpdir
+    @path = File.join(@dir, 'snapshot.db')
+  end
+
+  def teardown
+    @db.close
+    @tmp.close!
+    FileUtils.rm_rf(@dir)
+  end
+
+  def db_size
+    @db.pragma(:page_count) * @db.pragma(:page_size)
+  end
+
+  def assert_snapshot(path)
+    db = Extralite::Database.new(path)
+    assert_equal 1000, db.query_single_splat('select count(*) from t')
+    assert_equal (1..1000).sum, db.query_single_splat('select sum(x) from t')
+  ensure
+    db&.close
+  end
+
+  def test_snapshot_to
+    snapshot = @db.snapshot_to(@path)
+    assert_kind_of Extralite::Snapshot, snapshot
+    assert_equal @path, snapshot.path
+
+    assert_equal @path, snapshot.value
+    assert_equal true, snapshot.done?
+    assert_equal 1.0, snapshot.progress
+    assert_snapshot(@path)
+
+    # compact snapshot drops free pages
+    assert File.size(@path) < db_size
+  end
+
+  def test_snapshot_to_not_compact
+    snapshot = @db.snapshot_to(@path, compact: false)
+    assert_equal true, snapshot.wait
+    assert_equal @path, snapshot.value
+    assert_snapshot(@path)
+    assert_equal db_size, File.size(@path)
+  end
+
+  def test_snapshot_progress_block
+    [true, false].each do |compact|
+      progress = []
+      path = "#{@path}.#{compact}"
+      @db.snapshot_to(path, compact: compact) { |p| progress << p }.value
+      assert_equal 1.0, progress.last
+      assert_equal progress.sort, progress
+    end
+  end
+
+  def test_snapshot_error
+    File.write(@path, 'foo')
+    snapshot = @db.snapshot_to(@path)
+    assert_equal true, snapshot.wait(5)
+    assert_raises(Extralite::Error) { snapshot.value }
+    # existing file is kept
+    assert_equal 'foo', File.read(@path)
+  end
+
+  def test_snapshot_error_in_block
+    snapshot = @db.snapshot_to(@path, compact: false) { raise 'foo' }
+    e = assert_raises(RuntimeError) { snapshot.value }
+    assert_equal 'foo', e.message
+    assert !File.exist?(@path)
+  end
+
+  def test_snapshot_cancel
+    queue = Queue.new
+    snapshot = @db.snapshot_to(@path, compact: false) { |p| queue.pop if p < 1 }
+    snapshot.cancel
+    10.times { queue << true }
+    assert_raises(Extralite::InterruptError) { snapshot.value }
+    assert !File.exist?(@path)
+  end
+
+  def test_snapshot_memory_database
+    db = Extralite::Database.new(':memory:')
+    assert_raises(Extralite::Error) { db.snapshot_to(@path) }
+  ensure
+    db&.close
+  end
+end